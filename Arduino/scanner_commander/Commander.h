@@ -1,6 +1,7 @@
 /*
  valid cmds:
- 'H' = handshake (input H1, response: H1)
+ 'H' = handshake (input H1, response: H1 followed by config report: G, R, C, K, W, F)
+ 'F' = report config hash (hash of R, C, K, W, G - config is saved to EEPROM when changed)
  'R' = set RPM (val 0: report)
  'M' = move one turn (val 0: report is moving)
  'P' = take picture (val 0: report is shooting)
@@ -8,12 +9,15 @@
  'C' = set turns per circle (val 0: report current)
  'K' = set clockwise direction (vals - 0: report current, 1: set cw, 2: set ccw)
  'A' = run autoscan (vals - 0: report autoscan move left, 1: run, 2: stop)
+ 'N' = resume autoscan with N moves left (finishes current move then shoots, or shoots now)
  'W' = set wait (ms) after photo before next move (val 0: report current)
+ 'J' = photo landed, end wait after photo now (val: autoscan moves left when shot was taken, 0 if not autoscanning)
  'G' = set turntable total steps (val 0: report current)
  'I' = report step position
  'S' = move to step
  'D' = move to degree
  'Q' = flush cmdQueue (0: report # cmds in queue, other: flush)
+ 'Z' = report loop timing stats frame (0: report, 1: report + reset) - see LoopProfiler.h
  
 
  error code reporting:
@@ -22,9 +26,11 @@
  E2 = invalid cmd (unrecognized)
  E3 = invalid val
  E4 = command queue overflow (too many commands without running them)
- E5 = output queue overflow (too many outputs queued without sending)
+ E5 = output queue overflow (no longer sent: a full queue is written out first, replies are never dropped)
 */
 
+#pragma once
+
 #define ERR 'E'
 #define INVALID_BUFFER 0 
 #define BUFFER_OVERFLOW 1
@@ -35,6 +41,7 @@
 
 const int maxBufLen = 10; // 10 chars: 1 cmd char + 9 digits unsigned long
 const int maxQueueLen = 20; // max cmds to store in cmdQueue or outQueue
+const int maxOutBytes = 64; // max bytes written to serial per sendOutQueue() (size of TX buffer)
 
 // global struct for custom cmd/val pair
 struct cmdVal {
@@ -51,8 +58,8 @@ public:
     memset(buf,0,sizeof(buf)); // init buff to 0
   }
 
-  bool serialBegin() { Serial.begin(baudRate); while(!Serial){} }
-  bool serialBegin(long baud) { baudRate = baud; serialBegin(); }
+  bool serialBegin() { Serial.begin(baudRate); while(!Serial){} return true; }
+  bool serialBegin(long baud) { baudRate = baud; return serialBegin(); }
 
   void setEndChar(char ec) { endChar = ec; } //set the char to end a comm/val pair, default is '\n' (newline)
   char getEndChar() { return endChar; } // returns current endChar
@@ -73,8 +80,10 @@ public:
   
   /* OUTPUT */
   
-  void queueOut(char cmd, unsigned long val);                   // queue a cmdVal pair for output to serial
-  void sendOutQueue();                                          // send all cmdVal pairs in output queue
+  void queueOut(char cmd, unsigned long val, bool collapse = true); // queue a cmdVal pair for output to serial
+                                                                //   collapse: drop an already queued pair w/ same cmd, new one goes to the back
+  void sendOutQueue();                                          // send queued cmdVal pairs as one write (as many as fit in TX buffer)
+  void sendAllOut();                                            // send every queued pair, blocks on TX buffer room (before blocking work, full queue)
   void sendCmd(char cmd, unsigned long val)                     // immediately send single cmdVal pair to serial
     { Serial.print(cmd); Serial.print(val); Serial.print(endChar); }
     
@@ -86,6 +95,7 @@ public:
 private:
 
   cmdVal cvtBufferToCmdVal (char * buf, int bufLen);  // returns cmdVal.cmd == 0 if invalid
+  int cvtCmdValToBuffer (cmdVal cv, char * out);      // writes cmd, val digits + endChar to out, returns # chars
   
   void addToCmdQueue (char cmd, unsigned long val); // add a cmd val pair to cmdQueue
 
@@ -120,13 +130,9 @@ void Commander::parseAllIncoming() {
       cmdVal cv = cvtBufferToCmdVal(buf, bufLen);   // convert buffer to cmdVal (char and unsigned long)
 
       if (cv.cmd != 0){
-        if (cv.cmd == 'H' && cv.val == 1) { // handshake, send response
-          sendCmd('H',1);
-        } else {
-          addToCmdQueue(cv.cmd, cv.val);  // add to queue 
-        }
+        addToCmdQueue(cv.cmd, cv.val);  // add to queue 
       } else {
-        sendCmd(ERR,INVALID_BUFFER); // report error on serial
+        queueOut(ERR,INVALID_BUFFER,false); // report error on serial
       }
       // clear buffer, start fresh
       memset(buf,0,sizeof(buf));  // init to 0
@@ -142,7 +148,7 @@ void Commander::parseAllIncoming() {
         memset(buf,0,sizeof(buf));  // init to 0
         bufLen = 0;
 
-        sendCmd(ERR,BUFFER_OVERFLOW);   // send error code to serial
+        queueOut(ERR,BUFFER_OVERFLOW,false);   // send error code to serial
 
         // read serial until we hit an endChar to clear junk
         
@@ -192,6 +198,27 @@ cmdVal Commander::cvtBufferToCmdVal (char * buf, int bufLen) {
 }
 
 
+// converts cmdVal to chars for output (cmd, val digits, endChar)
+// ---------------------------------
+
+int Commander::cvtCmdValToBuffer (cmdVal cv, char * out) {
+
+  char digits[10]; // unsigned long is at most 10 digits
+  int nDigits = 0;
+  unsigned long val = cv.val;
+  do {
+    digits[nDigits++] = '0' + (val % 10);
+    val /= 10;
+  } while (val > 0);
+
+  int len = 0;
+  out[len++] = cv.cmd;
+  while (nDigits > 0) out[len++] = digits[--nDigits]; // reverse into out
+  out[len++] = endChar;
+  return len;
+}
+
+
 // returns next cmdVal pair in queue
 // ---------------------------------
 
@@ -216,11 +243,22 @@ void Commander::getNextCmdVal(char* cmd, unsigned long* val){
 // queues an output cmdVal
 // ---------------------------------
 
-void Commander::queueOut (char cmd, unsigned long val) {
+void Commander::queueOut (char cmd, unsigned long val, bool collapse) {
 
-  if (numOuts >= maxQueueLen) { // outQueue overflow
-    flushOutQueue();
-    sendCmd(ERR,OUTQUEUE_OVERFLOW); // E4 == error code for output queue overflow
+  if (collapse) { // status report - only the latest val matters
+    for (int i=0; i<numOuts; i++){
+      if (outQueue[i].cmd == cmd) {
+        // remove the old pair, new val is queued behind everything queued since (never jumps ahead of them)
+        for (int j=i+1; j<numOuts; j++) outQueue[j-1] = outQueue[j];
+        numOuts--;
+        outQueue[numOuts].cmd = 0; outQueue[numOuts].val = 0;
+        break;
+      }
+    }
+  }
+
+  if (numOuts >= maxQueueLen) { // outQueue full: wait for TX room rather than lose a reply the host waits on (M0, P1, ...)
+    sendAllOut();
   }
   outQueue[numOuts].cmd = cmd;
   outQueue[numOuts].val = val;
@@ -229,12 +267,51 @@ void Commander::queueOut (char cmd, unsigned long val) {
 }
 
 
-// sends all queued output cmdVals to serial, clears queue
+// sends queued output cmdVals to serial in a single write, clears sent pairs
+//   only sends what fits in the TX buffer so Serial.write() never blocks,
+//   anything left over stays queued for the next call
 // ---------------------------------
 
 void Commander::sendOutQueue() {
+
+  if (numOuts == 0) return;
+
+  int room = Serial.availableForWrite();
+  if (room > maxOutBytes) room = maxOutBytes;
+
+  char out[maxOutBytes];
+  int outLen = 0;
+  int nSent = 0;
+
+  while (nSent < numOuts) {
+    char pair[maxBufLen+2]; // cmd + up to 10 digits + endChar
+    int pairLen = cvtCmdValToBuffer(outQueue[nSent], pair);
+    if (outLen + pairLen > room) break; // TX buffer full, wait for next loop
+    memcpy(out+outLen, pair, pairLen);
+    outLen += pairLen;
+    nSent++;
+  }
+
+  if (outLen > 0) Serial.write((const uint8_t*)out, outLen);
+
+  // shift unsent pairs to front of queue
+  for (int i=nSent; i<numOuts; i++){
+    outQueue[i-nSent] = outQueue[i];
+  }
+  numOuts -= nSent;
+  memset(outQueue+numOuts, 0, sizeof(cmdVal)*(maxQueueLen-numOuts));
+}
+
+
+// sends every queued output cmdVal, Serial.write() blocks while the TX buffer is full
+// ---------------------------------
+
+void Commander::sendAllOut() {
+
   for (int i=0; i<numOuts; i++){
-    sendCmd(outQueue[i].cmd,outQueue[i].val);
+    char pair[maxBufLen+2];
+    int pairLen = cvtCmdValToBuffer(outQueue[i], pair);
+    Serial.write((const uint8_t*)pair, pairLen);
   }
   flushOutQueue();
 }
@@ -250,7 +327,7 @@ void Commander::addToCmdQueue (char cmd, unsigned long val){
   if (numCmds >= maxQueueLen){
     // clear queue
     flushCmdQueue();
-    sendCmd (ERR,CMDQUEUE_OVERFLOW); // E3 == error code for cmdQueue overflow
+    queueOut(ERR,CMDQUEUE_OVERFLOW,false); // E4 == error code for cmdQueue overflow
   }
   
   // add cmd val pair to queue in appropriate spot
@@ -0,0 +1,98 @@
+/*
+ loop() timing stats, per section of loop (micros() based, 4us resolution on 16MHz AVR)
+
+ usage:
+   profiler.beginLoop();
+   ... section 0 ... profiler.lap(0);
+   ... section 1 ... profiler.lap(1);
+   profiler.endLoop();
+
+ reported by 'Z' cmd as a frame of Z pairs, val = field * 100000000 + value (value capped at 99999999):
+   Z0xxxxxxxx = # loops since reset
+   Z1xxxxxxxx = avg loop time (us)
+   Z2xxxxxxxx = max loop time (us)
+   Z3xxxxxxxx = longest section # (see scanner_commander.ino)
+   Z4xxxxxxxx = longest section max time (us)
+   Z5xxxxxxxx .. Z8xxxxxxxx = max time (us) of sections 0-3
+   Z9xxxxxxxx = serial RX high-water mark (bytes waiting before parse)
+*/
+
+const int numProfiledSections = 4;
+const unsigned long statsFieldMult = 100000000UL; // field # goes above 8 value digits
+const unsigned long statsValueMax = 99999999UL;
+
+class LoopProfiler {
+
+public:
+
+  LoopProfiler() { reset(); }
+
+  void beginLoop() { loopStart = lapStart = micros(); }
+  void lap(int section);                          // end of section, starts timing next one
+  void endLoop();
+  void sampleRx(int available) { if (available > rxHighWater) rxHighWater = available; }
+
+  void reset();
+
+  unsigned long getNumLoops() { return numLoops; }
+  unsigned long getAvgLoop() { return (numLoops > 0) ? loopSum / numLoops : 0; }
+  unsigned long getMaxLoop() { return loopMax; }
+  unsigned long getSectionMax(int section) { return sectionMax[section]; }
+  int getLongestSection();                        // section w/ highest max time
+  int getRxHighWater() { return rxHighWater; }
+
+  int getNumStatsFields() { return 10; }
+  unsigned long getStatsField(int field);         // packed field for 'Z' report
+
+private:
+
+  unsigned long loopStart = 0;
+  unsigned long lapStart = 0;
+  unsigned long numLoops = 0;
+  unsigned long loopSum = 0; // for avg, halved w/ numLoops before it can overflow
+  unsigned long loopMax = 0;
+  unsigned long sectionMax[numProfiledSections];
+  int rxHighWater = 0;
+
+};
+
+void LoopProfiler::lap(int section) {
+  unsigned long now = micros();
+  unsigned long t = now - lapStart;
+  if (t > sectionMax[section]) sectionMax[section] = t;
+  lapStart = now;
+}
+
+void LoopProfiler::endLoop() {
+  unsigned long t = micros() - loopStart;
+  if (t > loopMax) loopMax = t;
+  if (loopSum > 0x7FFFFFFFUL) { loopSum /= 2; numLoops /= 2; } // keep avg, avoid overflow
+  loopSum += t;
+  numLoops++;
+}
+
+void LoopProfiler::reset() {
+  numLoops = 0; loopSum = 0; loopMax = 0; rxHighWater = 0;
+  for (int i=0; i<numProfiledSections; i++) sectionMax[i] = 0;
+}
+
+int LoopProfiler::getLongestSection() {
+  int longest = 0;
+  for (int i=1; i<numProfiledSections; i++) {
+    if (sectionMax[i] > sectionMax[longest]) longest = i;
+  }
+  return longest;
+}
+
+unsigned long LoopProfiler::getStatsField(int field) {
+  unsigned long val = 0;
+  if (field == 0) val = numLoops;
+  else if (field == 1) val = getAvgLoop();
+  else if (field == 2) val = loopMax;
+  else if (field == 3) val = getLongestSection();
+  else if (field == 4) val = sectionMax[getLongestSection()];
+  else if (field >= 5 && field <= 8) val = sectionMax[field-5];
+  else if (field == 9) val = rxHighWater;
+  if (val > statsValueMax) val = statsValueMax;
+  return field * statsFieldMult + val;
+}
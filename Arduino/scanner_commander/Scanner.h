@@ -1,5 +1,21 @@
 #pragma once
 #include <CheapStepper.h>
+#include <EEPROM.h>
+
+const int configAddress = 0; // EEPROM address of saved config
+const unsigned int configMagic = 0x3D5C; // marks EEPROM as holding a saved config
+const unsigned long configSaveDelay = 1000; // ms a changed config has to stay unchanged before it's written
+
+// config saved to EEPROM, restored on boot
+struct scannerConfig {
+  unsigned int magic = 0;
+  int rpm = 10;
+  int turnsPerCircle = 64;
+  bool clockwise = true;
+  unsigned long waitAfterPhoto = 3000;
+  int turntableRotationSteps = 4096;
+  unsigned long hash = 0; // config hash, doubles as checksum
+};
 
 class Scanner {
 
@@ -22,7 +38,9 @@ public:
 
   void startAutoscan();
   void stopAutoscan(); // cancel autoscan
+  void resumeAutoscan(int movesLeft); // continue autoscan w/ movesLeft from current state (finishes move, then shoots)
   void takePhoto();
+  void photoLanded(); // host saw the photo file arrive, photo is done (waitAfterPhoto becomes a timeout)
   void turn(); // intiate one turn
   void rotateTurntable(); // rotate continuously
 
@@ -78,6 +96,12 @@ public:
 
   void forceCameraReady(); // cancels move and finishes photo if any, then bMoving & bShooting = false
 
+  /* persist config (rpm, turns per circle, direction, wait, rotation steps) */
+  bool loadConfig(); // restore config from EEPROM, false if none saved (keeps current)
+  void saveConfig(); // write config to EEPROM now (only changed bytes are written, ~3.3ms each)
+  void saveConfigLater(); // write once it's been unchanged for configSaveDelay and the motor is idle (slider drags = one write)
+  unsigned long getConfigHash(); // FNV-1a hash of config, matches host Scanner::hashConfig()
+
   /* return pin #s */
   int getIrLedPin() { return irLedPin; }
   int getCamLedPin() { return camLedPin; }
@@ -88,7 +112,11 @@ public:
 private:
 
   void calcStepsPerTurn(); // turnsPerCircle -> stepsPerTurn
+  scannerConfig getConfig(); // current config (magic + hash left empty)
+  unsigned long hashConfig(scannerConfig config); // FNV-1a hash of config fields
+  void hashConfigVal(unsigned long* hash, unsigned long val); // add val to FNV-1a hash, 4 bytes little endian
   void triggerCamera(); // send IR code to camera
+  bool isPhotoDone() { return bPhotoLanded || millis() - photoStart > waitAfterPhoto; }
   void continueAutoscan(); // continue autoscanning
 
   int stepperPins[4] = {8,9,10,11}; // 8-11 <--> ULN2003 IN1-IN4
@@ -110,7 +138,11 @@ private:
 
   bool bChanged = false;
 
+  bool bConfigDirty = false; // saveConfigLater() called, not written yet
+  unsigned long configChangedAt = 0; // millis() of the last saveConfigLater()
+
   unsigned long photoStart = 0; // saves millis() time when last photo triggered
+  bool bPhotoLanded = false; // host confirmed last photo arrived
 
 };
 
@@ -128,6 +160,11 @@ bool Scanner::update() {
 
   bChanged = false;
 
+  // debounced config save, never mid-move (EEPROM writes block the stepper)
+  if (bConfigDirty && !bMoving && millis() - configChangedAt > configSaveDelay) {
+    saveConfig();
+  }
+
   if (autoscanMovesLeft > 0) { // autoscanning
     continueAutoscan();
     return bChanged;
@@ -153,7 +190,7 @@ bool Scanner::update() {
 
   else if (bShooting) { // mid-photo?
 
-    if (millis() - photoStart > waitAfterPhoto) { // is photo done?
+    if (isPhotoDone()) { // is photo done?
       bShooting = false;
       bChanged = true;
     }
@@ -171,6 +208,12 @@ void Scanner::startAutoscan() {
   autoscanMovesLeft = turnsPerCircle; // init autoscan
 }
 
+void Scanner::resumeAutoscan(int movesLeft) {
+  // unlike startAutoscan(), doesn't cancel a move in progress -
+  // host re-issues the move after the last confirmed shot, then resumes
+  autoscanMovesLeft = movesLeft;
+}
+
 void Scanner::stopAutoscan() { // cancel autoscan
   forceCameraReady(); // cancels move and finishes photo, if any
   autoscanMovesLeft = 0;
@@ -179,14 +222,19 @@ void Scanner::stopAutoscan() { // cancel autoscan
 void Scanner::takePhoto() { // trigger photo
   if (bShooting) { // mid-photo?
     unsigned long wait = 0; // calc time to wait for photo to finish
-    if (millis() - photoStart < waitAfterPhoto) { wait = waitAfterPhoto - (millis() - photoStart); }
+    if (!isPhotoDone()) { wait = waitAfterPhoto - (millis() - photoStart); }
     delay(wait);
   }
   triggerCamera();
   photoStart = millis();
+  bPhotoLanded = false;
   bShooting = true;
 }
 
+void Scanner::photoLanded() {
+  if (bShooting) bPhotoLanded = true;
+}
+
 void Scanner::turn() { // intiate one turn
   stepper.newMove(bClockwise, stepsPerTurn);
   bMoving = true;
@@ -202,7 +250,7 @@ void Scanner::forceCameraReady() {
   }
   if (bShooting) { // mid-photo?
     unsigned long wait = 0; // calc time to wait for photo to finish
-    if (millis() - photoStart < waitAfterPhoto) { wait = waitAfterPhoto - (millis() - photoStart); }
+    if (!isPhotoDone()) { wait = waitAfterPhoto - (millis() - photoStart); }
     delay(wait);
   }
   bMoving = false; bShooting = false;
@@ -215,11 +263,75 @@ void Scanner::setTurntableRotationSteps(int steps) {
   calcStepsPerTurn();
 }
 
+bool Scanner::loadConfig() {
+
+  scannerConfig config;
+  EEPROM.get(configAddress, config);
+  if (config.magic != configMagic) return false; // nothing saved yet
+  if (hashConfig(config) != config.hash || config.turnsPerCircle <= 0 || config.turntableRotationSteps <= 0) return false; // corrupt
+
+  setTurntableRotationSteps(config.turntableRotationSteps); // applies to stepper + recalcs stepsPerTurn
+  setTurnsPerCircle(config.turnsPerCircle);
+  setMotorRpm(config.rpm);
+  setClockwise(config.clockwise);
+  setWaitAfterPhoto(config.waitAfterPhoto);
+  return true;
+}
+
+void Scanner::saveConfig() {
+
+  scannerConfig config = getConfig();
+  config.magic = configMagic;
+  config.hash = hashConfig(config);
+  EEPROM.put(configAddress, config); // put() uses update(), unchanged bytes aren't rewritten
+  bConfigDirty = false;
+}
+
+void Scanner::saveConfigLater() {
+
+  bConfigDirty = true;
+  configChangedAt = millis(); // each new set restarts the wait
+}
+
+unsigned long Scanner::getConfigHash() {
+  return hashConfig(getConfig());
+}
+
 
 // -----------------
 // PRIVATE functions
 // -----------------
 
+scannerConfig Scanner::getConfig() {
+
+  scannerConfig config;
+  config.rpm = getMotorRpm();
+  config.turnsPerCircle = turnsPerCircle;
+  config.clockwise = bClockwise;
+  config.waitAfterPhoto = waitAfterPhoto;
+  config.turntableRotationSteps = turntableRotationSteps;
+  return config;
+}
+
+unsigned long Scanner::hashConfig(scannerConfig config) {
+
+  // field order + widths must match Scanner::hashConfig() on the host
+  unsigned long hash = 2166136261UL; // FNV-1a offset basis
+  hashConfigVal(&hash, config.rpm);
+  hashConfigVal(&hash, config.turnsPerCircle);
+  hashConfigVal(&hash, config.clockwise ? 1:0);
+  hashConfigVal(&hash, config.waitAfterPhoto);
+  hashConfigVal(&hash, config.turntableRotationSteps);
+  return hash;
+}
+
+void Scanner::hashConfigVal(unsigned long* hash, unsigned long val) {
+  for (int i=0; i<4; i++) {
+    *hash ^= (val >> (8*i)) & 0xFF;
+    *hash = (*hash * 16777619UL) & 0xFFFFFFFFUL; // FNV prime, keep 32 bit on any platform
+  }
+}
+
 void Scanner::calcStepsPerTurn() {
   // determine how many motor microsteps per turn to take (according to turnsPerCircle)
   unsigned long stepsPerTurnX100 = (unsigned long) turntableRotationSteps * 100 / (unsigned long) turnsPerCircle; // 4096 *100 to add 2 decimal place precision
@@ -258,7 +370,7 @@ void Scanner::continueAutoscan() { // continue autoscan
     else if (bShooting) { // mid-shot?
 
       if (camLedPin != 0) { digitalWrite(camLedPin, LOW); } // cam not ready
-      if (millis() - photoStart > waitAfterPhoto) { // if we've waited long enough for photo to finish
+      if (isPhotoDone()) { // if photo landed or we've waited long enough for photo to finish
 
         bShooting = false;
         bChanged = true;
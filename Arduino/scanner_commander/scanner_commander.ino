@@ -1,8 +1,16 @@
 #include "Scanner.h"
 #include "Commander.h"
+#include "LoopProfiler.h"
+
+// profiled sections of loop()
+#define SECTION_UPDATE 0
+#define SECTION_COMMANDS 1
+#define SECTION_PARSE 2
+#define SECTION_SEND 3
 
 Commander commander; // serial cmd/val IO
 Scanner scanner; // scanner control
+LoopProfiler profiler; // loop() timing stats
 
 void setup() {
   
@@ -10,13 +18,17 @@ void setup() {
   scanner.setIrLedPin(12);
   scanner.setCamLedPin(13); // onboard led
   scanner.setTurntableRotationSteps(16384); // motor:turntable gearing 1:4
+  scanner.loadConfig(); // restore saved config, if any (overrides defaults above)
 }
 
 void loop() {
 
+  profiler.beginLoop();
+
   if (scanner.update()){
     sendUpdate();
   }
+  profiler.lap(SECTION_UPDATE);
 
   // run all commands in commander's cmd queue
   while (commander.haveCmds()) {
@@ -24,46 +36,83 @@ void loop() {
     commander.getNextCmdVal(&cmd,&val); // grabs from & empties queue
     runCommand(cmd,val);
   }
+  profiler.lap(SECTION_COMMANDS);
 
   // get all new commands from serial, move to queue
+  profiler.sampleRx(Serial.available());
   commander.parseAllIncoming();
-  
+  profiler.lap(SECTION_PARSE);
+
+  // send all replies queued this loop in one write
+  commander.sendOutQueue();
+  profiler.lap(SECTION_SEND);
+
+  profiler.endLoop();
 }
 
 void sendUpdate(){
-  commander.sendCmd('A', scanner.getAutoscanMovesLeft());
-  commander.sendCmd('S', scanner.getStepperPos());
-  commander.sendCmd('M', (scanner.isMoving() ? 1:0));
-  commander.sendCmd('P', (scanner.isShooting() ? 1:0));
+  commander.queueOut('A', scanner.getAutoscanMovesLeft());
+  commander.queueOut('S', scanner.getStepperPos());
+  commander.queueOut('M', (scanner.isMoving() ? 1:0));
+  commander.queueOut('P', (scanner.isShooting() ? 1:0));
+}
+
+void sendConfig(){
+  commander.queueOut('G', scanner.getTurntableRotationSteps());
+  commander.queueOut('R', scanner.getMotorRpm());
+  commander.queueOut('C', scanner.getTurnsPerCircle());
+  commander.queueOut('K', scanner.getClockwise());
+  commander.queueOut('W', scanner.getWaitAfterPhoto());
+  commander.queueOut('F', scanner.getConfigHash());
+}
+
+void sendStats(){
+  for (int i=0; i<profiler.getNumStatsFields(); i++){
+    commander.queueOut('Z', profiler.getStatsField(i), false); // frame, don't collapse
+  }
 }
 
 void runCommand(char cmd, unsigned long val) {
 
   // parse, run command, send report
 
-  if (cmd == 'R'){ // set motor RPM
-    if (val > 0) scanner.setMotorRpm(val); // set
-    commander.sendCmd('R', scanner.getMotorRpm()); // report
+  if (cmd == 'H'){ // handshake
+    if (val == 1) {
+      commander.queueOut('H', 1);
+      sendConfig(); // lets host diff its config against ours in one round trip
+    }
+  }
+  else if (cmd == 'F'){ // report config hash
+    commander.queueOut('F', scanner.getConfigHash());
+  }
+  else if (cmd == 'R'){ // set motor RPM
+    if (val > 0) { scanner.setMotorRpm(val); scanner.saveConfigLater(); } // set
+    commander.queueOut('R', scanner.getMotorRpm()); // report
   }
   else if (cmd == 'M'){ // turn
     if (val > 0) scanner.turn();
-    commander.sendCmd('M', (scanner.isMoving() ? 1:0)); // report
+    commander.queueOut('M', (scanner.isMoving() ? 1:0)); // report
   }
   else if (cmd == 'P'){ // take picture
     if (val > 0) scanner.takePhoto();
-    commander.sendCmd('P', (scanner.isShooting() ? 1:0)); // report
+    commander.queueOut('P', (scanner.isShooting() ? 1:0)); // report
+  }
+  else if (cmd == 'J'){ // photo landed on host, stop waiting
+    // ignore late confirmations for an earlier autoscan shot
+    if (val == (unsigned long)scanner.getAutoscanMovesLeft()) scanner.photoLanded();
+    commander.queueOut('P', (scanner.isShooting() ? 1:0)); // report
   }
   else if (cmd == 'T'){ // rotate turntable
     scanner.rotateTurntable();
-    commander.sendCmd('S', scanner.getStepperPos()); // report current step
+    commander.queueOut('S', scanner.getStepperPos()); // report current step
   }
   else if (cmd == 'C'){ // set # turns per circle
-    if (val > 0) scanner.setTurnsPerCircle(val); // set
-    commander.sendCmd('C', scanner.getTurnsPerCircle()); // report
+    if (val > 0) { scanner.setTurnsPerCircle(val); scanner.saveConfigLater(); } // set
+    commander.queueOut('C', scanner.getTurnsPerCircle()); // report
   }
   else if (cmd == 'K'){ // set clockwise/ccw
-    if (val == 1 || val == 0) scanner.setClockwise(val); // 1 for cw, 0 for ccw
-    commander.sendCmd('K', scanner.getClockwise()); // report
+    if (val == 1 || val == 0) { scanner.setClockwise(val); scanner.saveConfigLater(); } // 1 for cw, 0 for ccw
+    commander.queueOut('K', scanner.getClockwise()); // report
   }
   else if (cmd == 'A'){ // start autoscan
     if (val == 1) scanner.startAutoscan(); // 1 for start
@@ -71,31 +120,40 @@ void runCommand(char cmd, unsigned long val) {
       scanner.stopAutoscan(); // 0 for stop
       sendUpdate();
     }
-    commander.sendCmd('A', scanner.getAutoscanMovesLeft()); // report # moves left in autoscan
+    commander.queueOut('A', scanner.getAutoscanMovesLeft()); // report # moves left in autoscan
+  }
+  else if (cmd == 'N'){ // resume autoscan w/ # moves left (after host reconnect)
+    if (val > 0) scanner.resumeAutoscan(val);
+    commander.queueOut('A', scanner.getAutoscanMovesLeft()); // report
   }
   else if (cmd == 'W'){ // set wait (ms) after photo before next move
-    if (val > 0) scanner.setWaitAfterPhoto(val);
-    commander.sendCmd('W', scanner.getWaitAfterPhoto()); // report
+    if (val > 0) { scanner.setWaitAfterPhoto(val); scanner.saveConfigLater(); }
+    commander.queueOut('W', scanner.getWaitAfterPhoto()); // report
   }
   else if (cmd == 'G'){ // set # steps in turntable rotation
-    if (val> 0) scanner.setTurntableRotationSteps(val);
-    commander.sendCmd('G', scanner.getTurntableRotationSteps());
+    if (val> 0) { scanner.setTurntableRotationSteps(val); scanner.saveConfigLater(); }
+    commander.queueOut('G', scanner.getTurntableRotationSteps());
   }
   else if (cmd == 'S'){ // move stepper to step pos
-    commander.sendCmd('M', 1); // moving
+    commander.queueOut('M', 1); // moving
+    commander.sendAllOut(); // move blocks, let host know now (all of it, not just what fits the TX buffer)
     scanner.moveToStep(val);
-    commander.sendCmd('M', 0); // stopped
-    commander.sendCmd('S', scanner.getStepperPos());
+    commander.queueOut('M', 0); // stopped
+    commander.queueOut('S', scanner.getStepperPos());
   }
   else if (cmd == 'I'){ // return stepper step pos
-    commander.sendCmd('S', scanner.getStepperPos());
+    commander.queueOut('S', scanner.getStepperPos());
+  }
+  else if (cmd == 'Z'){ // report loop timing stats (val 1: report then reset)
+    sendStats();
+    if (val == 1) profiler.reset();
   }
   else if (cmd == 'Q'){ // return number cmds in queue or flush queue
     if (val > 0) commander.flushCmdQueue(); // flush
-    commander.sendCmd('Q', commander.getNumCmds()); // report #
+    commander.queueOut('Q', commander.getNumCmds()); // report #
   }
   else {
-    commander.sendCmd(ERR,INVALID_CMD); // send invalid command error code (E4)
+    commander.queueOut(ERR,INVALID_CMD,false); // send invalid command error code (E2)
   }
   
 }
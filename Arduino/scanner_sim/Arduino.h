@@ -0,0 +1,134 @@
+/*
+ Arduino core stand-in for scanner_sim: virtual clock + modeled serial port
+
+ - time only moves when the sketch spends it: delay(), delayMicroseconds(),
+   pin writes, serial reads + writes, each command run, and a fixed overhead
+   per loop() (see scanner_sim.cpp)
+ - serial RX/TX buffers are 64 bytes like an Uno, bytes move at the baud rate,
+   writing to a full TX buffer blocks (advances the clock) like the real core
+*/
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <deque>
+#include <string>
+
+#define OUTPUT 1
+#define INPUT 0
+#define HIGH 1
+#define LOW 0
+
+typedef uint8_t byte;
+
+// cost (us) of core calls on a 16MHz AVR, roughly
+const unsigned long simPinWriteUs = 4;
+const unsigned long simSerialReadUs = 2;
+const unsigned long simSerialWriteUs = 3; // per byte into the TX ring buffer (interrupts off + index math)
+const unsigned long simCommandUs = 40; // dispatch + reply queueing (32 bit compares / copies), per command run
+
+struct SimClock {
+  uint64_t nowUs = 0;
+  void advance(uint64_t us) { nowUs += us; }
+};
+static SimClock simClock;
+
+inline unsigned long micros() { return (unsigned long)simClock.nowUs; }
+inline unsigned long millis() { return (unsigned long)(simClock.nowUs / 1000); }
+inline void delay(unsigned long ms) { simClock.advance((uint64_t)ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { simClock.advance(us); }
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) { simClock.advance(simPinWriteUs); }
+
+struct SimTxByte {
+  uint64_t timeUs; // when byte finished sending
+  char c;
+};
+
+class SimSerial {
+
+public:
+
+  static const int bufSize = 64; // SERIAL_RX/TX_BUFFER_SIZE on an Uno
+
+  void begin(long baud) { byteUs = 10000000UL / baud; } // 10 bits per byte (start + 8 + stop)
+  operator bool() { return true; }
+
+  // host side: queue bytes to arrive starting at timeUs
+  void inject(uint64_t timeUs, const std::string& data) {
+    uint64_t t = (timeUs > lastArrivalUs) ? timeUs : lastArrivalUs;
+    for (size_t i=0; i<data.size(); i++) {
+      t += byteUs;
+      incoming.push_back(SimTxByte{t, data[i]});
+    }
+    lastArrivalUs = t;
+  }
+
+  int available() { receive(); return (int)rx.size(); }
+  int read() {
+    simClock.advance(simSerialReadUs);
+    receive();
+    if (rx.empty()) return -1;
+    char c = rx.front(); rx.pop_front();
+    return (unsigned char)c;
+  }
+
+  int availableForWrite() { drain(); return bufSize - 1 - (int)tx.size(); }
+  size_t write(uint8_t c) {
+    simClock.advance(simSerialWriteUs);
+    drain();
+    if ((int)tx.size() >= bufSize - 1) { // full, blocks until a byte goes out
+      uint64_t wait = tx.front().timeUs - simClock.nowUs;
+      simClock.advance(wait);
+      txBlockedUs += wait;
+      if (wait > txBlockedMaxUs) txBlockedMaxUs = wait;
+      drain();
+    }
+    uint64_t start = tx.empty() ? simClock.nowUs : tx.back().timeUs;
+    tx.push_back(SimTxByte{start + byteUs, (char)c});
+    return 1;
+  }
+  size_t write(const uint8_t* buf, size_t len) {
+    for (size_t i=0; i<len; i++) write(buf[i]);
+    return len;
+  }
+  template<class T> void print(T val) { std::string s = toString(val); write((const uint8_t*)s.c_str(), s.size()); }
+
+  void drain() { // move sent bytes out of TX buffer
+    while (!tx.empty() && tx.front().timeUs <= simClock.nowUs) {
+      sent.push_back(tx.front());
+      tx.pop_front();
+    }
+  }
+
+  std::deque<SimTxByte> sent; // bytes that left the TX buffer (after drain()), read by scanner_sim.cpp
+  uint64_t txBlockedUs = 0; // total time write() blocked on a full TX buffer
+  uint64_t txBlockedMaxUs = 0;
+  unsigned long rxDropped = 0; // bytes lost to RX buffer overflow
+
+private:
+
+  void receive() { // move arrived bytes into RX buffer
+    while (!incoming.empty() && incoming.front().timeUs <= simClock.nowUs) {
+      if ((int)rx.size() < bufSize - 1) rx.push_back(incoming.front().c);
+      else rxDropped++;
+      incoming.pop_front();
+    }
+  }
+  static std::string toString(char c) { return std::string(1, c); }
+  static std::string toString(unsigned long v) { return std::to_string(v); }
+  static std::string toString(long v) { return std::to_string(v); }
+  static std::string toString(int v) { return std::to_string(v); }
+  static std::string toString(unsigned int v) { return std::to_string(v); }
+
+  unsigned long byteUs = 87; // 115200 baud
+  uint64_t lastArrivalUs = 0;
+  std::deque<SimTxByte> incoming;
+  std::deque<char> rx;
+  std::deque<SimTxByte> tx;
+
+};
+
+static SimSerial Serial;
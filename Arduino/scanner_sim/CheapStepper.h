@@ -0,0 +1,58 @@
+/*
+ CheapStepper stand-in for scanner_sim: same API the sketch uses,
+ steps take (virtual) time per the rpm, position tracked like the real lib
+*/
+
+#pragma once
+#include "Arduino.h"
+
+class CheapStepper {
+
+public:
+
+  CheapStepper() {}
+  CheapStepper(int p1, int p2, int p3, int p4) { pins[0] = p1; pins[1] = p2; pins[2] = p3; pins[3] = p4; }
+
+  void setTotalSteps(int steps) { totalSteps = steps; }
+  void setRpm(int rpm) { delay = 60000000UL / ((unsigned long)totalSteps * rpm); }
+  int getRpm() { return 60000000UL / (delay * (unsigned long)totalSteps); }
+  int getStep() { return stepN; }
+  int getStepsLeft() { return stepsLeft; }
+  int getPin(int p) { return pins[p]; }
+
+  void newMove(bool clockwise, unsigned long numSteps) { moveClockwise = clockwise; stepsLeft = numSteps; lastStepTime = micros(); }
+  void run() { // non-blocking, steps if it's time
+    if (stepsLeft > 0 && micros() - lastStepTime >= delay) {
+      step(moveClockwise);
+      stepsLeft--;
+      lastStepTime = micros();
+    }
+  }
+  void stop() { stepsLeft = 0; }
+
+  void move(bool clockwise, int numSteps) { // blocking
+    for (int i=0; i<numSteps; i++) { step(clockwise); delayMicroseconds(delay); }
+  }
+  void moveTo(bool clockwise, int toStep) { // blocking
+    toStep %= totalSteps;
+    while (stepN != toStep) { step(clockwise); delayMicroseconds(delay); }
+  }
+
+private:
+
+  void step(bool clockwise) {
+    for (int i=0; i<4; i++) digitalWrite(pins[i], LOW); // 4 coil writes per step
+    stepN += clockwise ? 1 : -1;
+    if (stepN >= totalSteps) stepN = 0;
+    else if (stepN < 0) stepN = totalSteps-1;
+  }
+
+  int pins[4] = {8,9,10,11};
+  int totalSteps = 4096;
+  unsigned long delay = 1220; // 12 rpm
+  int stepN = 0;
+  long stepsLeft = 0;
+  bool moveClockwise = true;
+  unsigned long lastStepTime = 0;
+
+};
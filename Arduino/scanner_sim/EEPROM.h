@@ -0,0 +1,38 @@
+/*
+ EEPROM stand-in for scanner_sim: 1KB (Uno), starts erased (0xFF), counts byte writes
+*/
+
+#pragma once
+#include "Arduino.h"
+
+class SimEEPROM {
+
+public:
+
+  SimEEPROM() { memset(mem, 0xFF, sizeof(mem)); }
+
+  template<class T> T& get(int address, T& t) {
+    memcpy((void*)&t, mem + address, sizeof(T));
+    return t;
+  }
+  template<class T> const T& put(int address, const T& t) { // like update(): only changed bytes are written
+    const uint8_t* bytes = (const uint8_t*)&t;
+    for (size_t i=0; i<sizeof(T); i++) {
+      if (mem[address+i] != bytes[i]) {
+        mem[address+i] = bytes[i];
+        numWrites++;
+        simClock.advance(3300); // ~3.3ms per EEPROM byte write
+      }
+    }
+    return t;
+  }
+
+  unsigned long numWrites = 0;
+
+private:
+
+  uint8_t mem[1024];
+
+};
+
+static SimEEPROM EEPROM;
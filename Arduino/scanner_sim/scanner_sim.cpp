@@ -0,0 +1,158 @@
+/*
+ scanner_sim: runs the scanner_commander sketch on the host under a virtual clock,
+ feeds it a scripted command scenario and prints its loop() timing stats (LoopProfiler)
+
+ usage: scanner_sim [-v] [-o loop overhead us] scenario.txt [scenario.txt ...]
+   -v  print every reply the sketch sends, with its virtual time
+
+ scenario format, one per line ('#' starts a comment):
+   <ms> <cmd>     send "<cmd>\n" to the sketch at virtual time ms (e.g. "0 H1", "500 A1")
+   <ms> end       stop the scenario at virtual time ms
+
+ the sketch is compiled as-is, only the Arduino core, EEPROM and CheapStepper are stand-ins
+ (its commander is subclassed, only to charge virtual time per command run)
+*/
+
+#include "Arduino.h"
+
+// prototypes the Arduino IDE would generate for the sketch
+void sendUpdate();
+void sendConfig();
+void sendStats();
+void runCommand(char cmd, unsigned long val);
+
+// charges each command the sketch runs (simCommandUs) - the sketch's commander is this one
+#include "Commander.h"
+class SimCommander : public Commander {
+public:
+  void getNextCmdVal(char* cmd, unsigned long* val) { simClock.advance(simCommandUs); Commander::getNextCmdVal(cmd, val); }
+};
+#define Commander SimCommander
+#include "../scanner_commander/scanner_commander.ino"
+#undef Commander
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+struct ScenarioCmd {
+  uint64_t timeUs;
+  string cmd;
+};
+
+const char* sectionNames[numProfiledSections] = { "update", "commands", "parse", "send" };
+
+bool loadScenario(const char* path, vector<ScenarioCmd>& cmds, uint64_t& endUs) {
+
+  ifstream file(path);
+  if (!file) return false;
+
+  string line;
+  endUs = 0;
+  while (getline(file, line)) {
+    size_t hash = line.find('#');
+    if (hash != string::npos) line = line.substr(0, hash);
+    stringstream ss(line);
+    double ms; string cmd;
+    if (!(ss >> ms >> cmd)) continue; // blank or comment
+    uint64_t t = (uint64_t)(ms * 1000);
+    if (cmd == "end") endUs = t;
+    else cmds.push_back(ScenarioCmd{t, cmd});
+    if (t > endUs) endUs = t;
+  }
+  return true;
+}
+
+// prints replies as they come out of the TX buffer, decodes 'Z' stats frames
+void printReplies(bool verbose) {
+
+  static string line;
+  Serial.drain();
+  while (!Serial.sent.empty()) {
+    SimTxByte b = Serial.sent.front();
+    Serial.sent.pop_front();
+    if (b.c != commander.getEndChar()) { line += b.c; continue; }
+
+    if (verbose) {
+      printf("  %10.3f ms  < %s", b.timeUs / 1000.0, line.c_str());
+      if (line.size() > 1 && line[0] == 'Z') {
+        unsigned long val = strtoul(line.c_str()+1, NULL, 10);
+        printf("   (stats field %lu = %lu)", val / statsFieldMult, val % statsFieldMult);
+      }
+      printf("\n");
+    }
+    line = "";
+  }
+}
+
+void printStats(const char* name, uint64_t endUs) {
+
+  printf("%s (%.1f s virtual)\n", name, endUs / 1000000.0);
+  printf("  loops:             %lu\n", profiler.getNumLoops());
+  printf("  loop avg / max:    %lu / %lu us\n", profiler.getAvgLoop(), profiler.getMaxLoop());
+  int longest = profiler.getLongestSection();
+  printf("  longest section:   %s (%lu us)\n", sectionNames[longest], profiler.getSectionMax(longest));
+  printf("  section max:      ");
+  for (int i=0; i<numProfiledSections; i++) printf(" %s %lu us%s", sectionNames[i], profiler.getSectionMax(i), (i < numProfiledSections-1) ? "," : "\n");
+  printf("  rx high-water:     %d bytes (%lu dropped)\n", profiler.getRxHighWater(), Serial.rxDropped);
+  printf("  tx blocked:        %lu us total, %lu us max\n", (unsigned long)Serial.txBlockedUs, (unsigned long)Serial.txBlockedMaxUs);
+  printf("  eeprom writes:     %lu bytes\n", EEPROM.numWrites);
+}
+
+int main(int argc, char** argv) {
+
+  bool verbose = false;
+  unsigned long loopOverheadUs = 10; // cost of loop() bookkeeping not covered by modeled calls
+  vector<const char*> paths;
+
+  for (int i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) verbose = true;
+    else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) loopOverheadUs = strtoul(argv[++i], NULL, 10);
+    else paths.push_back(argv[i]);
+  }
+  if (paths.empty()) {
+    fprintf(stderr, "usage: %s [-v] [-o loop overhead us] scenario.txt [scenario.txt ...]\n", argv[0]);
+    return 1;
+  }
+
+  int failed = 0;
+  for (size_t p=0; p<paths.size(); p++) {
+
+    vector<ScenarioCmd> cmds;
+    uint64_t endUs;
+    if (!loadScenario(paths[p], cmds, endUs)) {
+      fprintf(stderr, "can't read scenario: %s\n", paths[p]);
+      failed++;
+      continue;
+    }
+
+    // fresh board for each scenario
+    simClock = SimClock();
+    Serial = SimSerial();
+    commander = SimCommander();
+    scanner = Scanner();
+    profiler = LoopProfiler();
+    EEPROM = SimEEPROM(); // erased, so scenarios don't depend on each other
+
+    setup();
+    profiler.reset(); // don't count setup()
+
+    size_t next = 0;
+    while (simClock.nowUs < endUs) {
+      while (next < cmds.size() && cmds[next].timeUs <= simClock.nowUs) {
+        if (verbose) printf("  %10.3f ms  > %s\n", simClock.nowUs / 1000.0, cmds[next].cmd.c_str());
+        Serial.inject(cmds[next].timeUs, cmds[next].cmd + (char)commander.getEndChar());
+        next++;
+      }
+      loop();
+      simClock.advance(loopOverheadUs);
+      printReplies(verbose);
+    }
+
+    printStats(paths[p], endUs);
+  }
+
+  return failed;
+}
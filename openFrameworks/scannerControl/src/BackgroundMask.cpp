@@ -0,0 +1,189 @@
+//
+//  BackgroundMask.cpp
+//  scannerControl
+//
+//
+
+#include "BackgroundMask.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MASK_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MASK_NEON
+#endif
+
+// colour distance, n RGB pixels -> n mask bytes
+typedef void (*DistanceFn)(const uint8_t* img, const uint8_t* bg, uint8_t* mask, int n, int threshold);
+
+static void distanceScalar(const uint8_t* img, const uint8_t* bg, uint8_t* mask, int n, int threshold){
+
+    for (int i=0; i<n; i++, img += 3, bg += 3){
+        int d = abs(img[0] - bg[0]) + abs(img[1] - bg[1]) + abs(img[2] - bg[2]);
+        mask[i] = d > threshold ? 255 : 0;
+    }
+}
+
+#ifdef MASK_X86
+__attribute__((target("ssse3")))
+static void distanceSsse3(const uint8_t* img, const uint8_t* bg, uint8_t* mask, int n, int threshold){
+
+    // 16 pixels = 48 bytes a step: |diff| on interleaved bytes, then shuffled into R, G, B planes
+    // (-1 shuffle index writes 0, so each plane is three shuffles OR'd)
+    const __m128i rA = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i rB = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1);
+    const __m128i rC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13);
+    const __m128i gA = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i gB = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1);
+    const __m128i gC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14);
+    const __m128i bA = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i bB = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1);
+    const __m128i bC = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i thr = _mm_set1_epi16(threshold);
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16, img += 48, bg += 48){
+        __m128i d[3];
+        for (int k=0; k<3; k++){
+            __m128i a = _mm_loadu_si128((const __m128i*)(img + 16*k));
+            __m128i b = _mm_loadu_si128((const __m128i*)(bg + 16*k));
+            d[k] = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)); // |a - b|
+        }
+        __m128i dR = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d[0], rA), _mm_shuffle_epi8(d[1], rB)), _mm_shuffle_epi8(d[2], rC));
+        __m128i dG = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d[0], gA), _mm_shuffle_epi8(d[1], gB)), _mm_shuffle_epi8(d[2], gC));
+        __m128i dB = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(d[0], bA), _mm_shuffle_epi8(d[1], bB)), _mm_shuffle_epi8(d[2], bC));
+
+        // sum as 16 bit (max 765), compare, pack back to bytes
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(dR, zero), _mm_unpacklo_epi8(dG, zero)), _mm_unpacklo_epi8(dB, zero));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(dR, zero), _mm_unpackhi_epi8(dG, zero)), _mm_unpackhi_epi8(dB, zero));
+        __m128i m = _mm_packs_epi16(_mm_cmpgt_epi16(lo, thr), _mm_cmpgt_epi16(hi, thr));
+        _mm_storeu_si128((__m128i*)(mask + i), m);
+    }
+    distanceScalar(img, bg, mask + i, n - i, threshold); // tail
+}
+#endif
+
+#ifdef MASK_NEON
+static void distanceNeon(const uint8_t* img, const uint8_t* bg, uint8_t* mask, int n, int threshold){
+
+    const uint16x8_t thr = vdupq_n_u16(threshold);
+    int i = 0;
+    for (; i + 16 <= n; i += 16, img += 48, bg += 48){
+        uint8x16x3_t a = vld3q_u8(img); // deinterleaves R, G, B
+        uint8x16x3_t b = vld3q_u8(bg);
+        uint8x16_t dR = vabdq_u8(a.val[0], b.val[0]);
+        uint8x16_t dG = vabdq_u8(a.val[1], b.val[1]);
+        uint8x16_t dB = vabdq_u8(a.val[2], b.val[2]);
+        uint16x8_t lo = vaddw_u8(vaddl_u8(vget_low_u8(dR), vget_low_u8(dG)), vget_low_u8(dB));
+        uint16x8_t hi = vaddw_u8(vaddl_u8(vget_high_u8(dR), vget_high_u8(dG)), vget_high_u8(dB));
+        vst1q_u8(mask + i, vcombine_u8(vmovn_u16(vcgtq_u16(lo, thr)), vmovn_u16(vcgtq_u16(hi, thr))));
+    }
+    distanceScalar(img, bg, mask + i, n - i, threshold); // tail
+}
+#endif
+
+static DistanceFn pickDistance(const char** name){
+
+#ifdef MASK_X86
+    if (__builtin_cpu_supports("ssse3")) {
+        *name = "ssse3";
+        return distanceSsse3;
+    }
+#endif
+#ifdef MASK_NEON
+    *name = "neon";
+    return distanceNeon;
+#endif
+    *name = "scalar";
+    return distanceScalar;
+}
+
+static const char* implName = "";
+static const DistanceFn distanceBest = pickDistance(&implName);
+
+
+// 3 wide min (erode) / max (dilate) of three rows: out[x] = op(a[x-1..x+1], b[x-1..x+1], c[x-1..x+1])
+// clamped at the row ends - SSE2 is always there on x86_64, NEON on arm64
+static void morphRow(const uint8_t* a, const uint8_t* b, const uint8_t* c, uint8_t* out, uint8_t* col, int w, bool dilate){
+
+    auto op = [dilate](uint8_t x, uint8_t y) -> uint8_t { return dilate ? max(x, y) : min(x, y); };
+
+    // vertical pass into col
+    int x = 0;
+#if defined(MASK_X86)
+    for (; x + 16 <= w; x += 16){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + x)), vb = _mm_loadu_si128((const __m128i*)(b + x)), vc = _mm_loadu_si128((const __m128i*)(c + x));
+        __m128i v = dilate ? _mm_max_epu8(_mm_max_epu8(va, vb), vc) : _mm_min_epu8(_mm_min_epu8(va, vb), vc);
+        _mm_storeu_si128((__m128i*)(col + x), v);
+    }
+#elif defined(MASK_NEON)
+    for (; x + 16 <= w; x += 16){
+        uint8x16_t va = vld1q_u8(a + x), vb = vld1q_u8(b + x), vc = vld1q_u8(c + x);
+        vst1q_u8(col + x, dilate ? vmaxq_u8(vmaxq_u8(va, vb), vc) : vminq_u8(vminq_u8(va, vb), vc));
+    }
+#endif
+    for (; x<w; x++) col[x] = op(op(a[x], b[x]), c[x]);
+
+    // horizontal pass
+    out[0] = op(col[0], col[min(1, w-1)]);
+    out[w-1] = op(col[max(w-2, 0)], col[w-1]);
+    x = 1;
+#if defined(MASK_X86)
+    for (; x + 16 <= w - 1; x += 16){
+        __m128i l = _mm_loadu_si128((const __m128i*)(col + x - 1)), m = _mm_loadu_si128((const __m128i*)(col + x)), r = _mm_loadu_si128((const __m128i*)(col + x + 1));
+        _mm_storeu_si128((__m128i*)(out + x), dilate ? _mm_max_epu8(_mm_max_epu8(l, m), r) : _mm_min_epu8(_mm_min_epu8(l, m), r));
+    }
+#elif defined(MASK_NEON)
+    for (; x + 16 <= w - 1; x += 16){
+        uint8x16_t l = vld1q_u8(col + x - 1), m = vld1q_u8(col + x), r = vld1q_u8(col + x + 1);
+        vst1q_u8(out + x, dilate ? vmaxq_u8(vmaxq_u8(l, m), r) : vminq_u8(vminq_u8(l, m), r));
+    }
+#endif
+    for (; x<w-1; x++) out[x] = op(op(col[x-1], col[x]), col[x+1]);
+}
+
+// one 3x3 erode / dilate of the whole mask, src -> dst
+static void morph(const uint8_t* src, uint8_t* dst, int w, int h, bool dilate){
+
+    vector<uint8_t> col(w);
+    for (int y=0; y<h; y++){
+        const uint8_t* up = src + (size_t)max(y-1, 0) * w;
+        const uint8_t* row = src + (size_t)y * w;
+        const uint8_t* down = src + (size_t)min(y+1, h-1) * w;
+        morphRow(up, row, down, dst + (size_t)y * w, &col[0], w, dilate);
+    }
+}
+
+
+bool computeMask(const ofPixels& image, const ofPixels& background, ofPixels& mask, int threshold, int radius){
+
+    int w = image.getWidth();
+    int h = image.getHeight();
+    if (!image.isAllocated() || image.getNumChannels() != 3 || background.getNumChannels() != 3
+        || background.getWidth() != w || background.getHeight() != h || w < 2 || h < 2) return false;
+
+    mask.allocate(w, h, OF_PIXELS_GRAY);
+    uint8_t* m = mask.getData();
+    distanceBest(image.getData(), background.getData(), m, w * h, threshold);
+
+    // open (erode, dilate) then close (dilate, erode), radius 3x3 passes each, ping-ponging with tmp
+    vector<uint8_t> tmp((size_t)w * h);
+    uint8_t* src = m;
+    uint8_t* dst = &tmp[0];
+    const bool passes[4] = { false, true, true, false }; // dilate?
+    for (int p=0; p<4; p++){
+        for (int r=0; r<radius; r++){
+            morph(src, dst, w, h, passes[p]);
+            swap(src, dst);
+        }
+    }
+    // 4 * radius passes: result is back in mask
+    return true;
+}
+
+string getMaskImpl(){
+
+    return implName;
+}
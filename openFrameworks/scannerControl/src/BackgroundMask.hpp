@@ -0,0 +1,16 @@
+//
+//  BackgroundMask.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// object mask from a shot of the empty backdrop: a pixel is object when its colour is further
+// than threshold from the background (sum of |dR| + |dG| + |dB|, 0-765), then cleaned up by
+// opening (drops specks) + closing (fills pinholes) with a 3x3 box, radius times each
+// SSSE3 (picked at runtime) / NEON / scalar distance, SSE2 / NEON morphology - thread safe
+
+bool computeMask(const ofPixels& image, const ofPixels& background, ofPixels& mask, int threshold = 60, int radius = 2); // RGB in, same size; mask gray 0 / 255
+string getMaskImpl(); // "ssse3", "neon" or "scalar"
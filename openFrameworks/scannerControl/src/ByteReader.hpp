@@ -0,0 +1,56 @@
+//
+//  ByteReader.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// bounds checked big / little endian reads from a file in memory (TIFF, ISOBMFF...)
+// everything in the file is untrusted: out of range reads return 0, corrupt boxes end the search
+
+struct ByteReader {
+    const unsigned char* data;
+    size_t size;
+    bool bigEndian;
+
+    bool has(size_t pos, size_t n) const { return pos <= size && n <= size - pos; }
+    uint16_t u16(size_t pos) const {
+        if (!has(pos, 2)) return 0;
+        const unsigned char* p = data + pos;
+        return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+    }
+    uint32_t u32(size_t pos) const {
+        if (!has(pos, 4)) return 0;
+        const unsigned char* p = data + pos;
+        return bigEndian ? ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+                         : ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+    }
+    uint64_t u64(size_t pos) const { return bigEndian ? ((uint64_t)u32(pos) << 32) | u32(pos+4) : ((uint64_t)u32(pos+4) << 32) | u32(pos); }
+
+    // ISOBMFF: first box of a type in [start, end), false if not found
+    bool findBox(uint64_t start, uint64_t end, const char* type, uint64_t* payload, uint64_t* payloadEnd) const {
+        uint64_t pos = start;
+        while (pos + 8 <= end){
+            uint64_t boxSize = u32(pos);
+            uint64_t header = 8;
+            if (boxSize == 1) { // 64 bit size follows the type
+                boxSize = u64(pos + 8);
+                header = 16;
+            }
+            else if (boxSize == 0) boxSize = end - pos; // extends to end
+            if (boxSize < header || boxSize > end - pos) return false;
+
+            if (memcmp(data + pos + 4, type, 4) == 0) {
+                *payload = pos + header;
+                *payloadEnd = pos + boxSize;
+                return true;
+            }
+            pos += boxSize;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,123 @@
+//
+//  CaptureManifest.cpp
+//  scannerControl
+//
+//
+
+#include "CaptureManifest.hpp"
+#include "MappedFile.hpp"
+#include <chrono>
+#include <random>
+#include <unistd.h>
+
+static_assert(sizeof(CaptureManifest::Record) == 128, "manifest record layout changed, bump version");
+
+static const uint32_t manifestVersion = 1;
+const char* CaptureManifest::fileName = "capture_manifest.bin";
+
+bool CaptureManifest::setup(string dirPath){
+
+    close();
+    path = ofFilePath::join(dirPath, fileName);
+
+    // read existing records straight out of the mapped file
+    {
+        MappedFile existing(path, MappedFile::ACCESS_SEQUENTIAL);
+        if (existing.isOpen()) {
+            Header h;
+            if (existing.size() < sizeof(h)) {
+                ofLogError("CaptureManifest") << "truncated manifest, not touching it: " << path;
+                return false;
+            }
+            memcpy(&h, existing.getData(), sizeof(h));
+            if (memcmp(h.magic, "3DCM", 4) != 0 || h.version != manifestVersion || h.recordSize != sizeof(Record)) {
+                ofLogError("CaptureManifest") << "unknown manifest format, not touching it: " << path;
+                return false;
+            }
+            size_t numRecords = (existing.size() - sizeof(h)) / sizeof(Record); // a partly written last record is ignored
+            records.resize(numRecords);
+            if (numRecords > 0) memcpy(&records[0], existing.getData() + sizeof(h), numRecords * sizeof(Record));
+            for (int i=0; i<records.size(); i++) fileNames.insert(string(records[i].fileName, strnlen(records[i].fileName, sizeof(records[i].fileName))));
+
+            // drop a partial record so appends stay aligned
+            size_t validSize = sizeof(h) + numRecords * sizeof(Record);
+            if (validSize != existing.size()) {
+                ofLogWarning("CaptureManifest") << "dropping partial record at end of " << path;
+                existing.close();
+                truncate(path.c_str(), validSize);
+            }
+        }
+    }
+
+    file = fopen(path.c_str(), "ab");
+    if (file == NULL) {
+        ofLogError("CaptureManifest") << "can't open manifest: " << path;
+        records.clear();
+        fileNames.clear();
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) { // new file
+        Header h;
+        memcpy(h.magic, "3DCM", 4);
+        h.version = manifestVersion;
+        h.recordSize = sizeof(Record);
+        h.reserved = 0;
+        if (fwrite(&h, sizeof(h), 1, file) != 1 || fflush(file) != 0) {
+            ofLogError("CaptureManifest") << "can't write manifest: " << path;
+            close();
+            return false;
+        }
+    }
+
+    newSession();
+    ofLogVerbose("CaptureManifest") << path << ": " << records.size() << " records";
+    return true;
+}
+
+void CaptureManifest::close(){
+
+    if (file != NULL) fclose(file);
+    file = NULL;
+    records.clear();
+    fileNames.clear();
+}
+
+uint64_t CaptureManifest::newSession(){
+
+    // time in the high bits keeps ids sortable, random low bits keep two rigs apart
+    std::random_device rd;
+    uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    sessionId = (ms << 20) | (rd() & 0xFFFFF);
+    return sessionId;
+}
+
+bool CaptureManifest::append(Record r){
+
+    if (file == NULL) return false;
+    r.sessionId = sessionId;
+    r.fileName[sizeof(r.fileName)-1] = 0;
+
+    bool ok = fwrite(&r, sizeof(r), 1, file) == 1 && fflush(file) == 0;
+    if (!ok) {
+        ofLogError("CaptureManifest") << "write failed: " << path;
+        return false;
+    }
+    records.push_back(r);
+    fileNames.insert(r.fileName);
+    return true;
+}
+
+bool CaptureManifest::contains(const string& name){
+
+    return fileNames.count(name) > 0;
+}
+
+int CaptureManifest::find(const string& name){
+
+    if (!contains(name)) return -1;
+    for (int i=records.size()-1; i>=0; i--){
+        if (strncmp(records[i].fileName, name.c_str(), sizeof(records[i].fileName)) == 0) return i;
+    }
+    return -1;
+}
@@ -0,0 +1,75 @@
+//
+//  CaptureManifest.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// per shot turntable pose, kept next to the images so reconstruction starts from known camera poses
+// append only binary file: 16 byte header then fixed size records, little endian -
+// readers can mmap it and index records directly, a crash at worst loses the record being written
+//
+// layout (version 1):
+//   header: "3DCM", uint32 version, uint32 record size (128), uint32 reserved
+//   record: see Record below, file name NUL padded
+
+class CaptureManifest {
+
+public:
+
+    enum {
+        RECORD_MISSED = 1, // shot fired but no file landed, fileName empty
+        RECORD_RESHOOT = 2 // retake of a missed autoscan shot
+    };
+
+    struct Record {
+        uint64_t sessionId; // one per autoscan / watch folder load
+        int64_t shutterTime; // ms since 1970, host clock, when scanner fired the camera
+        int64_t captureTime; // ms since 1970, camera clock (EXIF), 0 if unknown
+        uint32_t step; // turntable step at shutter (0 = home)
+        uint32_t stepsPerRev; // turntable steps in one rotation
+        float degree;
+        int32_t shotIndex; // shot # within autoscan rotation, -1 for single shots
+        uint8_t clockwise;
+        uint8_t flags; // RECORD_* bits
+        uint8_t reserved[2];
+        char fileName[84]; // relative to manifest's folder
+    };
+
+    ~CaptureManifest() { close(); }
+
+    bool setup(string dirPath); // opens (or creates) the folder's manifest, reads existing records
+    void close();
+    bool isOpen() { return file != NULL; }
+
+    uint64_t newSession(); // new session id for records appended from now on, returns it
+    uint64_t getSessionId() { return sessionId; }
+
+    bool append(Record r); // sets session id, flushed to disk before returning
+    bool contains(const string& name); // already has a record for the file
+    int find(const string& name); // index of the file's latest record, -1 if none
+    int size() { return records.size(); }
+    const Record& getRecord(int i) { return records[i]; }
+    string getPath() { return path; }
+
+    static float getAngle(const Record& r) { return r.stepsPerRev > 0 ? TWO_PI * r.step / r.stepsPerRev : ofDegToRad(r.degree); } // table angle at shutter, radians
+    static const char* fileName; // "capture_manifest.bin"
+
+
+private:
+
+    struct Header {
+        char magic[4]; // "3DCM"
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t reserved;
+    };
+
+    FILE* file = NULL;
+    string path = "";
+    uint64_t sessionId = 0;
+    vector<Record> records; // everything in the file, incl. earlier sessions
+    set<string> fileNames;
+};
@@ -0,0 +1,118 @@
+//
+//  DecodePool.cpp
+//  scannerControl
+//
+//
+
+#include "DecodePool.hpp"
+#include "Undistorter.hpp"
+
+void DecodePool::setup(int numThreads){
+
+    close();
+    initImageDecode(); // before any worker decodes
+
+    if (numThreads <= 0) numThreads = max(1, (int)std::thread::hardware_concurrency() - 1); // leave a core for the app
+    bStop = false;
+    for (int i=0; i<numThreads; i++) workers.push_back(std::thread(&DecodePool::workerLoop, this));
+
+    ofLogVerbose("DecodePool") << "started " << numThreads << " decode threads";
+}
+
+void DecodePool::close(){
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        bStop = true;
+    }
+    jobCond.notify_all();
+    for (int i=0; i<workers.size(); i++) workers[i].join();
+    workers.clear();
+    clear();
+}
+
+void DecodePool::add(const Job& job){
+
+    numPending++;
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        jobs.push_back(job);
+    }
+    jobCond.notify_one();
+}
+
+void DecodePool::add(uint64_t id, int generation, string path, int maxSize){
+
+    Job job;
+    job.id = id;
+    job.generation = generation;
+    job.path = path;
+    job.maxSize = maxSize;
+    add(job);
+}
+
+void DecodePool::clear(){
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        numPending -= jobs.size();
+        jobs.clear();
+    }
+    std::lock_guard<std::mutex> lock(resultMutex);
+    numPending -= results.size();
+    results.clear();
+    numResults = 0;
+}
+
+bool DecodePool::getNextResult(Result& r){
+
+    if (numResults == 0) return false; // common case, no lock
+
+    std::lock_guard<std::mutex> lock(resultMutex);
+    if (results.empty()) return false;
+    r = std::move(results.front()); // pixels are moved, not copied
+    results.pop_front();
+    numResults--;
+    numPending--;
+    return true;
+}
+
+
+// PRIVATE
+
+
+void DecodePool::workerLoop(){
+
+    while (true){
+
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobCond.wait(lock, [this]{ return bStop || !jobs.empty(); });
+            if (bStop) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        Result r;
+        r.id = job.id;
+        r.generation = job.generation;
+        r.path = job.path;
+        r.maxSize = job.maxSize;
+        
+        // proxies: cached copy if the file hasn't changed, else decode + fill cache
+        bool useCache = job.maxSize > 0 && thumbCache != NULL && thumbCache->isSetup();
+        if (useCache) r.ok = r.fromCache = thumbCache->load(job.path, job.maxSize, r.pixels);
+        if (!r.ok) {
+            r.ok = decodeImage(job.path, r.pixels, job.maxSize); // FreeImage, no GL - safe off the main thread
+            if (!r.ok) ofLogError("DecodePool") << "error decoding image file: " << job.path;
+            else if (useCache) thumbCache->save(job.path, job.maxSize, r.pixels);
+        }
+        if (r.ok && undistorter != NULL) undistorter->apply(r.pixels); // tiles on this worker, the pool's other threads have their own images
+        if (postProcess) postProcess(r);
+
+        std::lock_guard<std::mutex> lock(resultMutex);
+        results.push_back(std::move(r));
+        numResults++;
+    }
+}
@@ -0,0 +1,87 @@
+//
+//  DecodePool.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+#include "ImageDecode.hpp"
+#include "ThumbnailCache.hpp"
+#include "ExifReader.hpp"
+#include <functional>
+
+class Undistorter;
+
+// decodes image files into ofPixels on worker threads
+// app thread adds jobs and picks up results - no GL here, see TextureUploader for uploads
+
+class DecodePool {
+
+public:
+
+    struct Job {
+        uint64_t id = 0; // caller's id, returned with result
+        int generation = 0; // caller's batch, lets it drop results of cleared batches
+        string path;
+        int maxSize = 0; // decode to >= this on the long side (JPEG DCT scaling), 0: full resolution
+    };
+
+    struct Result {
+        uint64_t id = 0;
+        int generation = 0;
+        string path;
+        int maxSize = 0; // as requested
+        bool ok = false;
+        bool fromCache = false; // proxy read from thumbnail cache, not decoded
+        float sharpness = -1; // filled in by a post process (ImageStore: proxies, see getSharpness())
+        ImageMeta meta; // same (ImageStore: proxies, see readExif())
+        ofPixels pixels;
+
+        // move-only, pixels are never deep copied on the way out
+        Result(){}
+        Result(Result&&) = default;
+        Result& operator=(Result&&) = default;
+        Result(const Result&) = delete;
+        Result& operator=(const Result&) = delete;
+    };
+
+    DecodePool(){}
+    ~DecodePool() { close(); }
+
+    void setup(int numThreads = 0); // 0: one less than # cores (min 1)
+    void close();
+    void setThumbnailCache(ThumbnailCache* cache) { thumbCache = cache; } // proxies checked here first, saved after decode
+    void setPostProcess(std::function<void(Result&)> fn) { postProcess = fn; } // runs on the worker after each decode (ok or not) - set before setup()
+    void setUndistorter(Undistorter* u) { undistorter = u; } // decoded images have the lens distortion taken out, before the post process - set before setup()
+
+    void add(const Job& job);
+    void add(uint64_t id, int generation, string path, int maxSize = 0);
+    void clear(); // drop queued jobs + results (jobs already decoding still finish)
+
+    bool getNextResult(Result& r); // app thread - false if none (no lock taken)
+    int getNumPending() { return numPending; } // queued + decoding + results not picked up
+    int getNumThreads() { return workers.size(); }
+
+
+private:
+
+    void workerLoop(); // runs on each worker thread
+
+    vector<std::thread> workers;
+    ThumbnailCache* thumbCache = NULL;
+    Undistorter* undistorter = NULL;
+    std::function<void(Result&)> postProcess;
+    bool bStop = false; // guarded by jobMutex
+
+    deque<Job> jobs;
+    std::mutex jobMutex;
+    std::condition_variable jobCond;
+
+    deque<Result> results;
+    std::mutex resultMutex;
+    std::atomic<int> numResults { 0 };
+    std::atomic<int> numPending { 0 };
+};
@@ -0,0 +1,280 @@
+//
+//  ExifReader.cpp
+//  scannerControl
+//
+//
+
+#include "ExifReader.hpp"
+#include "ByteReader.hpp"
+#include "FileReader.hpp"
+
+// tags used
+enum {
+    TAG_ORIENTATION = 0x0112,
+    TAG_EXIF_IFD = 0x8769,
+    TAG_EXPOSURE_TIME = 0x829A,
+    TAG_FNUMBER = 0x829D,
+    TAG_ISO = 0x8827,
+    TAG_DATETIME_ORIGINAL = 0x9003,
+    TAG_FOCAL_LENGTH = 0x920A,
+    TAG_SUBSEC_ORIGINAL = 0x9291
+};
+
+static const size_t headBytes = 64 * 1024; // first read of a file, EXIF is in its first few KB in every format
+static const size_t maxHeaderBytes = 8 * 1024 * 1024; // IFDs / moov past this: corrupt, give up
+
+// the start of the file: all of it when already in memory, else a pread prefix grown (doubled)
+// only when an IFD, segment or box points past it - data moves when it grows
+struct Head {
+    const unsigned char* data;
+    size_t size;
+    FileReader* file; // NULL: in memory
+    vector<unsigned char> buf;
+
+    bool cover(uint64_t end){
+        if (end <= size) return true;
+        if (file == NULL || end > file->size() || end > maxHeaderBytes) return false;
+        if (!file->read(0, min(file->size(), max(end, (uint64_t)size * 2)), buf)) return false;
+        data = buf.data();
+        size = buf.size();
+        return true;
+    }
+};
+
+// TIFF block: offsets are from its start, byte order from its header
+static bool tiffReader(const unsigned char* data, size_t size, ByteReader* r){
+
+    if (size < 8) return false;
+    if (data[0] == 'I' && data[1] == 'I') *r = { data, size, false };
+    else if (data[0] == 'M' && data[1] == 'M') *r = { data, size, true };
+    else return false;
+    return r->u16(2) == 42;
+}
+
+// entry offset of a tag in an IFD, 0 if not there
+static size_t findTag(const ByteReader& r, uint32_t ifd, uint16_t tag){
+
+    uint16_t numEntries = r.u16(ifd);
+    for (int i=0; i<numEntries; i++){
+        size_t entry = ifd + 2 + i * 12;
+        if (!r.has(entry, 12)) return 0;
+        if (r.u16(entry) == tag) return entry;
+    }
+    return 0;
+}
+
+static uint32_t tagInt(const ByteReader& r, size_t entry){
+
+    if (entry == 0) return 0;
+    uint16_t type = r.u16(entry + 2);
+    if (type == 3) return r.u16(entry + 8); // SHORT
+    if (type == 4) return r.u32(entry + 8); // LONG
+    return 0;
+}
+
+static float tagRational(const ByteReader& r, size_t entry){
+
+    if (entry == 0 || (r.u16(entry + 2) != 5 && r.u16(entry + 2) != 10)) return 0; // (S)RATIONAL, always out of line
+    uint32_t pos = r.u32(entry + 8);
+    uint32_t den = r.u32(pos + 4);
+    if (r.u16(entry + 2) == 10) return den == 0 ? 0 : (int32_t)r.u32(pos) / (float)(int32_t)den;
+    return den == 0 ? 0 : r.u32(pos) / (float)den;
+}
+
+static string tagString(const ByteReader& r, size_t entry){
+
+    if (entry == 0 || r.u16(entry + 2) != 2) return ""; // ASCII
+    uint32_t count = r.u32(entry + 4);
+    size_t pos = count <= 4 ? entry + 8 : r.u32(entry + 8); // inline if it fits
+    if (!r.has(pos, count)) return "";
+    const char* s = (const char*)r.data + pos;
+    return string(s, strnlen(s, count));
+}
+
+// "YYYY:MM:DD HH:MM:SS" -> ms since 1970, no time zone (calendar math, no timegm)
+static int64_t parseDateTime(const string& s, const string& subSec){
+
+    int Y, M, D, h, m, sec;
+    if (s.size() < 19 || sscanf(s.c_str(), "%d:%d:%d %d:%d:%d", &Y, &M, &D, &h, &m, &sec) != 6 || Y < 1970 || M < 1 || M > 12 || D < 1) return 0;
+
+    // days from civil (proleptic gregorian)
+    int y = Y - (M <= 2);
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (M + (M > 2 ? -3 : 9)) + 2) / 5 + D - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+    // sub seconds are decimal digits: "5" = 500ms, "05" = 50ms
+    int ms = 0, scale = 100;
+    for (int i=0; i<subSec.size() && scale > 0; i++){
+        if (subSec[i] < '0' || subSec[i] > '9') break;
+        ms += (subSec[i] - '0') * scale;
+        scale /= 10;
+    }
+    return ((days * 24 + h) * 60 + m) * 60000LL + sec * 1000LL + ms;
+}
+
+static void readExifIfd(const ByteReader& r, uint32_t ifd, ImageMeta& meta){
+
+    if (!r.has(ifd, 2)) return;
+    meta.valid = true;
+    meta.exposureTime = tagRational(r, findTag(r, ifd, TAG_EXPOSURE_TIME));
+    meta.fNumber = tagRational(r, findTag(r, ifd, TAG_FNUMBER));
+    meta.focalLength = tagRational(r, findTag(r, ifd, TAG_FOCAL_LENGTH));
+    meta.iso = tagInt(r, findTag(r, ifd, TAG_ISO));
+    meta.captureTime = parseDateTime(tagString(r, findTag(r, ifd, TAG_DATETIME_ORIGINAL)), tagString(r, findTag(r, ifd, TAG_SUBSEC_ORIGINAL)));
+}
+
+// IFD0 (orientation) + its Exif sub IFD
+static bool readTiff(const ByteReader& r, ImageMeta& meta){
+
+    uint32_t ifd0 = r.u32(4);
+    if (!r.has(ifd0, 2)) return false;
+    int orientation = tagInt(r, findTag(r, ifd0, TAG_ORIENTATION));
+    if (orientation >= 1 && orientation <= 8) meta.orientation = orientation;
+    meta.valid = true;
+    uint32_t exifIfd = tagInt(r, findTag(r, ifd0, TAG_EXIF_IFD));
+    if (exifIfd != 0) readExifIfd(r, exifIfd, meta);
+    return true;
+}
+
+// head grown over an IFD: its entries, and the ASCII / RATIONAL values they point at
+static bool coverIfd(Head& head, uint32_t ifd){
+
+    bool bigEndian = head.data[0] == 'M';
+    if (!head.cover((uint64_t)ifd + 2)) return false;
+    uint64_t entries = (uint64_t)ifd + 2;
+    uint64_t end = entries + ByteReader{ head.data, head.size, bigEndian }.u16(ifd) * 12;
+    if (!head.cover(end)) return false;
+
+    ByteReader r = { head.data, head.size, bigEndian };
+    uint64_t valuesEnd = end;
+    for (uint64_t entry = entries; entry < end; entry += 12){
+        uint16_t type = r.u16(entry + 2);
+        uint64_t n = type == 2 ? r.u32(entry + 4) : (type == 5 || type == 10) ? 8ULL * r.u32(entry + 4) : 0;
+        if (n > 4) valuesEnd = max(valuesEnd, (uint64_t)r.u32(entry + 8) + n);
+    }
+    head.cover(valuesEnd); // values past the limit just read as missing
+    return true;
+}
+
+// CR2 / TIFF: the file itself is the TIFF block
+static bool readTiffFile(Head& head, ImageMeta& meta){
+
+    ByteReader r;
+    if (!tiffReader(head.data, head.size, &r)) return false;
+    uint32_t ifd0 = r.u32(4);
+    if (!coverIfd(head, ifd0)) return false;
+    tiffReader(head.data, head.size, &r);
+    uint32_t exifIfd = tagInt(r, findTag(r, ifd0, TAG_EXIF_IFD));
+    if (exifIfd != 0) coverIfd(head, exifIfd);
+    return tiffReader(head.data, head.size, &r) && readTiff(r, meta);
+}
+
+static bool readJpeg(Head& head, ImageMeta& meta){
+
+    // walk segment headers up to the scan, APP1 "Exif" holds a TIFF block
+    size_t pos = 2;
+    while (head.cover(pos + 4)){
+        if (head.data[pos] != 0xFF) return false;
+        unsigned char marker = head.data[pos+1];
+        if (marker == 0xFF) { pos++; continue; } // fill byte
+        if (marker == 0xDA || marker == 0xD9) return false; // image data, no EXIF before it
+        size_t length = (head.data[pos+2] << 8) | head.data[pos+3];
+        if (length < 2 || !head.cover(pos + 2 + length)) return false;
+        if (marker == 0xE1 && length >= 16 && memcmp(head.data + pos + 4, "Exif\0\0", 6) == 0) {
+            ByteReader r;
+            return tiffReader(head.data + pos + 10, length - 8, &r) && readTiff(r, meta);
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+static bool readCr3(Head& head, ImageMeta& meta){
+
+    // moov -> canon uuid box -> CMT1 (TIFF with IFD0), CMT2 (TIFF whose IFD0 is the Exif IFD)
+    // top level boxes by their headers, moov (right after ftyp) is all that's read whole
+    static const unsigned char canonUuid[16] = { 0x85, 0xc0, 0xb6, 0x87, 0x82, 0x0f, 0x11, 0xe0, 0x81, 0x11, 0xf4, 0xce, 0x46, 0x2b, 0x6a, 0x48 };
+    uint64_t fileSize = head.file != NULL ? head.file->size() : head.size;
+    uint64_t moov = 0, moovEnd = 0;
+    uint64_t pos = 0;
+    while (pos + 16 <= fileSize && head.cover(pos + 16)){
+        ByteReader h = { head.data, head.size, true };
+        uint64_t boxSize = h.u32(pos);
+        uint64_t header = 8;
+        if (boxSize == 1) { // 64 bit size follows the type
+            boxSize = h.u64(pos + 8);
+            header = 16;
+        }
+        else if (boxSize == 0) boxSize = fileSize - pos; // extends to end
+        if (boxSize < header || boxSize > fileSize - pos) return false;
+        if (memcmp(head.data + pos + 4, "moov", 4) == 0) {
+            moov = pos + header;
+            moovEnd = pos + boxSize;
+            break;
+        }
+        pos += boxSize;
+    }
+    if (moovEnd == 0 || !head.cover(moovEnd)) return false;
+
+    ByteReader file = { head.data, head.size, true };
+    uint64_t p, pEnd;
+    pos = moov;
+    while (file.findBox(pos, moovEnd, "uuid", &p, &pEnd)){
+        if (file.has(p, 16) && memcmp(head.data + p, canonUuid, 16) == 0) {
+            uint64_t cmt, cmtEnd;
+            ByteReader r;
+            if (file.findBox(p + 16, pEnd, "CMT1", &cmt, &cmtEnd) && tiffReader(head.data + cmt, cmtEnd - cmt, &r)) readTiff(r, meta);
+            if (file.findBox(p + 16, pEnd, "CMT2", &cmt, &cmtEnd) && tiffReader(head.data + cmt, cmtEnd - cmt, &r)) readExifIfd(r, r.u32(4), meta);
+            return meta.valid;
+        }
+        pos = pEnd;
+    }
+    return false;
+}
+
+static bool readExif(Head& head, ImageMeta& meta){
+
+    meta = ImageMeta();
+    if (!head.cover(12)) return false;
+
+    if (head.data[0] == 0xFF && head.data[1] == 0xD8) return readJpeg(head, meta);
+    if (memcmp(head.data + 4, "ftyp", 4) == 0) return readCr3(head, meta);
+    return readTiffFile(head, meta); // CR2 / TIFF
+}
+
+
+string ImageMeta::getExposureString() const{
+
+    if (!valid) return "";
+    string s;
+    if (exposureTime > 0) s += (exposureTime < 1 ? "1/" + ofToString(round(1.0 / exposureTime)) : ofToString(exposureTime)) + "s ";
+    if (fNumber > 0) s += "f/" + ofToString(fNumber, 1) + " ";
+    if (iso > 0) s += "ISO" + ofToString(iso) + " ";
+    if (focalLength > 0) s += ofToString(round(focalLength)) + "mm";
+    return ofTrim(s);
+}
+
+bool readExif(const unsigned char* data, size_t size, ImageMeta& meta){
+
+    if (data == NULL) {
+        meta = ImageMeta();
+        return false;
+    }
+    Head head = { data, size, NULL };
+    return readExif(head, meta);
+}
+
+bool readExif(const string& path, ImageMeta& meta){
+
+    // a bounded prefix by pread, more only if the file's own offsets point past it - never mapped or read whole
+    FileReader file(path);
+    Head head = { NULL, 0, &file };
+    if (!file.isOpen() || !head.cover(min((uint64_t)headBytes, file.size()))) {
+        meta = ImageMeta();
+        return false;
+    }
+    return readExif(head, meta);
+}
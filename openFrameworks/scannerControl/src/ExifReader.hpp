@@ -0,0 +1,27 @@
+//
+//  ExifReader.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// capture metadata straight from the EXIF block - no decode, only the few KB of header are read (pread)
+//   JPEG: APP1 segment, CR2: the file's own TIFF IFDs, CR3: the CMT1 / CMT2 boxes
+// thread safe, fast enough to run on every file as it lands
+
+struct ImageMeta {
+    bool valid = false; // EXIF found
+    int64_t captureTime = 0; // ms since 1970, DateTimeOriginal + SubSecTimeOriginal on the camera's clock (no time zone), 0 if unknown
+    int orientation = 1; // EXIF orientation 1-8, 1: as stored
+    float exposureTime = 0; // s
+    float fNumber = 0;
+    int iso = 0;
+    float focalLength = 0; // mm
+
+    string getExposureString() const; // e.g. "1/125s f/8 ISO100 50mm", "" if not valid
+};
+
+bool readExif(const string& path, ImageMeta& meta); // false if no EXIF (meta left at defaults)
+bool readExif(const unsigned char* data, size_t size, ImageMeta& meta); // whole file in memory
@@ -0,0 +1,93 @@
+//
+//  FeatureExtractor.cpp
+//  scannerControl
+//
+//
+
+#include "FeatureExtractor.hpp"
+#include "Undistorter.hpp"
+#include <sys/stat.h>
+
+void FeatureExtractor::setup(int numThreads){
+
+    decodePool.setPostProcess([this](DecodePool::Result& r){ extract(r); });
+    decodePool.setup(numThreads);
+    ofLogVerbose("FeatureExtractor") << "features on " << numThreads << " threads (" << getFastImpl() << ")";
+}
+
+void FeatureExtractor::close(){
+
+    decodePool.close();
+    clear();
+}
+
+void FeatureExtractor::add(string path){
+
+    struct stat image, feat;
+    if (stat(getFeaturePath(path).c_str(), &feat) == 0 && stat(path.c_str(), &image) == 0 && feat.st_mtime >= image.st_mtime) {
+        FeatureSet header;
+        if (loadFeatureHeader(getFeaturePath(path), header) && header.undistortKey == getUndistortKey()) {
+            written.push_back(path); // reopened folder, already done
+            return;
+        }
+    }
+    decodePool.add(0, generation, path, imageSize);
+}
+
+void FeatureExtractor::clear(){
+
+    generation++;
+    decodePool.clear();
+    written.clear();
+    numFailed = 0;
+}
+
+int FeatureExtractor::update(){
+
+    int numWritten = 0;
+    DecodePool::Result r;
+    while (decodePool.getNextResult(r)){
+        if (r.generation != generation) continue;
+        if (r.ok) {
+            written.push_back(r.path);
+            numWritten++;
+        }
+        else numFailed++;
+    }
+    return numWritten;
+}
+
+bool FeatureExtractor::getNextFeatures(string* imagePath){
+
+    if (written.empty()) return false;
+    *imagePath = written.front();
+    written.pop_front();
+    return true;
+}
+
+string FeatureExtractor::getFeaturePath(const string& imagePath){
+
+    return ofFilePath::join(ofFilePath::getEnclosingDirectory(imagePath, false), ofFilePath::getBaseName(imagePath) + ".feat");
+}
+
+
+// PRIVATE
+
+
+uint64_t FeatureExtractor::getUndistortKey(){
+
+    return undistorter != NULL ? undistorter->getModelKey() : 0;
+}
+
+void FeatureExtractor::extract(DecodePool::Result& r){
+
+    if (!r.ok) return;
+
+    uint64_t start = ofGetElapsedTimeMicros();
+    FeatureSet features;
+    features.undistortKey = getUndistortKey(); // what the pool just applied
+    detectFeatures(r.pixels, features, maxFeatures, threshold);
+    r.pixels.clear(); // main thread only needs to know it's done
+    r.ok = saveFeatures(getFeaturePath(r.path), features);
+    ofLogVerbose("FeatureExtractor") << ofFilePath::getFileName(r.path) << ": " << features.size() << " features in " << (ofGetElapsedTimeMicros() - start) / 1000.0 << "ms";
+}
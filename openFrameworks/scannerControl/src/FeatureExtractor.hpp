@@ -0,0 +1,52 @@
+//
+//  FeatureExtractor.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "DecodePool.hpp"
+#include "Features.hpp"
+
+// keypoints + descriptors for every ingested image, written next to it as <name>.feat as it lands
+// (see Features.hpp), so the detection pass is done by the time the rotation is - decode, detect
+// and save all run on own worker threads, main thread only picks up which images are done
+
+class FeatureExtractor {
+
+public:
+
+    void setup(int numThreads = 2);
+    void close();
+    void setUndistorter(Undistorter* u) { undistorter = u; decodePool.setUndistorter(u); } // keypoints in undistorted (pinhole) pixels - set before setup()
+    void setImageSize(int size) { imageSize = size; } // long side to decode at (JPEG DCT scaling, so >= size)
+    void setMaxFeatures(int n) { maxFeatures = n; }
+    void setThreshold(int t) { threshold = t; } // FAST intensity difference
+
+    void add(string path); // skipped if its .feat is newer than the image + made with the current lens model
+    void clear(); // drops queued images
+    int update(); // once per frame, returns # feature files written since last call
+    bool getNextFeatures(string* imagePath); // images with a current .feat since last call, in the order they finished
+
+    int getNumPending() { return decodePool.getNumPending(); }
+    int getNumFailed() { return numFailed; }
+
+    static string getFeaturePath(const string& imagePath); // <dir>/<name>.feat
+
+
+private:
+
+    void extract(DecodePool::Result& r); // on worker threads
+
+    uint64_t getUndistortKey(); // of the lens model images are undistorted with now, 0: none
+
+    DecodePool decodePool;
+    Undistorter* undistorter = NULL;
+    int generation = 0;
+    deque<string> written;
+    std::atomic<int> maxFeatures { 4000 };
+    std::atomic<int> threshold { 20 };
+    int imageSize = 1024;
+    int numFailed = 0;
+};
@@ -0,0 +1,477 @@
+//
+//  Features.cpp
+//  scannerControl
+//
+//
+
+#include "Features.hpp"
+#include "MappedFile.hpp"
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define FEATURES_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FEATURES_NEON
+#endif
+
+static const int numLevels = 4;
+static const int border = 16; // descriptor pattern + orientation patch radius 15
+static const int patchRadius = 15;
+static const int numAngleBins = 32;
+static const uint32_t featVersion = 2;
+
+// FAST circle, radius 3, in order round the circle
+static const int circleX[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+static const int circleY[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+namespace {
+
+struct Image {
+    int w = 0, h = 0;
+    vector<uint8_t> data;
+    uint8_t* row(int y) { return &data[(size_t)y * w]; }
+    const uint8_t* row(int y) const { return &data[(size_t)y * w]; }
+};
+
+// 256 point pairs inside the patch disc, Gaussian around the centre (BRIEF's G II sampling),
+// fixed seed so every file uses the same bits - plus copies rotated to each angle bin
+struct Pattern {
+
+    int8_t pairs[numAngleBins][256][4]; // x1, y1, x2, y2
+
+    Pattern(){
+        uint32_t seed = 0x3DF7;
+        auto uniform = [&seed](){ seed = seed * 1664525u + 1013904223u; return ((seed >> 8) + 0.5f) / 16777216.0f; };
+        auto gauss = [&](){ // Box-Muller, sigma = patch size / 5
+            float r = sqrt(-2.0f * log(uniform())) * (2 * patchRadius + 1) / 5.0f;
+            return r * cos(2 * PI * uniform());
+        };
+        float base[256][4];
+        for (int i=0; i<256; i++){
+            for (int p=0; p<2; p++){
+                float x, y;
+                do { x = gauss(); y = gauss(); } while (x * x + y * y > (patchRadius - 1) * (patchRadius - 1));
+                base[i][p*2] = x;
+                base[i][p*2+1] = y;
+            }
+        }
+        for (int b=0; b<numAngleBins; b++){
+            float a = b * 2 * PI / numAngleBins;
+            float c = cos(a), s = sin(a);
+            for (int i=0; i<256; i++){
+                for (int p=0; p<2; p++){
+                    float x = base[i][p*2], y = base[i][p*2+1];
+                    pairs[b][i][p*2] = (int8_t)round(c * x - s * y);
+                    pairs[b][i][p*2+1] = (int8_t)round(s * x + c * y);
+                }
+            }
+        }
+    }
+};
+
+const Pattern& pattern(){
+
+    static Pattern p;
+    return p;
+}
+
+// sum of how far the circle is past the threshold on its brighter / darker side, whichever is larger
+int fastScore(const uint8_t* p, const int* offsets, int t){
+
+    int c = p[0];
+    int bright = 0, dark = 0;
+    for (int i=0; i<16; i++){
+        int v = p[offsets[i]];
+        if (v > c + t) bright += v - c - t;
+        else if (v < c - t) dark += c - t - v;
+    }
+    return max(bright, dark);
+}
+
+bool isCornerScalar(const uint8_t* p, const int* offsets, int t){
+
+    int c = p[0];
+    int runBright = 0, runDark = 0;
+    for (int i=0; i<16+8; i++){ // wrapped, arcs crossing position 0 too
+        int v = p[offsets[i & 15]];
+        runBright = v > c + t ? runBright + 1 : 0;
+        runDark = v < c - t ? runDark + 1 : 0;
+        if (runBright >= 9 || runDark >= 9) return true;
+    }
+    return false;
+}
+
+// corner bits for pixels x .. x+15 of a row (bit i: x + i), at least 3 pixels from any edge
+uint32_t fastBlock(const uint8_t* p, const int* offsets, int t){
+
+#if defined(FEATURES_SSE2)
+    __m128i c = _mm_loadu_si128((const __m128i*)p);
+    __m128i tv = _mm_set1_epi8((char)t);
+    __m128i hi = _mm_adds_epu8(c, tv);
+    __m128i lo = _mm_subs_epu8(c, tv);
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+
+    __m128i bright[16], dark[16];
+    for (int i=0; i<16; i++){
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + offsets[i]));
+        bright[i] = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(v, hi), zero), _mm_set1_epi8(-1)); // v > c + t
+        dark[i] = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(lo, v), zero), _mm_set1_epi8(-1)); // v < c - t
+        if (i == 12) {
+            // any 9 arc covers 2 of the 4 compass points: reject the whole block early
+            __m128i nb = _mm_setzero_si128(), nd = _mm_setzero_si128();
+            for (int k=0; k<16; k+=4){
+                nb = _mm_add_epi8(nb, _mm_and_si128(bright[k], one));
+                nd = _mm_add_epi8(nd, _mm_and_si128(dark[k], one));
+            }
+            __m128i candidate = _mm_or_si128(_mm_cmpgt_epi8(nb, one), _mm_cmpgt_epi8(nd, one));
+            if (_mm_movemask_epi8(candidate) == 0) return 0;
+        }
+    }
+
+    // longest run round the circle per lane
+    __m128i runB = zero, runD = zero, maxB = zero, maxD = zero;
+    for (int i=0; i<16+8; i++){
+        runB = _mm_and_si128(_mm_add_epi8(runB, one), bright[i & 15]);
+        runD = _mm_and_si128(_mm_add_epi8(runD, one), dark[i & 15]);
+        maxB = _mm_max_epu8(maxB, runB);
+        maxD = _mm_max_epu8(maxD, runD);
+    }
+    __m128i eight = _mm_set1_epi8(8);
+    return _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi8(maxB, eight), _mm_cmpgt_epi8(maxD, eight)));
+#elif defined(FEATURES_NEON)
+    uint8x16_t c = vld1q_u8(p);
+    uint8x16_t tv = vdupq_n_u8(t);
+    uint8x16_t hi = vqaddq_u8(c, tv);
+    uint8x16_t lo = vqsubq_u8(c, tv);
+    uint8x16_t one = vdupq_n_u8(1);
+
+    uint8x16_t bright[16], dark[16];
+    for (int i=0; i<16; i++){
+        uint8x16_t v = vld1q_u8(p + offsets[i]);
+        bright[i] = vcgtq_u8(v, hi);
+        dark[i] = vcltq_u8(v, lo);
+    }
+    uint8x16_t nb = vdupq_n_u8(0), nd = vdupq_n_u8(0);
+    for (int k=0; k<16; k+=4){
+        nb = vaddq_u8(nb, vandq_u8(bright[k], one));
+        nd = vaddq_u8(nd, vandq_u8(dark[k], one));
+    }
+    uint8x16_t candidate = vorrq_u8(vcgeq_u8(nb, vdupq_n_u8(2)), vcgeq_u8(nd, vdupq_n_u8(2)));
+    uint64x2_t any = vreinterpretq_u64_u8(candidate);
+    if ((vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) == 0) return 0;
+
+    uint8x16_t runB = vdupq_n_u8(0), runD = vdupq_n_u8(0), maxB = runB, maxD = runD;
+    for (int i=0; i<16+8; i++){
+        runB = vandq_u8(vaddq_u8(runB, one), bright[i & 15]);
+        runD = vandq_u8(vaddq_u8(runD, one), dark[i & 15]);
+        maxB = vmaxq_u8(maxB, runB);
+        maxD = vmaxq_u8(maxD, runD);
+    }
+    uint8_t corner[16];
+    vst1q_u8(corner, vorrq_u8(vcgtq_u8(maxB, vdupq_n_u8(8)), vcgtq_u8(maxD, vdupq_n_u8(8))));
+    uint32_t bits = 0;
+    for (int i=0; i<16; i++) bits |= (corner[i] & 1) << i;
+    return bits;
+#else
+    uint32_t bits = 0;
+    for (int i=0; i<16; i++) if (isCornerScalar(p + i, offsets, t)) bits |= 1 << i;
+    return bits;
+#endif
+}
+
+void toGray(const ofPixels& pixels, Image& gray){
+
+    gray.w = pixels.getWidth();
+    gray.h = pixels.getHeight();
+    gray.data.resize((size_t)gray.w * gray.h);
+    int channels = pixels.getNumChannels();
+    const uint8_t* src = pixels.getData();
+    size_t n = (size_t)gray.w * gray.h;
+    if (channels == 1) memcpy(&gray.data[0], src, n);
+    else for (size_t i=0; i<n; i++, src+=channels) gray.data[i] = (77 * src[0] + 150 * src[1] + 29 * src[2]) >> 8;
+}
+
+void downscale(const Image& src, Image& dst, float scale){ // bilinear
+
+    dst.w = max(1, (int)(src.w * scale));
+    dst.h = max(1, (int)(src.h * scale));
+    dst.data.resize((size_t)dst.w * dst.h);
+    float inv = 1.0f / scale;
+    for (int y=0; y<dst.h; y++){
+        float sy = min((y + 0.5f) * inv - 0.5f, src.h - 1.001f);
+        int y0 = max(0, (int)sy);
+        int fy = (int)((sy - y0) * 256);
+        const uint8_t* r0 = src.row(y0);
+        const uint8_t* r1 = src.row(min(y0 + 1, src.h - 1));
+        uint8_t* out = dst.row(y);
+        for (int x=0; x<dst.w; x++){
+            float sx = min((x + 0.5f) * inv - 0.5f, src.w - 1.001f);
+            int x0 = max(0, (int)sx);
+            int fx = (int)((sx - x0) * 256);
+            int x1 = min(x0 + 1, src.w - 1);
+            int top = r0[x0] * (256 - fx) + r0[x1] * fx;
+            int bottom = r1[x0] * (256 - fx) + r1[x1] * fx;
+            out[x] = (top * (256 - fy) + bottom * fy + (1 << 15)) >> 16;
+        }
+    }
+}
+
+void smooth(const Image& src, Image& dst){ // [1 4 6 4 1] / 16 both ways, edges clamped
+
+    Image tmp;
+    tmp.w = dst.w = src.w;
+    tmp.h = dst.h = src.h;
+    tmp.data.resize(src.data.size());
+    dst.data.resize(src.data.size());
+    const int k[5] = { 1, 4, 6, 4, 1 };
+    for (int y=0; y<src.h; y++){
+        const uint8_t* in = src.row(y);
+        uint8_t* out = tmp.row(y);
+        for (int x=0; x<src.w; x++){
+            int s = 0;
+            for (int i=-2; i<=2; i++) s += k[i+2] * in[ofClamp(x + i, 0, src.w - 1)];
+            out[x] = (s + 8) >> 4;
+        }
+    }
+    for (int y=0; y<src.h; y++){
+        const uint8_t* rows[5];
+        for (int i=-2; i<=2; i++) rows[i+2] = tmp.row(ofClamp(y + i, 0, src.h - 1));
+        uint8_t* out = dst.row(y);
+        for (int x=0; x<src.w; x++){
+            int s = 0;
+            for (int i=0; i<5; i++) s += k[i] * rows[i][x];
+            out[x] = (s + 8) >> 4;
+        }
+    }
+}
+
+// FAST corners of one level, non-max suppressed, strongest maxKeep (x, y in level pixels)
+void detectLevel(const Image& img, int threshold, int maxKeep, vector<Keypoint>& out){
+
+    int w = img.w, h = img.h;
+    if (w < 2 * border + 16 || h < 2 * border) return;
+
+    int offsets[16];
+    for (int i=0; i<16; i++) offsets[i] = circleY[i] * w + circleX[i];
+
+    // score rows of corners only, 0 elsewhere - three rows kept for the 3x3 suppression
+    vector<int> scores((size_t)w * h, 0);
+    for (int y=border-1; y<h-border+1; y++){
+        const uint8_t* row = img.row(y);
+        int* scoreRow = &scores[(size_t)y * w];
+        for (int x=border-1; x<w-border+1; x+=16){
+            int x0 = min(x, w - border + 1 - 16); // last block overlaps the previous one
+            uint32_t bits = fastBlock(row + x0, offsets, threshold);
+            bits &= ~0u << (x - x0); // already done
+            while (bits){
+                int i = __builtin_ctz(bits);
+                bits &= bits - 1;
+                scoreRow[x0 + i] = fastScore(row + x0 + i, offsets, threshold);
+            }
+        }
+    }
+
+    vector<Keypoint> level;
+    for (int y=border; y<h-border; y++){
+        const int* s = &scores[(size_t)y * w];
+        for (int x=border; x<w-border; x++){
+            int v = s[x];
+            if (v == 0) continue;
+            // strictly stronger than what's after it, at least as strong as what's before: ties keep one
+            if (v < s[x-1] || v <= s[x+1] || v < s[x-w-1] || v < s[x-w] || v < s[x-w+1] || v <= s[x+w-1] || v <= s[x+w] || v <= s[x+w+1]) continue;
+            Keypoint k;
+            k.x = x;
+            k.y = y;
+            k.response = v;
+            k.octave = 0;
+            k.angle = 0;
+            k.reserved = 0;
+            level.push_back(k);
+        }
+    }
+    if (level.size() > maxKeep) {
+        nth_element(level.begin(), level.begin() + maxKeep, level.end(), [](const Keypoint& a, const Keypoint& b){ return a.response > b.response; });
+        level.resize(maxKeep);
+    }
+    out.insert(out.end(), level.begin(), level.end());
+}
+
+uint8_t orientation(const Image& img, int x, int y){
+
+    // intensity centroid of the disc round the keypoint
+    int m01 = 0, m10 = 0;
+    for (int dy=-patchRadius; dy<=patchRadius; dy++){
+        int dx = (int)sqrt((float)(patchRadius * patchRadius - dy * dy));
+        const uint8_t* row = img.row(y + dy) + x;
+        int rowSum = 0;
+        for (int i=-dx; i<=dx; i++){
+            m10 += i * row[i];
+            rowSum += row[i];
+        }
+        m01 += dy * rowSum;
+    }
+    float a = atan2((float)m01, (float)m10);
+    return (uint8_t)((int)round(a / (2 * PI) * 256) & 255);
+}
+
+void describe(const Image& smoothed, int x, int y, uint8_t angle, uint8_t* desc){
+
+    int bin = ((angle * numAngleBins + 128) >> 8) % numAngleBins;
+    const int8_t (*pairs)[4] = pattern().pairs[bin];
+    const uint8_t* c = smoothed.row(y) + x;
+    int w = smoothed.w;
+    for (int i=0; i<FeatureSet::descriptorBytes; i++){
+        uint8_t byte = 0;
+        for (int b=0; b<8; b++){
+            const int8_t* p = pairs[i*8 + b];
+            if (c[p[1] * w + p[0]] < c[p[3] * w + p[2]]) byte |= 1 << b;
+        }
+        desc[i] = byte;
+    }
+}
+
+}
+
+void detectFeatures(const ofPixels& image, FeatureSet& features, int maxFeatures, int threshold){
+
+    features.keypoints.clear();
+    features.descriptors.clear();
+    features.width = image.getWidth();
+    features.height = image.getHeight();
+    if (!image.isAllocated()) return;
+
+    // levels 2^(-1/2) apart, features shared out by area
+    Image levels[numLevels];
+    toGray(image, levels[0]);
+    float scales[numLevels];
+    scales[0] = 1;
+    float areaSum = 1;
+    for (int l=1; l<numLevels; l++){
+        scales[l] = scales[l-1] * (float)M_SQRT1_2;
+        downscale(levels[l-1], levels[l], (float)M_SQRT1_2);
+        areaSum += scales[l] * scales[l];
+    }
+
+    for (int l=0; l<numLevels; l++){
+        const Image& img = levels[l];
+        vector<Keypoint> kps;
+        detectLevel(img, threshold, (int)ceil(maxFeatures * scales[l] * scales[l] / areaSum), kps);
+        if (kps.empty()) continue;
+
+        Image smoothed;
+        smooth(img, smoothed);
+        size_t first = features.keypoints.size();
+        features.descriptors.resize((first + kps.size()) * FeatureSet::descriptorBytes);
+        for (int i=0; i<kps.size(); i++){
+            Keypoint k = kps[i];
+            int x = k.x, y = k.y;
+            k.angle = orientation(img, x, y);
+            describe(smoothed, x, y, k.angle, &features.descriptors[(first + i) * FeatureSet::descriptorBytes]);
+            k.octave = l;
+            k.x = (x + 0.5f) / scales[l] - 0.5f; // level 0 pixels
+            k.y = (y + 0.5f) / scales[l] - 0.5f;
+            features.keypoints.push_back(k);
+        }
+    }
+}
+
+namespace {
+
+struct FeatHeader {
+    char magic[4]; // "3DFT"
+    uint32_t version;
+    uint32_t count;
+    uint32_t width;
+    uint32_t height;
+    uint32_t keypointBytes;
+    uint32_t descriptorBytes;
+    uint32_t reserved;
+    uint64_t undistortKey;
+};
+
+}
+
+bool saveFeatures(const string& path, const FeatureSet& features){
+
+    FeatHeader h;
+    memcpy(h.magic, "3DFT", 4);
+    h.version = featVersion;
+    h.count = features.keypoints.size();
+    h.width = features.width;
+    h.height = features.height;
+    h.keypointBytes = sizeof(Keypoint);
+    h.descriptorBytes = FeatureSet::descriptorBytes;
+    h.reserved = 0;
+    h.undistortKey = features.undistortKey;
+
+    string tmpPath = path + ".tmp" + ofToString(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (h.count > 0) {
+        ok = ok && fwrite(&features.keypoints[0], sizeof(Keypoint), h.count, f) == h.count;
+        ok = ok && fwrite(&features.descriptors[0], FeatureSet::descriptorBytes, h.count, f) == h.count;
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        ofLogWarning("Features") << "can't write feature file: " << path;
+        remove(tmpPath.c_str());
+    }
+    return ok;
+}
+
+bool loadFeatures(const string& path, FeatureSet& features){
+
+    MappedFile file(path, MappedFile::ACCESS_SEQUENTIAL);
+    if (!file.isOpen() || file.size() < sizeof(FeatHeader)) return false;
+
+    FeatHeader h;
+    memcpy(&h, file.getData(), sizeof(h));
+    if (memcmp(h.magic, "3DFT", 4) != 0 || h.version != featVersion || h.keypointBytes != sizeof(Keypoint) || h.descriptorBytes != FeatureSet::descriptorBytes) {
+        ofLogWarning("Features") << "not a version " << featVersion << " feature file: " << path;
+        return false;
+    }
+    if (file.size() < sizeof(h) + (size_t)h.count * (sizeof(Keypoint) + FeatureSet::descriptorBytes)) return false; // truncated
+
+    features.width = h.width;
+    features.height = h.height;
+    features.undistortKey = h.undistortKey;
+    features.keypoints.resize(h.count);
+    features.descriptors.resize((size_t)h.count * FeatureSet::descriptorBytes);
+    if (h.count > 0) {
+        const unsigned char* p = file.getData() + sizeof(h);
+        memcpy(&features.keypoints[0], p, (size_t)h.count * sizeof(Keypoint));
+        memcpy(&features.descriptors[0], p + (size_t)h.count * sizeof(Keypoint), features.descriptors.size());
+    }
+    return true;
+}
+
+bool loadFeatureHeader(const string& path, FeatureSet& features){
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL) return false;
+    FeatHeader h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, "3DFT", 4) == 0 && h.version == featVersion;
+    fclose(f);
+    if (!ok) return false;
+    features.width = h.width;
+    features.height = h.height;
+    features.undistortKey = h.undistortKey;
+    return true;
+}
+
+string getFastImpl(){
+
+#if defined(FEATURES_SSE2)
+    return "sse2";
+#elif defined(FEATURES_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,44 @@
+//
+//  Features.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// ORB style keypoints + binary descriptors, computed once per image and kept in a .feat file
+// next to it, so reconstruction starts matching instead of detecting:
+// FAST-9 corners (SSE2 / NEON, 16 pixels per test) on a 4 level pyramid, 3x3 non-max suppression,
+// strongest kept per level, intensity centroid orientation, 256 bit steered BRIEF on a smoothed copy
+//
+// .feat layout (version 2, little endian) - descriptors contiguous so matchers can mmap + scan them:
+//   header: "3DFT", uint32 version, uint32 count, uint32 image width, uint32 image height,
+//           uint32 keypoint bytes (16), uint32 descriptor bytes (32), uint32 reserved, uint64 undistort key
+//   count Keypoints, then count descriptors
+
+struct Keypoint {
+    float x, y; // pixels in the image it was detected on (see FeatureSet width / height)
+    float response; // FAST score, higher is stronger
+    uint8_t octave; // pyramid level, scale 2^(-octave/2)
+    uint8_t angle; // orientation, 256 steps per turn
+    uint16_t reserved;
+};
+
+struct FeatureSet {
+    int width = 0; // image size keypoints are in - scale to any other resolution of the same shot
+    int height = 0;
+    uint64_t undistortKey = 0; // lens model the image was undistorted with (Undistorter::getModelKey()), 0: as shot
+    vector<Keypoint> keypoints;
+    vector<uint8_t> descriptors; // descriptorBytes per keypoint, same order
+
+    static const int descriptorBytes = 32;
+    const uint8_t* getDescriptor(int i) const { return &descriptors[(size_t)i * descriptorBytes]; }
+    int size() const { return keypoints.size(); }
+};
+
+void detectFeatures(const ofPixels& image, FeatureSet& features, int maxFeatures = 4000, int threshold = 20); // RGB or gray, thread safe
+bool saveFeatures(const string& path, const FeatureSet& features); // temp file + rename, never seen half written
+bool loadFeatures(const string& path, FeatureSet& features);
+bool loadFeatureHeader(const string& path, FeatureSet& features); // size + undistortKey only, no keypoints read
+string getFastImpl(); // "sse2", "neon" or "scalar"
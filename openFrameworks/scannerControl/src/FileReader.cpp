@@ -0,0 +1,56 @@
+//
+//  FileReader.cpp
+//  scannerControl
+//
+//
+
+#include "FileReader.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+bool FileReader::open(const string& path){
+
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close();
+        return false;
+    }
+    length = st.st_size;
+    return true;
+}
+
+void FileReader::close(){
+
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    length = 0;
+}
+
+bool FileReader::read(uint64_t offset, size_t n, vector<unsigned char>& out){
+
+    if (fd < 0 || offset > length || n > length - offset) return false;
+    out.resize(n);
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = pread(fd, out.data() + got, n - got, offset + got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false; // error, or shrunk since it was opened
+        got += r;
+    }
+    return true;
+}
+
+size_t FileReader::readPrefix(size_t n, vector<unsigned char>& out){
+
+    n = min((uint64_t)n, length);
+    if (!read(0, n, out)) {
+        out.clear();
+        return 0;
+    }
+    return n;
+}
@@ -0,0 +1,38 @@
+//
+//  FileReader.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// reads parts of a file with pread, for parsers that only need its headers + whatever they point
+// at (EXIF, RAW previews): nothing else is read or paged in, and unlike a mapping a file that's
+// truncated meanwhile just reads short. One per parse - safe to use on any thread
+
+class FileReader {
+
+public:
+
+    FileReader(){}
+    FileReader(const string& path) { open(path); }
+    ~FileReader() { close(); }
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    bool open(const string& path);
+    void close();
+    bool isOpen() { return fd >= 0; }
+    uint64_t size() { return length; } // when opened
+
+    bool read(uint64_t offset, size_t n, vector<unsigned char>& out); // exactly n bytes into out (resized), false if past the end / error
+    size_t readPrefix(size_t n, vector<unsigned char>& out); // first min(n, size) bytes, # read
+
+
+private:
+
+    int fd = -1;
+    uint64_t length = 0;
+};
@@ -0,0 +1,47 @@
+//
+//  HullExporter.cpp
+//  scannerControl
+//
+//
+
+#include "HullExporter.hpp"
+
+bool HullExporter::start(shared_ptr<const VisualHull::Grid> grid, const string& path, MeshFormat format){
+
+    if (bBusy || grid == NULL) return false;
+    if (runThread.joinable()) runThread.join();
+    bBusy = true;
+    bFinished = false;
+    runThread = std::thread(&HullExporter::run, this, grid, path, format);
+    return true;
+}
+
+bool HullExporter::update(){
+
+    if (!bFinished) return false;
+    bFinished = false;
+    return true;
+}
+
+
+// PRIVATE
+
+
+void HullExporter::run(shared_ptr<const VisualHull::Grid> grid, string path, MeshFormat format){
+
+    Stats s;
+    s.path = path;
+    s.numViews = grid->numViews;
+
+    string dir = ofFilePath::getEnclosingDirectory(path, false);
+    string tmpPath = ofFilePath::join(dir, "." + ofFilePath::getFileName(path) + ".tmp");
+    s.ok = extractMesh(*grid, tmpPath, format, &s.mesh) && rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!s.ok) remove(tmpPath.c_str());
+
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats = s;
+    }
+    bFinished = true;
+    bBusy = false;
+}
@@ -0,0 +1,46 @@
+//
+//  HullExporter.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+#include "VisualHull.hpp"
+#include "MeshExtractor.hpp"
+
+// writes a snapshot of the hull as a mesh file (extractMesh) on its own thread, so the app keeps
+// drawing + carving meanwhile - the grid is shared, not copied, carving swaps in a new one.
+// Written under a temp name, the file only appears once complete
+
+class HullExporter {
+
+public:
+
+    struct Stats {
+        bool ok = false;
+        string path;
+        int numViews = 0;
+        MeshStats mesh;
+    };
+
+    ~HullExporter() { if (runThread.joinable()) runThread.join(); }
+
+    bool start(shared_ptr<const VisualHull::Grid> grid, const string& path, MeshFormat format); // false if still busy
+    bool isBusy() { return bBusy; }
+    bool update(); // main thread, true once after each export finished
+    Stats getStats() { std::lock_guard<std::mutex> lock(statsMutex); return stats; }
+
+
+private:
+
+    void run(shared_ptr<const VisualHull::Grid> grid, string path, MeshFormat format);
+
+    std::thread runThread;
+    std::atomic<bool> bBusy { false };
+    std::atomic<bool> bFinished { false };
+    std::mutex statsMutex;
+    Stats stats;
+};
@@ -0,0 +1,126 @@
+//
+//  ImageDecode.cpp
+//  scannerControl
+//
+//
+
+#include "ImageDecode.hpp"
+#include "MappedFile.hpp"
+#include "RawPreview.hpp"
+#include "FreeImage.h"
+#include <mutex>
+
+static const int maxReads = 3; // a file still being rewritten gets this many decodes before it fails
+
+// JPEG plugin takes the requested size in the high 16 bits, picks the DCT scale from it
+static int loadFlags(FREE_IMAGE_FORMAT fif, int maxSize){
+
+    if (fif == FIF_JPEG && maxSize > 0) return JPEG_FAST | (min(maxSize, 0xFFFF) << 16);
+    return 0;
+}
+
+// FIBITMAP (bottom up, BGR on little endian) -> RGB / gray ofPixels
+static bool bitmapToPixels(FIBITMAP* bmp, ofPixels& pixels){
+
+    if (FreeImage_GetImageType(bmp) != FIT_BITMAP) return false;
+
+    FIBITMAP* converted = NULL;
+    int bpp = FreeImage_GetBPP(bmp);
+    bool gray = (bpp == 8 && FreeImage_GetColorType(bmp) == FIC_MINISBLACK);
+    if (!gray && bpp != 24) {
+        converted = FreeImage_ConvertTo24Bits(bmp); // palette / 32 bit / 16 bit
+        if (converted == NULL) return false;
+        bmp = converted;
+    }
+
+    int w = FreeImage_GetWidth(bmp);
+    int h = FreeImage_GetHeight(bmp);
+    int channels = gray ? 1 : 3;
+    pixels.allocate(w, h, gray ? OF_PIXELS_GRAY : OF_PIXELS_RGB);
+
+    unsigned char* dst = pixels.getData();
+    for (int y=0; y<h; y++){
+        const unsigned char* src = FreeImage_GetScanLine(bmp, h-1-y);
+        unsigned char* row = dst + (size_t)y * w * channels;
+        if (gray) {
+            memcpy(row, src, w);
+        } else {
+            for (int x=0; x<w; x++){
+                row[0] = src[FI_RGBA_RED];
+                row[1] = src[FI_RGBA_GREEN];
+                row[2] = src[FI_RGBA_BLUE];
+                row += 3;
+                src += 3;
+            }
+        }
+    }
+
+    if (converted != NULL) FreeImage_Unload(converted);
+    return true;
+}
+
+void initImageDecode(){
+
+    // static FreeImage builds (linux) load no plugins until this runs; reference counted, so ofImage's own init is harmless
+    static std::once_flag once;
+    std::call_once(once, [](){ FreeImage_Initialise(); });
+}
+
+bool decodeImage(const string& path, ofPixels& pixels, int maxSize){
+
+    initImageDecode();
+
+    // RAW: container headers + the embedded preview are read, the sensor data never is
+    if (isRawFile(path)) {
+        vector<unsigned char> jpeg;
+        return readRawPreview(path, jpeg) && decodeImage(jpeg.data(), jpeg.size(), pixels, maxSize, "preview.jpg");
+    }
+
+    // straight out of the page cache, no read() copy into a buffer first - rewritten in place
+    // while decoding, what was decoded may mix old + new contents: decode again
+    bool mapped = false;
+    for (int i=0; i<maxReads; i++){
+        MappedFile file(path, MappedFile::ACCESS_SEQUENTIAL);
+        if (!file.isOpen()) break;
+        mapped = true;
+        bool ok = decodeImage(file.getData(), file.size(), pixels, maxSize, path);
+        if (!file.hasChanged()) return ok;
+        ofLogVerbose("ImageDecode") << "changed while decoding, reading again: " << path;
+    }
+    if (mapped) return false; // never held still
+
+    // can't map (empty, special file): let FreeImage read it
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(path.c_str(), 0);
+    if (fif == FIF_UNKNOWN) fif = FreeImage_GetFIFFromFilename(path.c_str());
+    if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsReading(fif)) return false;
+
+    FIBITMAP* bmp = FreeImage_Load(fif, path.c_str(), loadFlags(fif, maxSize));
+    if (bmp == NULL) return false;
+
+    bool ok = bitmapToPixels(bmp, pixels);
+    FreeImage_Unload(bmp);
+    return ok;
+}
+
+bool decodeImage(const unsigned char* data, size_t size, ofPixels& pixels, int maxSize, const string& nameHint){
+
+    if (data == NULL || size == 0 || size > 0xFFFFFFFF) return false;
+    initImageDecode();
+
+    // FreeImage only reads from a memory stream it didn't allocate, never writes to it
+    FIMEMORY* mem = FreeImage_OpenMemory((BYTE*)data, (DWORD)size);
+    if (mem == NULL) return false;
+
+    FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeFromMemory(mem, 0);
+    if (fif == FIF_UNKNOWN && nameHint != "") fif = FreeImage_GetFIFFromFilename(nameHint.c_str());
+    bool ok = false;
+    if (fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif)) {
+        FIBITMAP* bmp = FreeImage_LoadFromMemory(fif, mem, loadFlags(fif, maxSize));
+        if (bmp != NULL) {
+            ok = bitmapToPixels(bmp, pixels);
+            FreeImage_Unload(bmp);
+        }
+    }
+    FreeImage_CloseMemory(mem);
+    return ok;
+}
@@ -0,0 +1,18 @@
+//
+//  ImageDecode.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// image file -> ofPixels through FreeImage directly (thread safe, no GL)
+// maxSize > 0: JPEGs are decoded with libjpeg's scaled IDCT (1/2, 1/4, 1/8),
+// at the smallest scale still >= maxSize on the long side - a fraction of the full decode's time + memory
+// CR2 / CR3 decode their embedded full size JPEG preview (see RawPreview), the RAW file itself is left alone
+// files are memory mapped and decoded in place, unmapped as soon as the decode returns
+
+void initImageDecode(); // FreeImage_Initialise, once per process (later calls return at once) - before the first decode / FreeImage call
+bool decodeImage(const string& path, ofPixels& pixels, int maxSize = 0); // maxSize 0: full resolution
+bool decodeImage(const unsigned char* data, size_t size, ofPixels& pixels, int maxSize = 0, const string& nameHint = ""); // encoded image already in memory (mapped file, embedded preview), nameHint: format fallback by extension
@@ -0,0 +1,299 @@
+//
+//  ImageStore.cpp
+//  scannerControl
+//
+//
+
+#include "ImageStore.hpp"
+
+void ImageStore::setup(int numDecodeThreads, string thumbCacheDir){
+
+    if (thumbCache.setup(ofToDataPath(thumbCacheDir, true))) decodePool.setThumbnailCache(&thumbCache);
+    decodePool.setPostProcess([](DecodePool::Result& r){
+        if (r.maxSize == 0) return; // full res, proxy had it all
+        readExif(r.path, r.meta); // header only, off the main thread - even if the decode failed
+        if (r.ok) r.sharpness = ::getSharpness(r.pixels); // ~1ms, same size for every proxy so scores compare
+    });
+    decodePool.setup(numDecodeThreads);
+}
+
+void ImageStore::setBudget(size_t ramMB, size_t vramMB){
+
+    ramBudget = ramMB * 1024 * 1024;
+    vramBudget = vramMB * 1024 * 1024;
+    evict();
+}
+
+int ImageStore::add(string path){
+
+    Handle h = allocSlot();
+    Entry& e = slotEntry(h.slot);
+    e.path = path;
+    order.push_back(h); // where it lands until its capture time is known
+
+    decodePool.add(toId(h), generation, path, proxySize); // display proxy, not full res
+    return order.size() - 1;
+}
+
+void ImageStore::remove(int i){
+
+    if (i < 0 || i >= order.size()) return;
+    Handle h = order[i];
+    order.erase(order.begin() + i); // handles only, images stay where they are
+    freeSlot(h);
+}
+
+void ImageStore::rename(int i, string newPath){
+
+    if (i < 0 || i >= order.size()) return;
+    at(i).path = newPath;
+}
+
+int ImageStore::find(const string& path){
+
+    for (int i=order.size()-1; i>=0; i--){ // newest first, removals are usually recent shots
+        if (at(i).path == path) return i;
+    }
+    return -1;
+}
+
+void ImageStore::clear(){
+
+    generation++; // anything still decoding is dropped when it comes back
+    decodePool.clear();
+    proxyUploader.clear();
+    fullUploader.clear();
+    while (!order.empty()) {
+        freeSlot(order.back());
+        order.pop_back();
+    }
+    numFromCache = 0;
+    recentSharpness.clear();
+    blurryPaths.clear();
+    ramUsed = 0;
+    vramUsed = 0;
+}
+
+int ImageStore::update(){
+
+    // decoded pixels -> uploaders, moved all the way
+    DecodePool::Result r;
+    while (decodePool.getNextResult(r)){
+        Entry* e = get(fromId(r.id));
+        if (r.generation != generation || e == NULL) continue; // cleared / removed since queued
+        if (r.maxSize > 0) { // proxy
+            if (!e->metaRead) {
+                e->meta = r.meta;
+                e->metaRead = true;
+                placeByCaptureTime(fromId(r.id));
+            }
+            if (r.ok) {
+                e->sharpness = r.sharpness;
+                e->blurry = checkBlurry(r.sharpness);
+                if (e->blurry) blurryPaths.push_back(e->path);
+                proxyUploader.add(r.id, std::move(r.pixels));
+            }
+            else e->state = IMAGE_FAILED;
+            if (r.fromCache) numFromCache++;
+        }
+        else if (r.ok) {
+            if (!e->fullPixels.isAllocated()) {
+                e->fullPixels = std::move(r.pixels); // kept in RAM for re-uploads, upload straight from it
+                ramUsed += e->fullPixels.getTotalBytes();
+            }
+            fullUploader.add(r.id, &e->fullPixels);
+        }
+        else e->fullRequested = false;
+    }
+
+    // upload a slice of pending pixels, keeps frame time steady while ingesting
+    // full res gets what's left of the budget after proxies
+    uint64_t uploadStart = ofGetElapsedTimeMicros();
+    proxyUploader.update(uploadBudgetMs);
+    float budgetLeftMs = uploadBudgetMs - (ofGetElapsedTimeMicros() - uploadStart) / 1000.0;
+    if (fullUploader.getNumPending() > 0 && budgetLeftMs > 0) fullUploader.update(budgetLeftMs);
+
+    int numReady = 0;
+    uint64_t id;
+    ofTexture tex;
+    while (proxyUploader.getNextUploaded(&id, &tex)){
+        Entry* e = get(fromId(id));
+        if (e == NULL) continue; // removed while uploading
+        e->proxy = tex;
+        e->state = IMAGE_READY;
+        vramUsed += textureBytes(tex);
+        numReady++;
+    }
+    while (fullUploader.getNextUploaded(&id, &tex)){
+        Entry* e = get(fromId(id));
+        if (e == NULL) continue;
+        e->fullTexture = tex;
+        e->fullRequested = false;
+        vramUsed += textureBytes(tex);
+    }
+
+    evict();
+    return numReady;
+}
+
+bool ImageStore::getNextBlurry(string* path){
+
+    if (blurryPaths.empty()) return false;
+    *path = blurryPaths.front();
+    blurryPaths.pop_front();
+    return true;
+}
+
+int ImageStore::getIndex(Handle h){
+
+    if (get(h) == NULL) return -1;
+    for (int i=order.size()-1; i>=0; i--){
+        if (order[i] == h) return i;
+    }
+    return -1;
+}
+
+ofTexture* ImageStore::getFull(int i){
+
+    Entry& e = at(i);
+    e.lastUsed = ++useCounter;
+    if (e.fullTexture.isAllocated()) return &e.fullTexture;
+    requestFull(order[i]);
+    return NULL;
+}
+
+
+// PRIVATE
+
+
+ImageStore::Handle ImageStore::allocSlot(){
+
+    if (freeSlots.empty()) { // new slab, existing ones stay where they are
+        uint32_t first = slabs.size() * slabSize;
+        slabs.push_back(unique_ptr<Entry[]>(new Entry[slabSize]));
+        for (int i=slabSize-1; i>=0; i--) freeSlots.push_back(first + i);
+    }
+    Handle h;
+    h.slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    Entry& e = slotEntry(h.slot);
+    e.gen++;
+    if (e.gen == 0) e.gen++; // 0 is never valid
+    e.used = true;
+    e.state = IMAGE_LOADING;
+    e.fullRequested = false;
+    e.lastUsed = 0;
+    h.gen = e.gen;
+    return h;
+}
+
+void ImageStore::freeSlot(Handle h){
+
+    Entry* e = get(h);
+    if (e == NULL) return;
+
+    uint64_t id = toId(h);
+    proxyUploader.cancel(id); // decodes still coming for it won't match the slot any more
+    fullUploader.cancel(id); // (also drops borrowed fullPixels before they're freed)
+
+    vramUsed -= textureBytes(e->proxy) + textureBytes(e->fullTexture);
+    if (e->fullPixels.isAllocated()) ramUsed -= e->fullPixels.getTotalBytes();
+
+    e->used = false;
+    e->path.clear();
+    e->meta = ImageMeta();
+    e->metaRead = false;
+    e->sharpness = -1;
+    e->blurry = false;
+    e->proxy.clear();
+    e->fullTexture.clear();
+    e->fullPixels.clear();
+    freeSlots.push_back(h.slot);
+}
+
+ImageStore::Entry* ImageStore::get(Handle h){
+
+    if (h.slot >= slabs.size() * slabSize) return NULL;
+    Entry& e = slotEntry(h.slot);
+    return (e.used && e.gen == h.gen) ? &e : NULL;
+}
+
+void ImageStore::placeByCaptureTime(Handle h){
+
+    // keep capture order: camera numbering wraps + files can land out of order
+    // images without a capture time stay where they landed, ones still waiting on their EXIF place themselves later
+    Entry& e = slotEntry(h.slot);
+    if (e.meta.captureTime <= 0) return;
+    int from = getIndex(h);
+    if (from < 0) return;
+    order.erase(order.begin() + from);
+
+    int i = order.size();
+    while (i > 0 && (!at(i-1).metaRead || at(i-1).meta.captureTime > e.meta.captureTime)) i--;
+    order.insert(order.begin() + i, h);
+}
+
+void ImageStore::requestFull(Handle h){
+
+    Entry& e = slotEntry(h.slot);
+    if (e.fullRequested || e.state == IMAGE_FAILED) return;
+    e.fullRequested = true;
+
+    if (e.fullPixels.isAllocated()) {
+        fullUploader.add(toId(h), &e.fullPixels); // evicted from VRAM only, re-upload from RAM copy (no copy)
+    } else {
+        decodePool.add(toId(h), generation, e.path, 0); // not resident at all, decode
+    }
+}
+
+void ImageStore::evict(){
+
+    // sum full res held, proxies are never evicted
+    size_t fullVram = 0;
+    for (int i=0; i<order.size(); i++) fullVram += textureBytes(at(i).fullTexture);
+
+    // evict least recently used first, never the most recent one (it's on screen)
+    // nor pixels an upload is still reading from
+    while (ramUsed > ramBudget || fullVram > vramBudget){
+
+        Entry* lru = NULL;
+        for (int i=0; i<order.size(); i++){
+            Entry& e = at(i);
+            if (e.lastUsed == useCounter) continue;
+            bool holdsRam = ramUsed > ramBudget && e.fullPixels.isAllocated() && !e.fullRequested;
+            bool holdsVram = fullVram > vramBudget && e.fullTexture.isAllocated();
+            if ((holdsRam || holdsVram) && (lru == NULL || e.lastUsed < lru->lastUsed)) lru = &e;
+        }
+        if (lru == NULL) break; // only the current image / uploads in flight are over budget, keep them
+
+        if (ramUsed > ramBudget && lru->fullPixels.isAllocated() && !lru->fullRequested) {
+            ramUsed -= lru->fullPixels.getTotalBytes();
+            lru->fullPixels.clear();
+        }
+        if (fullVram > vramBudget && lru->fullTexture.isAllocated()) {
+            size_t bytes = textureBytes(lru->fullTexture);
+            fullVram -= bytes;
+            vramUsed -= bytes;
+            lru->fullTexture.clear();
+        }
+    }
+}
+
+bool ImageStore::checkBlurry(float sharpness){
+
+    if (sharpness < 0) return false;
+
+    // relative to the median of the last few: same object + lighting all rotation, absolute scores aren't
+    bool blurry = false;
+    if (recentSharpness.size() >= 4) {
+        vector<float> sorted(recentSharpness.begin(), recentSharpness.end());
+        nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+        blurry = sharpness < blurRatio * sorted[sorted.size()/2];
+    }
+    if (!blurry) { // blurry frames would drag the median down
+        recentSharpness.push_back(sharpness);
+        if (recentSharpness.size() > 16) recentSharpness.pop_front();
+    }
+    return blurry;
+}
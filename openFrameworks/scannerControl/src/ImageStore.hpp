@@ -0,0 +1,137 @@
+//
+//  ImageStore.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "DecodePool.hpp"
+#include "TextureUploader.hpp"
+#include "ThumbnailCache.hpp"
+#include "ExifReader.hpp"
+#include "Sharpness.hpp"
+
+// ingested images: display proxies always resident,
+// full resolution pixels (RAM) + textures (VRAM) kept within budgets, least recently used evicted first
+// and decoded / re-uploaded again when asked for - main thread only (decodes on DecodePool threads)
+//
+// images live in fixed size slabs and never move once added: adding one costs no copies of the others,
+// removing one frees its slot for reuse. Indices (display order) change on remove(), Handles don't
+
+class ImageStore {
+
+public:
+
+    enum State {
+        IMAGE_LOADING, // proxy decoding / uploading
+        IMAGE_READY,
+        IMAGE_FAILED
+    };
+
+    // stable reference to an image, goes invalid (not dangling) once the image is removed
+    struct Handle {
+        uint32_t slot = 0;
+        uint32_t gen = 0; // slot generation, 0 never valid
+        bool operator==(const Handle& h) const { return slot == h.slot && gen == h.gen; }
+        bool operator!=(const Handle& h) const { return !(*this == h); }
+    };
+
+    void setup(int numDecodeThreads = 0, string thumbCacheDir = "thumbnails"); // 0: one less than # cores, cache dir relative to data/
+    void setProxySize(int size) { proxySize = ((size + 127) / 128) * 128; } // long side of proxies decoded from now on (rounded up, keeps thumbnail cache hits across window sizes)
+    void setBudget(size_t ramMB, size_t vramMB); // full res pixels / textures
+    void setUploadBudget(float ms) { uploadBudgetMs = ms; } // max texture upload time per update()
+    void setBlurThreshold(float ratio) { blurRatio = ratio; } // blurry: sharpness below ratio * median of recent images
+
+    int add(string path); // queues proxy decode (+ EXIF read, on the worker), returns index: last until the EXIF is in, then moved into capture order
+    void remove(int i); // later images move down one, decodes / uploads in flight for it are dropped
+    void rename(int i, string newPath); // keeps decoded proxy + full res
+    int find(const string& path); // index of image, -1 if not in store
+    void clear(); // drops everything, incl. decodes in flight
+    int update(); // once per frame: decoded -> uploaded -> evict, returns # proxies that became ready. Images can move (capture order), Handles stay
+
+    int size() { return order.size(); }
+    Handle getHandle(int i) { return order[i]; }
+    bool isValid(Handle h) { return get(h) != NULL; }
+    int getIndex(Handle h); // -1 if removed
+
+    string getPath(int i) { return at(i).path; }
+    string getFileName(int i) { return ofFilePath::getFileName(at(i).path); }
+    State getState(int i) { return at(i).state; }
+    const ImageMeta& getMeta(int i) { return at(i).meta; } // capture time, orientation, exposure - empty until hasMeta()
+    bool hasMeta(int i) { return at(i).metaRead; } // EXIF read (or tried and failed), comes back with the proxy
+    float getSharpness(int i) { return at(i).sharpness; } // -1 until proxy decoded
+    bool isBlurry(int i) { return at(i).blurry; }
+    bool getNextBlurry(string* path); // images found blurry since last call, oldest first
+    ofTexture& getProxy(int i) { return at(i).proxy; } // unallocated until ready
+    ofTexture* getFull(int i); // full res if resident (NULL if not yet), requests it otherwise
+
+    size_t getRamUsed() { return ramUsed; } // bytes of full res pixels held
+    size_t getVramUsed() { return vramUsed; } // bytes of textures, proxies + full res
+    int getNumFromCache() { return numFromCache; } // proxies read from thumbnail cache since clear()
+
+
+private:
+
+    struct Entry {
+        uint32_t gen = 0; // bumped each time slot is handed out, stale handles + decodes stop matching
+        bool used = false;
+        string path;
+        ImageMeta meta;
+        bool metaRead = false;
+        State state = IMAGE_LOADING;
+        float sharpness = -1;
+        bool blurry = false;
+        ofTexture proxy;
+        ofPixels fullPixels; // full res in RAM, lets an evicted texture come back without a decode
+        ofTexture fullTexture;
+        bool fullRequested = false; // decode or upload in flight
+        uint64_t lastUsed = 0; // useCounter at last getFull()
+
+        // never copied - pixels only ever move in, and the slot itself stays put
+        Entry(){}
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+    };
+
+    static const int slabSize = 64; // entries per slab
+
+    Handle allocSlot();
+    void freeSlot(Handle h);
+    Entry& slotEntry(uint32_t slot) { return slabs[slot / slabSize][slot % slabSize]; }
+    Entry* get(Handle h); // NULL if stale
+    Entry& at(int i) { return slotEntry(order[i].slot); }
+
+    // handle <-> decode / upload id
+    static uint64_t toId(Handle h) { return ((uint64_t)h.gen << 32) | h.slot; }
+    static Handle fromId(uint64_t id) { Handle h; h.slot = id & 0xFFFFFFFF; h.gen = id >> 32; return h; }
+
+    void placeByCaptureTime(Handle h); // EXIF just read: moved among the others by capture time
+    void requestFull(Handle h);
+    void evict(); // drop LRU full res until within budgets
+    bool checkBlurry(float sharpness); // against recent images, then remembers it
+    static size_t textureBytes(const ofTexture& tex) { return tex.isAllocated() ? (size_t)tex.getWidth() * tex.getHeight() * 3 : 0; }
+
+    vector<unique_ptr<Entry[]> > slabs; // slabs never move, only the vector of pointers grows
+    vector<uint32_t> freeSlots;
+    vector<Handle> order; // display order
+
+    ThumbnailCache thumbCache; // before decodePool, workers use it until the pool is destroyed
+    DecodePool decodePool;
+    int numFromCache = 0;
+    TextureUploader proxyUploader;
+    TextureUploader fullUploader;
+    int generation = 0; // bumped by clear(), stale decodes are dropped
+
+    deque<float> recentSharpness; // last few proxies' scores
+    deque<string> blurryPaths;
+    float blurRatio = 0.5;
+
+    int proxySize = 512;
+    float uploadBudgetMs = 4.0;
+    size_t ramBudget = 1024 * 1024 * 1024; // bytes
+    size_t vramBudget = 512 * 1024 * 1024;
+    size_t ramUsed = 0;
+    size_t vramUsed = 0;
+    uint64_t useCounter = 0;
+};
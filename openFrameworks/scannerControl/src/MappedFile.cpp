@@ -0,0 +1,144 @@
+//
+//  MappedFile.cpp
+//  scannerControl
+//
+//
+
+#include "MappedFile.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// blocks for the whole file up front: a sparse file on a full disk only fails when a page is
+// written back through the mapping, as SIGBUS. 0 or errno
+static int reserve(int fd, size_t size){
+
+#ifdef __APPLE__
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, (off_t)size, 0 };
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL; // fragmented is fine too
+        if (fcntl(fd, F_PREALLOCATE, &store) == -1) return errno;
+    }
+    return ftruncate(fd, size) == 0 ? 0 : errno; // length, blocks are already reserved
+#else
+    return posix_fallocate(fd, 0, size);
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& m){
+
+    *this = std::move(m);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& m){
+
+    if (this != &m) {
+        close();
+        data = m.data;
+        length = m.length;
+        writable = m.writable;
+        fd = m.fd;
+        openedMtime = m.openedMtime;
+        m.data = NULL;
+        m.length = 0;
+        m.writable = false;
+        m.fd = -1;
+    }
+    return *this;
+}
+
+bool MappedFile::open(const string& path, Access access){
+
+    close();
+
+    int f = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f < 0) return false;
+
+    struct stat st;
+    if (fstat(f, &st) != 0 || st.st_size <= 0) { // can't map an empty file
+        ::close(f);
+        return false;
+    }
+
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, f, 0);
+    if (p == MAP_FAILED) {
+        ofLogWarning("MappedFile") << "mmap failed (" << strerror(errno) << "): " << path;
+        ::close(f);
+        return false;
+    }
+
+    data = (unsigned char*)p;
+    length = st.st_size;
+    fd = f; // mapping has its own reference, this one is for hasChanged()
+    openedMtime = st.st_mtime;
+
+    // hints only, failures don't matter
+    if (access == ACCESS_SEQUENTIAL) {
+        posix_madvise(data, length, POSIX_MADV_SEQUENTIAL);
+        posix_madvise(data, length, POSIX_MADV_WILLNEED); // start readahead now, decoder's first touch doesn't stall
+    }
+    else posix_madvise(data, length, POSIX_MADV_RANDOM);
+    return true;
+}
+
+bool MappedFile::create(const string& path, size_t size){
+
+    close();
+    if (size == 0) return false;
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ofLogError("MappedFile") << "can't create (" << strerror(errno) << "): " << path;
+        return false;
+    }
+    int err = reserve(fd, size);
+    if (err != 0) {
+        ofLogError("MappedFile") << "can't allocate " << size << " bytes (" << strerror(err) << "): " << path;
+        ::close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        ofLogError("MappedFile") << "mmap failed (" << strerror(errno) << "): " << path;
+        return false;
+    }
+
+    data = (unsigned char*)p;
+    length = size;
+    writable = true;
+    posix_madvise(data, length, POSIX_MADV_SEQUENTIAL); // written front to back (per thread), written pages can go early
+    return true;
+}
+
+void MappedFile::close(){
+
+    if (data != NULL) munmap(data, length); // shared mapping: written pages reach the file via the page cache
+    if (fd >= 0) ::close(fd);
+    data = NULL;
+    length = 0;
+    writable = false;
+    fd = -1;
+}
+
+bool MappedFile::hasChanged(){
+
+    if (fd < 0) return false; // created, or not open
+    struct stat st;
+    return fstat(fd, &st) != 0 || (size_t)st.st_size != length || st.st_mtime != openedMtime;
+}
+
+void MappedFile::willNeed(size_t offset, size_t len){
+
+    if (data == NULL || offset >= length) return;
+
+    // madvise wants a page aligned start
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = offset - (offset % page);
+    len = min(len + (offset - start), length - start);
+    posix_madvise(data + start, len, POSIX_MADV_WILLNEED);
+}
+
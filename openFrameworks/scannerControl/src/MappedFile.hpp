@@ -0,0 +1,55 @@
+//
+//  MappedFile.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// read-only memory map of a whole file, unmapped when it goes out of scope
+// lets decoders read straight from the page cache instead of a read() copy in user space
+// create() maps a new file of known size for writing instead, so writers can fill it in
+// any order from many threads without holding the output in memory
+// a file rewritten in place while mapped changes under the reader: hasChanged() tells, so callers can
+// read it again (the watch folder only hands over files once closed / held still, so that's rare)
+// move-only, one per decode - safe to use on any thread
+
+class MappedFile {
+
+public:
+
+    enum Access {
+        ACCESS_SEQUENTIAL, // read once front to back (decodes): aggressive readahead, pages dropped behind
+        ACCESS_RANDOM // jumps around (container / header parsing): no readahead
+    };
+
+    MappedFile(){}
+    MappedFile(const string& path, Access access = ACCESS_SEQUENTIAL) { open(path, access); }
+    ~MappedFile() { close(); }
+
+    MappedFile(MappedFile&& m);
+    MappedFile& operator=(MappedFile&& m);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const string& path, Access access = ACCESS_SEQUENTIAL);
+    bool create(const string& path, size_t size); // replaces any existing file, contents start zeroed - all blocks allocated up front, false (file removed) if the disk is too full
+    void close();
+    void willNeed(size_t offset, size_t length); // prefetch a range ahead of reading it
+
+    bool isOpen() { return data != NULL; }
+    bool hasChanged(); // size / mtime differ from when it was opened - data may mix old + new contents
+    const unsigned char* getData() { return data; }
+    unsigned char* getWritableData() { return writable ? data : NULL; } // created files only
+    size_t size() { return length; }
+
+
+private:
+
+    unsigned char* data = NULL;
+    size_t length = 0;
+    bool writable = false;
+    int fd = -1; // opened files, kept to fstat the same file later
+    int64_t openedMtime = 0;
+};
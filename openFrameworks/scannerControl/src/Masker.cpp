@@ -0,0 +1,223 @@
+//
+//  Masker.cpp
+//  scannerControl
+//
+//
+
+#include "Masker.hpp"
+#include "Undistorter.hpp"
+#include <sys/stat.h>
+
+static const uint64_t referenceId = 0; // images are 1
+
+// masks carry the lens model they were made under in a private PNG chunk right before IEND:
+// length (8), "udKy", uint64 key little endian, CRC - viewers skip it (ancillary, lower case first letter)
+static const char keyChunkType[] = "udKy";
+static const unsigned char iendChunk[12] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+static const int keyChunkSize = 12 + 8;
+
+static uint32_t pngCrc(const unsigned char* data, size_t size){
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i=0; i<size; i++){
+        crc ^= data[i];
+        for (int b=0; b<8; b++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// IEND replaced by the key chunk + IEND, false if the file doesn't end like a PNG
+static bool writeKeyChunk(const string& path, uint64_t key){
+
+    FILE* f = fopen(path.c_str(), "r+b");
+    if (f == NULL) return false;
+    unsigned char end[12];
+    bool ok = fseek(f, -12, SEEK_END) == 0 && fread(end, 12, 1, f) == 1 && memcmp(end, iendChunk, 12) == 0;
+    if (ok) {
+        unsigned char chunk[keyChunkSize + 12] = { 0, 0, 0, 8 };
+        memcpy(chunk + 4, keyChunkType, 4);
+        for (int i=0; i<8; i++) chunk[8 + i] = (key >> (i * 8)) & 0xFF;
+        uint32_t crc = pngCrc(chunk + 4, 12);
+        for (int i=0; i<4; i++) chunk[16 + i] = (crc >> ((3 - i) * 8)) & 0xFF;
+        memcpy(chunk + keyChunkSize, iendChunk, 12);
+        ok = fseek(f, -12, SEEK_END) == 0 && fwrite(chunk, sizeof(chunk), 1, f) == 1;
+    }
+    return (fclose(f) == 0) && ok;
+}
+
+// 0 if the mask has no key chunk (made from images as shot)
+static uint64_t readKeyChunk(const string& path){
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL) return 0;
+    unsigned char chunk[keyChunkSize];
+    bool ok = fseek(f, -(keyChunkSize + 12), SEEK_END) == 0 && fread(chunk, keyChunkSize, 1, f) == 1;
+    fclose(f);
+    if (!ok || memcmp(chunk, "\0\0\0\x08", 4) != 0 || memcmp(chunk + 4, keyChunkType, 4) != 0) return 0;
+    uint64_t key = 0;
+    for (int i=0; i<8; i++) key |= (uint64_t)chunk[8 + i] << (i * 8);
+    return key;
+}
+
+void Masker::setup(int numThreads){
+
+    decodePool.setPostProcess([this](DecodePool::Result& r){ makeMask(r); });
+    decodePool.setup(numThreads);
+    ofLogVerbose("Masker") << "masks on " << numThreads << " threads (" << getMaskImpl() << ")";
+}
+
+void Masker::close(){
+
+    decodePool.close();
+    clear();
+}
+
+void Masker::setReference(string path){
+
+    generation++; // masks still coming back were made against the old one
+    decodePool.clear();
+    {
+        std::lock_guard<std::mutex> lock(modelMutex);
+        model.reset();
+    }
+    refPath = "";
+    pendingRefPath = path;
+    waiting.clear(); // the caller adds every image again for the new backdrop
+    added.clear();
+    decodePool.add(referenceId, generation, path, maskSize);
+}
+
+void Masker::add(string path){
+
+    if (path == refPath || path == pendingRefPath) return; // backdrop itself has no object
+    if (!added.insert(path).second) return; // queued / masked already
+    if (model == NULL) waiting.push_back(path);
+    else queue(path);
+}
+
+void Masker::clear(){
+
+    generation++;
+    decodePool.clear();
+    {
+        std::lock_guard<std::mutex> lock(modelMutex);
+        model.reset();
+    }
+    refPath = "";
+    pendingRefPath = "";
+    waiting.clear();
+    added.clear();
+    written.clear();
+    numFailed = 0;
+}
+
+int Masker::update(){
+
+    int numWritten = 0;
+    DecodePool::Result r;
+    while (decodePool.getNextResult(r)){
+        if (r.generation != generation) continue;
+
+        if (r.id == referenceId) {
+            if (!r.ok) {
+                ofLogError("Masker") << "can't use as background: " << r.path;
+                pendingRefPath = "";
+                continue;
+            }
+            shared_ptr<Model> m(new Model());
+            m->background = std::move(r.pixels);
+            if (m->background.getNumChannels() != 3) m->background.setImageType(OF_IMAGE_COLOR); // grayscale JPEG
+            {
+                std::lock_guard<std::mutex> lock(modelMutex);
+                model = m;
+            }
+            refPath = r.path;
+            pendingRefPath = "";
+            ofLogNotice("Masker") << "background " << ofFilePath::getFileName(refPath) << " (" << m->background.getWidth() << "x" << m->background.getHeight() << "), masking " << waiting.size() << " images";
+            while (!waiting.empty()) {
+                if (waiting.front() != refPath) queue(waiting.front());
+                waiting.pop_front();
+            }
+            continue;
+        }
+
+        if (r.ok) {
+            written.push_back(r.path);
+            numWritten++;
+        }
+        else numFailed++;
+    }
+    return numWritten;
+}
+
+bool Masker::getNextMask(string* imagePath){
+
+    if (written.empty()) return false;
+    *imagePath = written.front();
+    written.pop_front();
+    return true;
+}
+
+string Masker::getMaskPath(const string& imagePath){
+
+    return ofFilePath::join(ofFilePath::getEnclosingDirectory(imagePath, false), ofFilePath::getBaseName(imagePath) + "_mask.png");
+}
+
+
+// PRIVATE
+
+
+void Masker::queue(const string& path){
+
+    if (isMaskCurrent(path)) { // reopened folder, already masked against this backdrop
+        written.push_back(path);
+        return;
+    }
+    decodePool.add(1, generation, path, maskSize);
+}
+
+bool Masker::isMaskCurrent(const string& path){
+
+    struct stat image, ref, mask;
+    if (stat(getMaskPath(path).c_str(), &mask) != 0) return false;
+    if (stat(path.c_str(), &image) != 0 || stat(refPath.c_str(), &ref) != 0) return false;
+    if (mask.st_mtime < image.st_mtime || mask.st_mtime < ref.st_mtime) return false;
+    return readKeyChunk(getMaskPath(path)) == getUndistortKey(); // lens model changed since
+}
+
+uint64_t Masker::getUndistortKey(){
+
+    return undistorter != NULL ? undistorter->getModelKey() : 0;
+}
+
+void Masker::makeMask(DecodePool::Result& r){
+
+    if (r.id == referenceId || !r.ok) return;
+
+    shared_ptr<const Model> m;
+    {
+        std::lock_guard<std::mutex> lock(modelMutex);
+        m = model;
+    }
+    r.ok = false;
+    if (m == NULL) return; // cleared while decoding
+
+    ofPixels mask;
+    uint64_t key = getUndistortKey(); // what the pool just applied
+    if (r.pixels.getNumChannels() != 3) r.pixels.setImageType(OF_IMAGE_COLOR);
+    if (!computeMask(r.pixels, m->background, mask, threshold, radius)) {
+        ofLogWarning("Masker") << "size differs from background (" << r.pixels.getWidth() << "x" << r.pixels.getHeight() << "), no mask: " << r.path;
+        r.pixels.clear();
+        return;
+    }
+
+    // written under a temp name, key chunk added, only then replaces the old mask
+    string maskPath = getMaskPath(r.path);
+    string tmpPath = ofFilePath::join(ofFilePath::getEnclosingDirectory(r.path, false), "." + ofFilePath::getBaseName(r.path) + "_mask.tmp.png");
+    if (!ofSaveImage(mask, tmpPath) || (key != 0 && !writeKeyChunk(tmpPath, key)) || rename(tmpPath.c_str(), maskPath.c_str()) != 0) {
+        ofLogError("Masker") << "can't write mask: " << maskPath;
+        remove(tmpPath.c_str());
+    }
+    else r.ok = true;
+    r.pixels.clear(); // main thread only needs the count
+}
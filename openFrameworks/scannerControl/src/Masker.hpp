@@ -0,0 +1,71 @@
+//
+//  Masker.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "DecodePool.hpp"
+#include "BackgroundMask.hpp"
+
+// object masks for ingested images, written next to them as <name>_mask.png (gray, 255: object)
+// background model is a shot of the empty backdrop (setReference), images added before it's
+// decoded wait for it - decode + mask + save all run on own worker threads, main thread only
+// picks up the counts. Masks are decoded size (>= maskSize long side), not full resolution, and
+// remember the lens model they were undistorted with - made again once it changes
+
+class Masker {
+
+public:
+
+    void setup(int numThreads = 2); // own pool, ImageStore's proxies keep decoding meanwhile
+    void close();
+    void setUndistorter(Undistorter* u) { undistorter = u; decodePool.setUndistorter(u); } // images (+ backdrop) undistorted before use - set before setup()
+    void setMaskSize(int size) { maskSize = size; } // long side to decode at (JPEG DCT scaling, so >= size), from next setReference()
+    void setThreshold(int t) { threshold = t; } // colour distance (0-765) that counts as object
+    void setCleanupRadius(int r) { radius = r; } // open + close passes, 0: raw threshold
+
+    void setReference(string path); // empty backdrop, images added from now on are masked against it (anything added before is dropped, add again)
+    bool hasReference() { return model != NULL; }
+    string getReferencePath() { return refPath; }
+
+    void add(string path); // masks once the reference is ready, skipped if mask on disk is newer than image + reference and of the current lens model, or already added since setReference()
+    void clear(); // drops queued images + the reference
+    int update(); // once per frame, returns # masks written since last call
+    bool getNextMask(string* imagePath); // images masked since last call, in the order they finished
+
+    int getNumPending() { return waiting.size() + decodePool.getNumPending(); } // 0: every image added has its mask
+    int getNumFailed() { return numFailed; }
+
+    static string getMaskPath(const string& imagePath); // <dir>/<name>_mask.png
+
+
+private:
+
+    struct Model {
+        ofPixels background;
+    };
+
+    void queue(const string& path);
+    bool isMaskCurrent(const string& path); // mask newer than image + reference, same lens model
+    uint64_t getUndistortKey(); // of the lens model images are undistorted with now, 0: none
+    void makeMask(DecodePool::Result& r); // on worker threads
+
+    DecodePool decodePool;
+    Undistorter* undistorter = NULL;
+    int generation = 0; // bumped by clear() / setReference()
+
+    shared_ptr<const Model> model; // swapped on main thread, workers take a copy of the pointer
+    std::mutex modelMutex;
+    string refPath;
+    string pendingRefPath; // decoding
+
+    deque<string> waiting; // added before the reference was ready
+    set<string> added; // since the last setReference() / clear(), each image is masked once
+    deque<string> written;
+    std::atomic<int> threshold { 60 };
+    std::atomic<int> radius { 2 };
+    int maskSize = 1024;
+    int numFailed = 0;
+};
@@ -0,0 +1,388 @@
+//
+//  MeshExtractor.cpp
+//  scannerControl
+//
+//
+
+#include "MeshExtractor.hpp"
+#include "MappedFile.hpp"
+#include "ParallelFor.hpp"
+#include <climits>
+
+namespace {
+
+// corner c of a cell is at (c & 1, (c >> 1) & 1, (c >> 2) & 1), edge axis * 4 + k runs from a
+// corner with that axis bit clear to the one with it set
+struct CaseTable {
+
+    int8_t tris[256][3 * 8]; // edge triples
+    uint8_t numTris[256];
+    uint8_t edgeCorner[12];
+    uint8_t edgeAxis[12];
+    int8_t edgeOf[8][3]; // corner + axis -> edge, -1 if corner's bit is set
+
+    CaseTable(){
+
+        memset(edgeOf, -1, sizeof(edgeOf));
+        for (int a=0; a<3; a++){
+            int k = 0;
+            for (int c=0; c<8; c++){
+                if (c & (1 << a)) continue;
+                edgeCorner[a*4 + k] = c;
+                edgeAxis[a*4 + k] = a;
+                edgeOf[c][a] = a*4 + k;
+                k++;
+            }
+        }
+
+        // faces as corner loops, counter clockwise seen from outside the cell
+        int faces[6][4];
+        for (int a=0; a<3; a++){
+            int u = 1 << ((a + 1) % 3);
+            int v = 1 << ((a + 2) % 3);
+            for (int s=0; s<2; s++){
+                int base = s << a;
+                int* f = faces[a*2 + s];
+                f[0] = base;
+                f[1] = base | u;
+                f[2] = base | u | v;
+                f[3] = base | v;
+                if (s == 0) swap(f[1], f[3]); // seen from the other side
+            }
+        }
+
+        for (int c=0; c<256; c++){
+
+            // per face, each edge the surface enters the face through is joined to the edge it
+            // leaves through next (going round the face) - every crossed edge enters exactly one
+            // of its two faces, so following these links walks closed loops
+            int next[12];
+            memset(next, -1, sizeof(next));
+            for (int f=0; f<6; f++){
+                int crossed[4];
+                bool entry[4];
+                int num = 0;
+                for (int i=0; i<4; i++){
+                    int p = faces[f][i];
+                    int q = faces[f][(i+1) % 4];
+                    bool pin = (c >> p) & 1;
+                    bool qin = (c >> q) & 1;
+                    if (pin == qin) continue;
+                    int axis = 0;
+                    while (((p ^ q) >> axis) != 1) axis++;
+                    crossed[num] = edgeOf[min(p, q)][axis];
+                    entry[num] = qin;
+                    num++;
+                }
+                for (int i=0; i<num; i++){
+                    if (entry[i]) next[crossed[i]] = crossed[(i+1) % num]; // next crossing round is its exit
+                }
+            }
+
+            // loops -> triangle fans
+            numTris[c] = 0;
+            bool used[12] = { false };
+            for (int e=0; e<12; e++){
+                if (next[e] < 0 || used[e]) continue;
+                int loop[12];
+                int len = 0;
+                for (int cur=e; !used[cur]; cur=next[cur]){
+                    used[cur] = true;
+                    loop[len++] = cur;
+                }
+                for (int i=1; i+1<len; i++){
+                    int8_t* t = tris[c] + numTris[c] * 3;
+                    t[0] = loop[0];
+                    t[1] = loop[i]; // counter clockwise seen from outside the solid
+                    t[2] = loop[i+1];
+                    numTris[c]++;
+                }
+            }
+        }
+    }
+};
+
+const CaseTable& caseTable(){
+
+    static CaseTable table; // built on first use, thread safe
+    return table;
+}
+
+// sample grid is the volume plus a ring of zeros, m = n + 2 per side, worked on one z plane at a
+// time: padded values + one bit per point (inside), so empty / solid space is skipped 64 points
+// at a time and only crossed edges + mixed cells are ever visited
+struct Plane {
+    vector<uint8_t> values; // m x m
+    vector<uint64_t> bits; // words per row, last one always zero
+};
+
+struct Samples {
+
+    const uint8_t* data;
+    int n, m;
+    int words; // per bit row
+    int iso;
+
+    void fill(int k, Plane& plane) const {
+        plane.values.assign((size_t)m * m, 0);
+        plane.bits.assign((size_t)m * words, 0);
+        if (k < 1 || k > n) return;
+        for (int j=1; j<=n; j++){
+            uint8_t* row = &plane.values[(size_t)j * m];
+            memcpy(row + 1, data + ((size_t)(k-1) * n + (j-1)) * n, n);
+            uint64_t* bits = &plane.bits[(size_t)j * words];
+            for (int i=1; i<=n; i++){
+                if (row[i] >= iso) bits[i >> 6] |= 1ULL << (i & 63);
+            }
+        }
+    }
+    inline int cellCase(const Plane& lo, const Plane& hi, int i, int j) const { // planes k, k+1
+        size_t p = (size_t)j * m + i;
+        const uint8_t* a = &lo.values[0];
+        const uint8_t* b = &hi.values[0];
+        return (a[p] >= iso) | (a[p+1] >= iso) << 1 | (a[p+m] >= iso) << 2 | (a[p+m+1] >= iso) << 3
+            | (b[p] >= iso) << 4 | (b[p+1] >= iso) << 5 | (b[p+m] >= iso) << 6 | (b[p+m+1] >= iso) << 7;
+    }
+};
+
+inline uint64_t shr1(const uint64_t* row, int w){ return (row[w] >> 1) | (row[w+1] << 63); } // bit i: point i + 1
+
+struct Writer {
+
+    MeshFormat format;
+    unsigned char* vertices; // start of vertex records
+    unsigned char* faces;
+    size_t vertexBytes, faceBytes;
+    ofVec3f origin;
+    float voxelSize;
+
+    void vertex(size_t index, float x, float y, float z) const {
+        unsigned char* dst = vertices + index * vertexBytes;
+        if (format == MESH_PLY) {
+            float v[3] = { x, y, z };
+            memcpy(dst, v, 12);
+        } else {
+            char line[64];
+            snprintf(line, sizeof(line), "v %12.4f %12.4f %12.4f\n", x, y, z);
+            memcpy(dst, line, vertexBytes);
+        }
+    }
+    void face(size_t index, int a, int b, int c) const {
+        unsigned char* dst = faces + index * faceBytes;
+        if (format == MESH_PLY) {
+            int32_t v[3] = { a, b, c };
+            dst[0] = 3;
+            memcpy(dst + 1, v, 12);
+        } else {
+            char line[64];
+            snprintf(line, sizeof(line), "f %10d %10d %10d\n", a + 1, b + 1, c + 1); // 1 based
+            memcpy(dst, line, faceBytes);
+        }
+    }
+};
+
+// surface crossings on the edges plane k owns (+x, +y, +z from each of its points), numbered row by
+// row, x then y then z edges - map: 3 per point (only crossed edges set), vertices written if writer given
+int planeEdges(const Samples& s, const Plane& lo, const Plane& hi, int k, vector<int>* map, const Writer* writer, size_t base){
+
+    const int m = s.m;
+    const int words = s.words;
+    int count = 0;
+    for (int j=0; j<m; j++){
+        const uint64_t* row = &lo.bits[(size_t)j * words];
+        const uint64_t* down = (j + 1 < m) ? row + words : row; // last row is all outside anyway
+        const uint64_t* up = &hi.bits[(size_t)j * words];
+        for (int axis=0; axis<3; axis++){
+            for (int w=0; w<words-1; w++){
+                uint64_t crossed = row[w] ^ (axis == 0 ? shr1(row, w) : (axis == 1 ? down[w] : up[w]));
+                while (crossed){
+                    int i = w * 64 + __builtin_ctzll(crossed);
+                    crossed &= crossed - 1;
+                    size_t p = (size_t)j * m + i;
+                    if (map) (*map)[p * 3 + axis] = count;
+                    if (writer) {
+                        int a = lo.values[p];
+                        int b = axis == 0 ? lo.values[p+1] : (axis == 1 ? lo.values[p+m] : hi.values[p]);
+                        float t = (float)(s.iso - a) / (b - a);
+                        writer->vertex(base + count,
+                            writer->origin.x + (i - 1 + (axis == 0) * t) * writer->voxelSize,
+                            writer->origin.y + (j - 1 + (axis == 1) * t) * writer->voxelSize,
+                            writer->origin.z + (k - 1 + (axis == 2) * t) * writer->voxelSize);
+                    }
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// fn(i, j, case) for every cell between planes k, k+1 with corners on both sides, row by row
+template<class F> void mixedCells(const Samples& s, const Plane& lo, const Plane& hi, F fn){
+
+    const int words = s.words;
+    for (int j=0; j<s.m-1; j++){
+        const uint64_t* r[4] = { &lo.bits[(size_t)j * words], &lo.bits[(size_t)(j+1) * words], &hi.bits[(size_t)j * words], &hi.bits[(size_t)(j+1) * words] };
+        for (int w=0; w<words-1; w++){
+            uint64_t any = 0, all = ~0ULL;
+            for (int q=0; q<4; q++){
+                uint64_t pair = r[q][w];
+                uint64_t next = shr1(r[q], w);
+                any |= pair | next;
+                all &= pair & next;
+            }
+            uint64_t mixed = any & ~all;
+            while (mixed){
+                int i = w * 64 + __builtin_ctzll(mixed);
+                mixed &= mixed - 1;
+                fn(i, j, s.cellCase(lo, hi, i, j));
+            }
+        }
+    }
+}
+
+}
+
+bool extractMesh(const uint8_t* volume, int n, float voxelSize, const ofVec3f& origin, int iso, const string& path, MeshFormat format, MeshStats* stats){
+
+    uint64_t start = ofGetElapsedTimeMicros();
+    if (volume == NULL || n < 1) return false;
+
+    Samples s;
+    s.data = volume;
+    s.n = n;
+    s.m = n + 2;
+    s.words = (s.m + 63) / 64 + 1;
+    s.iso = max(1, iso); // outside is 0, must count as outside
+    const int m = s.m;
+    const CaseTable& table = caseTable();
+
+    // pass 1: counts per plane -> where each plane's vertices + triangles go
+    vector<size_t> vertexBase(m + 1, 0), faceBase(m + 1, 0);
+    parallelFor(m, [&](int begin, int end, int worker){
+        Plane lo, hi;
+        s.fill(begin, lo);
+        for (int k=begin; k<end; k++){
+            s.fill(k + 1, hi); // zeros past the top
+            vertexBase[k+1] = planeEdges(s, lo, hi, k, NULL, NULL, 0);
+            size_t tris = 0;
+            mixedCells(s, lo, hi, [&](int i, int j, int c){ tris += table.numTris[c]; });
+            faceBase[k+1] = tris;
+            swap(lo, hi);
+        }
+    }, 0, 1);
+    for (int k=0; k<m; k++){
+        vertexBase[k+1] += vertexBase[k];
+        faceBase[k+1] += faceBase[k];
+    }
+    size_t numVertices = vertexBase[m];
+    size_t numFaces = faceBase[m];
+    if (numVertices > INT_MAX) {
+        ofLogError("MeshExtractor") << "too many vertices: " << numVertices;
+        return false;
+    }
+
+    string header;
+    Writer w;
+    w.format = format;
+    w.origin = origin;
+    w.voxelSize = voxelSize;
+    if (format == MESH_PLY) {
+        header = "ply\nformat binary_little_endian 1.0\ncomment scannerControl\n"
+            "element vertex " + ofToString(numVertices) + "\nproperty float x\nproperty float y\nproperty float z\n"
+            "element face " + ofToString(numFaces) + "\nproperty list uchar int vertex_indices\nend_header\n";
+        w.vertexBytes = 12;
+        w.faceBytes = 13;
+    } else {
+        header = "# scannerControl, " + ofToString(numVertices) + " vertices, " + ofToString(numFaces) + " faces\n";
+        w.vertexBytes = 41; // "v " + 3 x 12 wide + spaces + newline
+        w.faceBytes = 35;
+    }
+
+    MappedFile file;
+    size_t size = header.size() + numVertices * w.vertexBytes + numFaces * w.faceBytes;
+    if (!file.create(path, size)) return false;
+    unsigned char* out = file.getWritableData();
+    memcpy(out, header.data(), header.size());
+    w.vertices = out + header.size();
+    w.faces = w.vertices + numVertices * w.vertexBytes;
+
+    // pass 2: each plane writes its vertices + the triangles of the layer above it, needing the
+    // edge numbering of its own plane and the next one up
+    parallelFor(m, [&](int begin, int end, int worker){
+        vector<int> cur((size_t)m * m * 3), next((size_t)m * m * 3);
+        Plane p0, p1, p2; // planes k, k+1, k+2
+        s.fill(begin, p0);
+        s.fill(begin + 1, p1);
+        planeEdges(s, p0, p1, begin, &cur, &w, vertexBase[begin]);
+        for (int k=begin; k<end; k++){
+            if (k + 1 >= m) break;
+            s.fill(k + 2, p2);
+            planeEdges(s, p1, p2, k + 1, &next, (k + 1 < end) ? &w : NULL, vertexBase[k+1]);
+
+            size_t f = faceBase[k];
+            int lowBase = vertexBase[k];
+            int highBase = vertexBase[k+1];
+            mixedCells(s, p0, p1, [&](int i, int j, int c){
+                for (int t=0; t<table.numTris[c]; t++){
+                    int v[3];
+                    for (int q=0; q<3; q++){
+                        int e = table.tris[c][t*3 + q];
+                        int corner = table.edgeCorner[e];
+                        size_t p = (size_t)(j + ((corner >> 1) & 1)) * m + i + (corner & 1);
+                        bool upper = (corner >> 2) & 1;
+                        v[q] = (upper ? highBase + next[p * 3 + table.edgeAxis[e]] : lowBase + cur[p * 3 + table.edgeAxis[e]]);
+                    }
+                    w.face(f++, v[0], v[1], v[2]);
+                }
+            });
+            swap(cur, next);
+            swap(p0, p1);
+            swap(p1, p2);
+        }
+    }, 0, 2);
+
+    file.close();
+
+    MeshStats st;
+    st.numVertices = numVertices;
+    st.numFaces = numFaces;
+    st.ms = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+    if (stats) *stats = st;
+    ofLogVerbose("MeshExtractor") << ofFilePath::getFileName(path) << ": " << numVertices << " vertices, " << numFaces << " triangles in " << st.ms << "ms";
+    return true;
+}
+
+bool extractMesh(const VisualHull::Grid& grid, const string& path, MeshFormat format, MeshStats* stats){
+
+    int n = grid.n;
+    if (n < 1 || grid.occupied.size() != (size_t)n * n * n) return false;
+
+    // 0 / 255, then [1 2 1] / 4 along each axis: surface of a voxel block becomes a smooth iso
+    // surface at 128 instead of stairs, still on the voxel boundaries
+    size_t total = (size_t)n * n * n;
+    vector<uint8_t> a(total), b(total);
+    for (size_t i=0; i<total; i++) a[i] = grid.occupied[i] ? 255 : 0;
+
+    size_t strides[3] = { 1, (size_t)n, (size_t)n * n };
+    for (int axis=0; axis<3; axis++){
+        size_t stride = strides[axis];
+        parallelFor(n, [&](int begin, int end, int worker){ // z planes, reads neighbouring planes only
+            for (int z=begin; z<end; z++){
+                for (int y=0; y<n; y++){
+                    for (int x=0; x<n; x++){
+                        int coord = axis == 0 ? x : (axis == 1 ? y : z);
+                        size_t i = ((size_t)z * n + y) * n + x;
+                        int lo = coord > 0 ? a[i - stride] : 0;
+                        int hi = coord < n-1 ? a[i + stride] : 0;
+                        b[i] = (lo + 2 * a[i] + hi + 2) >> 2;
+                    }
+                }
+            }
+        }, 0, 4);
+        swap(a, b);
+    }
+
+    ofVec3f first = grid.origin + ofVec3f(0.5f, 0.5f, 0.5f) * grid.voxelSize; // voxel centres
+    return extractMesh(&a[0], n, grid.voxelSize, first, 128, path, format, stats);
+}
@@ -0,0 +1,34 @@
+//
+//  MeshExtractor.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "VisualHull.hpp"
+
+// triangle mesh of a volume's surface (marching cubes), written straight into the output file:
+// one pass over the z planes on all cores counts each plane's vertices + triangles, the file is
+// then sized from the totals and mapped, and a second pass has every plane write its own slice.
+// No mesh is held in memory - only the volume + two planes of edge indices per thread
+//
+// vertices sit on grid edges, each edge owned by one plane, so cells share them and the mesh is
+// indexed + watertight. Case table is built once from the cube's faces (ambiguous faces keep
+// inside corners apart, the same way from both sides)
+
+enum MeshFormat {
+    MESH_PLY, // binary little endian, float xyz + int triangles
+    MESH_OBJ // text, fixed width lines so it can be written the same way
+};
+
+struct MeshStats {
+    int numVertices = 0;
+    int numFaces = 0;
+    float ms = 0;
+};
+
+// n^3 values, x fastest, >= iso is inside - outside the volume counts as 0, so surfaces close.
+// origin: position of the first value, voxelSize apart (mm)
+bool extractMesh(const uint8_t* volume, int n, float voxelSize, const ofVec3f& origin, int iso, const string& path, MeshFormat format, MeshStats* stats = NULL);
+bool extractMesh(const VisualHull::Grid& grid, const string& path, MeshFormat format, MeshStats* stats = NULL); // occupancy smoothed first, surface isn't voxel stairs
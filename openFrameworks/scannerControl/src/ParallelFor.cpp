@@ -0,0 +1,91 @@
+//
+//  ParallelFor.cpp
+//  scannerControl
+//
+//
+
+#include "ParallelFor.hpp"
+#include <thread>
+#include <atomic>
+
+namespace {
+
+struct Range {
+    std::mutex mutex; // guards changes, sizes are read without it when picking a victim
+    std::atomic<int> begin { 0 };
+    std::atomic<int> end { 0 };
+};
+
+// next chunk from own range, else steal half of the fullest one - false when nothing is left anywhere
+bool nextChunk(vector<Range>& ranges, int worker, int grain, int* begin, int* end){
+
+    while (true){
+        {
+            Range& own = ranges[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.begin < own.end){
+                *begin = own.begin;
+                *end = min(own.begin + grain, (int)own.end);
+                own.begin = *end;
+                return true;
+            }
+        }
+
+        int victim = -1;
+        int most = 0;
+        for (int i=0; i<ranges.size(); i++){
+            int left = ranges[i].end - ranges[i].begin;
+            if (i != worker && left > most) { most = left; victim = i; }
+        }
+        if (victim < 0) return false;
+
+        int stolenBegin, stolenEnd;
+        {
+            Range& v = ranges[victim];
+            std::lock_guard<std::mutex> lock(v.mutex);
+            int left = v.end - v.begin;
+            if (left <= 0) continue; // emptied meanwhile, look again
+            stolenEnd = v.end;
+            stolenBegin = v.end - (left + 1) / 2; // back half, victim keeps working from its front
+            v.end = stolenBegin;
+        }
+        Range& own = ranges[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.begin = stolenBegin;
+        own.end = stolenEnd;
+    }
+}
+
+}
+
+int parallelThreads(int numThreads){
+
+    if (numThreads > 0) return numThreads;
+    return max(1, (int)std::thread::hardware_concurrency());
+}
+
+void parallelFor(int n, std::function<void(int begin, int end, int worker)> fn, int numThreads, int grain){
+
+    if (n <= 0) return;
+    grain = max(1, grain);
+    numThreads = min(parallelThreads(numThreads), (n + grain - 1) / grain);
+    if (numThreads <= 1) {
+        for (int i=0; i<n; i+=grain) fn(i, min(i + grain, n), 0);
+        return;
+    }
+
+    vector<Range> ranges(numThreads);
+    for (int i=0; i<numThreads; i++){
+        ranges[i].begin = (int)((int64_t)n * i / numThreads);
+        ranges[i].end = (int)((int64_t)n * (i+1) / numThreads);
+    }
+
+    auto work = [&](int worker){
+        int begin, end;
+        while (nextChunk(ranges, worker, grain, &begin, &end)) fn(begin, end, worker);
+    };
+    vector<std::thread> threads;
+    for (int i=1; i<numThreads; i++) threads.push_back(std::thread(work, i));
+    work(0);
+    for (int i=0; i<threads.size(); i++) threads[i].join();
+}
@@ -0,0 +1,18 @@
+//
+//  ParallelFor.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <functional>
+
+// runs fn(begin, end, worker) over [0, n) in chunks of at most grain, on numThreads threads
+// (calling thread is worker 0) and returns once all are done. The range is split evenly up front,
+// a thread that runs out steals the back half of whichever thread has the most left - uneven
+// chunks (e.g. octree cells that split a lot) still finish together. worker < numThreads, for
+// per thread output without locks
+
+int parallelThreads(int numThreads = 0); // 0: # cores (min 1)
+void parallelFor(int n, std::function<void(int begin, int end, int worker)> fn, int numThreads = 0, int grain = 64);
@@ -0,0 +1,196 @@
+//
+//  RawPreview.cpp
+//  scannerControl
+//
+//
+
+#include "RawPreview.hpp"
+#include "ByteReader.hpp"
+#include "FileReader.hpp"
+#include <functional>
+
+// containers are parsed through whatever reads their bytes: a file in memory, or pread - headers
+// + the preview only, never the sensor data. false if the range isn't in the file
+typedef std::function<bool(uint64_t offset, size_t n, vector<unsigned char>& out)> Fetch;
+
+struct Range {
+    uint64_t offset;
+    uint64_t length;
+};
+
+static const size_t headBytes = 64 * 1024; // first read of a CR2, grown only if its IFDs lie past it
+static const size_t maxHeaderBytes = 8 * 1024 * 1024; // IFDs / moov past this: corrupt, give up
+
+// starts with SOI
+static bool isJpeg(const unsigned char* data, size_t length){
+
+    return length > 4 && data[0] == 0xFF && data[1] == 0xD8;
+}
+
+
+// CR2 / TIFF
+
+
+// value of a SHORT / LONG tag in an IFD, 0 if not there
+static uint32_t tiffTag(const ByteReader& r, uint32_t ifd, uint16_t tag){
+
+    uint16_t numEntries = r.u16(ifd);
+    for (int i=0; i<numEntries; i++){
+        size_t entry = ifd + 2 + i * 12;
+        if (!r.has(entry, 12)) return 0;
+        if (r.u16(entry) != tag) continue;
+        uint16_t type = r.u16(entry + 2);
+        if (type == 3) return r.u16(entry + 8); // SHORT, first value in the field
+        if (type == 4) return r.u32(entry + 8); // LONG
+        return 0;
+    }
+    return 0;
+}
+
+// head holds at least the first end bytes of the file, read again (doubled) if not
+static bool cover(const Fetch& fetch, uint64_t fileSize, uint64_t end, vector<unsigned char>& head){
+
+    if (end <= head.size()) return true;
+    if (end > fileSize || end > maxHeaderBytes) return false;
+    return fetch(0, min(fileSize, max(end, (uint64_t)head.size() * 2)), head);
+}
+
+static void findTiffPreviews(const Fetch& fetch, uint64_t fileSize, vector<Range>& ranges){
+
+    vector<unsigned char> head;
+    if (!fetch(0, min((uint64_t)headBytes, fileSize), head)) return;
+    bool bigEndian = head[0] == 'M';
+
+    // IFD0: old style JPEG (compression 6) in a single strip - the full size preview
+    // IFD1: JPEGInterchangeFormat thumbnail, as a fallback
+    static const uint16_t offsetTags[2] = { 0x0111, 0x0201 };
+    static const uint16_t lengthTags[2] = { 0x0117, 0x0202 };
+    uint32_t ifd = ByteReader{ head.data(), head.size(), bigEndian }.u32(4);
+    for (int i=0; i<2 && ifd != 0; i++){
+        if (!cover(fetch, fileSize, (uint64_t)ifd + 2, head)) return;
+        uint64_t ifdEnd = ifd + 2 + ByteReader{ head.data(), head.size(), bigEndian }.u16(ifd) * 12 + 4; // entries + next IFD's offset
+        if (!cover(fetch, fileSize, ifdEnd, head)) return;
+        ByteReader r = { head.data(), head.size(), bigEndian };
+        ranges.push_back(Range{ tiffTag(r, ifd, offsetTags[i]), tiffTag(r, ifd, lengthTags[i]) });
+        ifd = r.u32(ifdEnd - 4);
+    }
+}
+
+
+// CR3 / ISOBMFF
+
+
+// box path from a parent, e.g. {"mdia","minf","stbl"}
+static bool findBoxPath(const ByteReader& r, uint64_t start, uint64_t end, const vector<string>& path, uint64_t* payload, uint64_t* payloadEnd){
+
+    for (int i=0; i<path.size(); i++){
+        if (!r.findBox(start, end, path[i].c_str(), &start, &end)) return false;
+    }
+    *payload = start;
+    *payloadEnd = end;
+    return true;
+}
+
+static void findIsoPreviews(const Fetch& fetch, uint64_t fileSize, vector<Range>& ranges){
+
+    // preview uuid box: 8 bytes, then PRVW box (size, type, 4 + 2 unknown, width, height, 2 unknown, JPEG size, JPEG)
+    static const unsigned char prvwUuid[16] = { 0xea, 0xf4, 0x2b, 0x5e, 0x1c, 0x98, 0x4b, 0x88, 0xb9, 0xfb, 0xb7, 0xdc, 0x40, 0x6e, 0x4d, 0x16 };
+    static const int prvwHeader = 16 + 8 + 24;
+
+    // top level boxes by their headers only: moov read whole, the preview uuid's header, mdat skipped
+    Range track = { 0, 0 }, prvw = { 0, 0 };
+    vector<unsigned char> buf;
+    uint64_t pos = 0;
+    while (pos + 8 <= fileSize && (track.length == 0 || prvw.length == 0)){
+        if (!fetch(pos, min((uint64_t)16, fileSize - pos), buf)) return;
+        ByteReader h = { buf.data(), buf.size(), true };
+        uint64_t boxSize = h.u32(0);
+        uint64_t header = 8;
+        if (boxSize == 1) { // 64 bit size follows the type
+            boxSize = h.u64(8);
+            header = 16;
+        }
+        else if (boxSize == 0) boxSize = fileSize - pos; // extends to end
+        if (boxSize < header || boxSize > fileSize - pos) return;
+        uint64_t payload = pos + header, payloadSize = boxSize - header;
+
+        if (memcmp(buf.data() + 4, "moov", 4) == 0) {
+            // first track is the full size JPEG: one sample, size from stsz, offset (in the file) from stco / co64
+            uint64_t p, pEnd;
+            if (payloadSize > maxHeaderBytes || !fetch(payload, payloadSize, buf)) return;
+            ByteReader r = { buf.data(), buf.size(), true };
+            if (findBoxPath(r, 0, r.size, {"trak", "mdia", "minf", "stbl"}, &p, &pEnd)) {
+                uint64_t stbl = p, stblEnd = pEnd;
+                if (r.findBox(stbl, stblEnd, "stsz", &p, &pEnd) && r.has(p, 12)) {
+                    track.length = r.u32(p + 4); // fixed size, else first entry
+                    if (track.length == 0 && r.u32(p + 8) > 0) track.length = r.u32(p + 12);
+                }
+                if (r.findBox(stbl, stblEnd, "co64", &p, &pEnd) && r.u32(p + 4) > 0) track.offset = r.u64(p + 8);
+                else if (r.findBox(stbl, stblEnd, "stco", &p, &pEnd) && r.u32(p + 4) > 0) track.offset = r.u32(p + 8);
+            }
+        }
+        else if (memcmp(buf.data() + 4, "uuid", 4) == 0 && payloadSize >= prvwHeader && fetch(payload, prvwHeader, buf)
+                 && memcmp(buf.data(), prvwUuid, 16) == 0 && memcmp(buf.data() + 16 + 8 + 4, "PRVW", 4) == 0) {
+            prvw.offset = payload + prvwHeader;
+            prvw.length = ByteReader{ buf.data(), buf.size(), true }.u32(16 + 8 + 20);
+        }
+        pos += boxSize;
+    }
+    ranges.push_back(track);
+    ranges.push_back(prvw);
+}
+
+// where the JPEG may be, best first - each still has to start like one
+static void findPreviews(const Fetch& fetch, uint64_t fileSize, vector<Range>& ranges){
+
+    vector<unsigned char> magic;
+    if (fileSize < 16 || !fetch(0, 8, magic)) return;
+
+    // TIFF based (CR2): byte order mark + 42
+    if ((magic[0] == 'I' && magic[1] == 'I') || (magic[0] == 'M' && magic[1] == 'M')) {
+        if (ByteReader{ magic.data(), magic.size(), magic[0] == 'M' }.u16(2) == 42) findTiffPreviews(fetch, fileSize, ranges);
+    }
+    // ISOBMFF (CR3): starts with an ftyp box, all big endian
+    else if (memcmp(magic.data() + 4, "ftyp", 4) == 0) findIsoPreviews(fetch, fileSize, ranges);
+}
+
+
+bool isRawFile(const string& path){
+
+    string ext = ofToLower(ofFilePath::getFileExt(path));
+    return ext == "cr2" || ext == "cr3";
+}
+
+bool findRawPreview(const unsigned char* data, size_t size, size_t* offset, size_t* length){
+
+    if (data == NULL) return false;
+    Fetch fetch = [&](uint64_t o, size_t n, vector<unsigned char>& out){
+        if (o > size || n > size - o) return false;
+        out.assign(data + o, data + o + n);
+        return true;
+    };
+    vector<Range> ranges;
+    findPreviews(fetch, size, ranges);
+    for (int i=0; i<ranges.size(); i++){
+        const Range& r = ranges[i];
+        if (r.offset > size || r.length > size - r.offset || !isJpeg(data + r.offset, r.length)) continue;
+        *offset = r.offset;
+        *length = r.length;
+        return true;
+    }
+    return false;
+}
+
+bool readRawPreview(const string& path, vector<unsigned char>& jpeg){
+
+    FileReader file(path);
+    if (!file.isOpen()) return false;
+    Fetch fetch = [&](uint64_t o, size_t n, vector<unsigned char>& out){ return file.read(o, n, out); };
+    vector<Range> ranges;
+    findPreviews(fetch, file.size(), ranges);
+    for (int i=0; i<ranges.size(); i++){
+        if (ranges[i].length > 4 && file.read(ranges[i].offset, ranges[i].length, jpeg) && isJpeg(jpeg.data(), jpeg.size())) return true;
+    }
+    jpeg.clear();
+    return false;
+}
@@ -0,0 +1,17 @@
+//
+//  RawPreview.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// finds the full size JPEG preview Canon embeds in its RAW files, by walking the container only -
+// no demosaic, the preview decodes exactly like a camera JPEG (incl. DCT scaled proxies)
+//   CR2: TIFF, preview is IFD0's strip (IFD1's small thumbnail as a fallback)
+//   CR3: ISOBMFF, preview is the first track's sample (the PRVW box's 1620px preview as a fallback)
+
+bool isRawFile(const string& path); // by extension: cr2, cr3
+bool findRawPreview(const unsigned char* data, size_t size, size_t* offset, size_t* length); // byte range of the JPEG in a file in memory
+bool readRawPreview(const string& path, vector<unsigned char>& jpeg); // just the JPEG, pread from the file: container headers + the preview, the sensor data is never read
@@ -0,0 +1,57 @@
+//
+//  ReshootQueue.cpp
+//  scannerControl
+//
+//
+
+#include "ReshootQueue.hpp"
+
+void ReshootQueue::add(const Scanner::ShutterEvent& missedShot){
+
+    if (missedShot.shotIndex < 0) return; // single shot, nothing to go back to
+    if (++attempts[missedShot.shotIndex] > maxAttempts) {
+        ofLogError("ReshootQueue") << "shot " << missedShot.shotIndex << " at " << missedShot.degree << " deg still missing after " << maxAttempts << " reshoots, giving up";
+        return;
+    }
+    queue.push_back(missedShot);
+}
+
+void ReshootQueue::update(Scanner& scanner, int numPendingShots){
+
+    if (isActive()) {
+        // done once its photo is taken, or the scanner never answered
+        if (bShotFired && !scanner.isShooting()) current.shotIndex = -1;
+        else if (!bShotFired && ofGetElapsedTimef() - startTime > giveUpAfter) {
+            ofLogWarning("ReshootQueue") << "no shutter for reshoot of shot " << current.shotIndex << ", requeued";
+            queue.push_back(current);
+            current.shotIndex = -1;
+        }
+        return;
+    }
+
+    // wait out the rotation: autoscan done, table back, every shot landed or timed out
+    if (queue.empty() || !scanner.isConnected() || scanner.isAutoscanning() || scanner.isMoving() || scanner.isShooting() || numPendingShots > 0) return;
+
+    current = queue.front();
+    queue.pop_front();
+    bShotFired = false;
+    startTime = ofGetElapsedTimef();
+    scanner.moveToStep(current.step); // blocking move on the scanner, shot runs after it
+    scanner.takePhoto();
+    ofLogNotice("ReshootQueue") << "reshooting shot " << current.shotIndex << " at " << current.degree << " deg (" << queue.size() << " more)";
+}
+
+void ReshootQueue::onShutter(Scanner::ShutterEvent& shot){
+
+    if (!isActive() || bShotFired) return;
+    shot.shotIndex = current.shotIndex;
+    shot.reshoot = true;
+    bShotFired = true;
+}
+
+void ReshootQueue::clear(){
+
+    queue.clear();
+    attempts.clear();
+    current.shotIndex = -1;
+}
@@ -0,0 +1,38 @@
+//
+//  ReshootQueue.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "Scanner.hpp"
+
+// autoscan shots that never produced a file, retaken once the rotation is done:
+// the table is moved straight to each missed step ('S') and shot there ('P'), one at a time
+// so a missed frame costs a move + a shot instead of a whole rotation
+
+class ReshootQueue {
+
+public:
+
+    void add(const Scanner::ShutterEvent& missedShot); // ignores single shots, gives up on a shot after maxAttempts
+    void update(Scanner& scanner, int numPendingShots); // once per frame, numPendingShots: shots still waiting on their file
+    void onShutter(Scanner::ShutterEvent& shot); // tags the shutter event of a reshoot with the shot it retakes
+    void clear();
+
+    bool isActive() { return current.shotIndex >= 0; }
+    int size() { return queue.size() + (isActive() ? 1 : 0); }
+    void setMaxAttempts(int n) { maxAttempts = n; }
+
+
+private:
+
+    deque<Scanner::ShutterEvent> queue;
+    Scanner::ShutterEvent current; // shotIndex -1 when idle
+    map<int, int> attempts; // per shot index
+    bool bShotFired = false; // current reshoot's shutter event seen
+    float startTime = 0; // current reshoot sent
+    float giveUpAfter = 30.0; // s, no shutter event (command lost, link dropped)
+    int maxAttempts = 2;
+};
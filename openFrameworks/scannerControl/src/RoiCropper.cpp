@@ -0,0 +1,312 @@
+//
+//  RoiCropper.cpp
+//  scannerControl
+//
+//
+
+#include "RoiCropper.hpp"
+#include "Masker.hpp"
+#include "ImageDecode.hpp"
+#include "RawPreview.hpp"
+#include "MappedFile.hpp"
+#include "ByteReader.hpp"
+#include "ParallelFor.hpp"
+#include "FreeImage.h"
+#include <sys/stat.h>
+
+const char* RoiCropper::dirName = "roi";
+const char* RoiCropper::listName = "crops.txt";
+
+static const int gridSize = 256; // region found on this grid over the frame
+static const int motionDecodeSize = 256; // DCT scaled, a fraction of a full decode
+static const int blockSize = 16; // JPEG MCU at 4:2:0 (4:4:4 is 8, so 16 suits both)
+static const int edgeSamples = 32; // per side of the region, through the lens model
+
+// frame size from the SOF marker, no decode
+static bool jpegSize(const unsigned char* data, size_t size, int* width, int* height){
+
+    ByteReader r = { data, size, true };
+    if (r.u16(0) != 0xFFD8) return false;
+    size_t pos = 2;
+    while (r.has(pos, 4)){
+        if (data[pos] != 0xFF) return false;
+        uint8_t marker = data[pos+1];
+        if (marker == 0xFF) { // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) return false; // end / scan data before any frame
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            *height = r.u16(pos + 5);
+            *width = r.u16(pos + 7);
+            return *width > 0 && *height > 0;
+        }
+        pos += 2 + r.u16(pos + 2);
+    }
+    return false;
+}
+
+static uint64_t fileSize(const string& path){
+
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+bool RoiCropper::start(const vector<string>& imagePaths, const string& watchPath, const TurntableGeometry& geometry){
+
+    if (bBusy) return false;
+    if (runThread.joinable()) runThread.join();
+    lens = geometry;
+    initImageDecode(); // FreeImage_JPEGCrop may run before anything was decoded
+    bBusy = true;
+    bFinished = false;
+    runThread = std::thread(&RoiCropper::run, this, imagePaths, ofFilePath::join(watchPath, dirName));
+    return true;
+}
+
+bool RoiCropper::update(){
+
+    if (!bFinished) return false;
+    bFinished = false;
+    return true;
+}
+
+
+// PRIVATE
+
+
+void RoiCropper::run(vector<string> paths, string outDir){
+
+    uint64_t start = ofGetElapsedTimeMicros();
+    Stats s;
+    s.numImages = paths.size();
+
+    ofRectangle roi;
+    if (!ofDirectory::doesDirectoryExist(outDir, false) && !ofDirectory::createDirectory(outDir, false, true)) {
+        ofLogError("RoiCropper") << "can't create " << outDir;
+        s.numFailed = paths.size();
+    }
+    else if (!findRoi(paths, roi, s.source)) {
+        ofLogError("RoiCropper") << "no object found, nothing cropped";
+        s.numFailed = paths.size();
+    }
+    else {
+        s.roi = roi;
+        bool undistorted = s.source == ROI_MASKS && lens.hasDistortion();
+        vector<Crop> crops(paths.size());
+        vector<uint8_t> ok(paths.size(), 0);
+        parallelFor(paths.size(), [&](int begin, int end, int worker){
+            for (int i=begin; i<end; i++) ok[i] = crop(paths[i], outDir, roi, undistorted, crops[i]);
+        }, 0, 1);
+
+        vector<Crop> written;
+        for (int i=0; i<paths.size(); i++){
+            if (!ok[i]) {
+                ofLogWarning("RoiCropper") << "can't crop " << paths[i];
+                s.numFailed++;
+                continue;
+            }
+            if (crops[i].lossless) s.numLossless++;
+            else s.numRecompressed++;
+            s.bytesIn += crops[i].bytesIn;
+            s.bytesOut += crops[i].bytesOut;
+            written.push_back(crops[i]);
+        }
+        if (!saveList(ofFilePath::join(outDir, listName), written)) ofLogError("RoiCropper") << "can't write " << listName;
+    }
+
+    s.ms = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats = s;
+    }
+    bFinished = true;
+    bBusy = false;
+}
+
+bool RoiCropper::findRoi(const vector<string>& paths, ofRectangle& roi, Source& source){
+
+    // masks if most shots have one, the rest would only add the same object again
+    vector<string> masks;
+    for (int i=0; i<paths.size(); i++){
+        string maskPath = Masker::getMaskPath(paths[i]);
+        if (fileSize(maskPath) > 0) masks.push_back(maskPath);
+    }
+    source = (!masks.empty() && masks.size() * 2 >= paths.size()) ? ROI_MASKS : ROI_MOTION;
+    const vector<string>& inputs = source == ROI_MASKS ? masks : paths;
+    if (source == ROI_MOTION && paths.size() < 2) return false;
+
+    // per thread grids, merged after: masks OR'd, images min / max brightness
+    int n = gridSize * gridSize;
+    int numThreads = parallelThreads();
+    vector<vector<uint8_t> > lo(numThreads, vector<uint8_t>(n, 255));
+    vector<vector<uint8_t> > hi(numThreads, vector<uint8_t>(n, 0));
+    parallelFor(inputs.size(), [&](int begin, int end, int worker){
+        for (int i=begin; i<end; i++){
+            ofPixels px;
+            if (!decodeImage(inputs[i], px, source == ROI_MASKS ? 0 : motionDecodeSize)) continue;
+            int w = px.getWidth(), h = px.getHeight(), c = px.getNumChannels();
+            const unsigned char* d = px.getData();
+            for (int gy=0; gy<gridSize; gy++){
+                const unsigned char* row = d + (size_t)((gy * 2 + 1) * h / (gridSize * 2)) * w * c;
+                for (int gx=0; gx<gridSize; gx++){
+                    const unsigned char* p = row + (size_t)((gx * 2 + 1) * w / (gridSize * 2)) * c;
+                    uint8_t v = c >= 3 ? (p[0] + 2 * p[1] + p[2]) >> 2 : p[0];
+                    int g = gy * gridSize + gx;
+                    lo[worker][g] = min(lo[worker][g], v);
+                    hi[worker][g] = max(hi[worker][g], v);
+                }
+            }
+        }
+    }, numThreads, 1);
+
+    // rows / columns with a single cell set are speckle (mask noise, sensor noise), not the object
+    vector<int> rows(gridSize, 0), cols(gridSize, 0);
+    for (int g=0; g<n; g++){
+        uint8_t mn = 255, mx = 0;
+        for (int t=0; t<numThreads; t++){
+            mn = min(mn, lo[t][g]);
+            mx = max(mx, hi[t][g]);
+        }
+        bool hit = source == ROI_MASKS ? mx > 127 : mx > mn && mx - mn > motionThreshold;
+        if (hit) {
+            rows[g / gridSize]++;
+            cols[g % gridSize]++;
+        }
+    }
+    int x0 = 0, x1 = gridSize - 1, y0 = 0, y1 = gridSize - 1;
+    while (x0 < gridSize && cols[x0] < 2) x0++;
+    while (x1 >= 0 && cols[x1] < 2) x1--;
+    while (y0 < gridSize && rows[y0] < 2) y0++;
+    while (y1 >= 0 && rows[y1] < 2) y1--;
+    if (x0 > x1 || y0 > y1) return false;
+
+    roi.set((float)x0 / gridSize, (float)y0 / gridSize, (float)(x1 + 1 - x0) / gridSize, (float)(y1 + 1 - y0) / gridSize);
+    ofLogNotice("RoiCropper") << "region from " << (source == ROI_MASKS ? ofToString(masks.size()) + " masks" : "motion across " + ofToString(paths.size()) + " shots")
+        << ": " << (int)(roi.width * roi.height * 100) << "% of the frame";
+    return true;
+}
+
+bool RoiCropper::crop(const string& path, const string& outDir, const ofRectangle& roi, bool undistorted, Crop& c){
+
+    // JPEG bytes to crop: the file, or the preview inside a RAW file
+    MappedFile file(path, MappedFile::ACCESS_RANDOM);
+    if (!file.isOpen()) return false;
+    const unsigned char* jpeg = file.getData();
+    size_t jpegLength = file.size();
+    bool raw = isRawFile(path);
+    if (raw) {
+        size_t offset;
+        if (!findRawPreview(file.getData(), file.size(), &offset, &jpegLength)) return false;
+        jpeg += offset;
+    }
+    bool isJpeg = jpegSize(jpeg, jpegLength, &c.fullWidth, &c.fullHeight);
+
+    ofPixels pixels; // only if it can't be cropped losslessly
+    if (!isJpeg) {
+        if (!decodeImage(path, pixels, 0)) return false;
+        c.fullWidth = pixels.getWidth();
+        c.fullHeight = pixels.getHeight();
+    }
+
+    // onto the original, padded, then out to whole blocks - lossless crops can only start on one
+    float l = roi.x * c.fullWidth, t = roi.y * c.fullHeight;
+    float r = (roi.x + roi.width) * c.fullWidth, b = (roi.y + roi.height) * c.fullHeight;
+    if (undistorted) toDistorted(l, t, r, b, c.fullWidth, c.fullHeight);
+    float pad = padding * max(c.fullWidth, c.fullHeight);
+    int left = max(0, (int)floor(l - pad));
+    int top = max(0, (int)floor(t - pad));
+    int right = min(c.fullWidth, (int)ceil(r + pad));
+    int bottom = min(c.fullHeight, (int)ceil(b + pad));
+    left -= left % blockSize;
+    top -= top % blockSize;
+    right = min(c.fullWidth, (right + blockSize - 1) / blockSize * blockSize);
+    bottom = min(c.fullHeight, (bottom + blockSize - 1) / blockSize * blockSize);
+    c.left = left;
+    c.top = top;
+    c.width = right - left;
+    c.height = bottom - top;
+    if (c.width <= 0 || c.height <= 0) return false;
+
+    // written under temp names, the copy only appears once complete
+    string base = ofFilePath::getBaseName(path);
+    c.name = base + ".jpg";
+    string outPath = ofFilePath::join(outDir, c.name);
+    string tmpPath = ofFilePath::join(outDir, "." + base + ".tmp.jpg");
+    c.bytesIn = jpegLength;
+
+    if (isJpeg) {
+        string srcPath = path;
+        if (raw) { // FreeImage crops files only: the preview goes out on its own first
+            srcPath = ofFilePath::join(outDir, "." + base + ".preview.jpg");
+            FILE* f = fopen(srcPath.c_str(), "wb");
+            bool written = f != NULL && fwrite(jpeg, jpegLength, 1, f) == 1;
+            if (f != NULL) written = (fclose(f) == 0) && written;
+            if (!written) srcPath = "";
+        }
+        c.lossless = srcPath != "" && FreeImage_JPEGCrop(srcPath.c_str(), tmpPath.c_str(), left, top, right, bottom);
+        if (raw && srcPath != "") remove(srcPath.c_str());
+    }
+    if (!c.lossless) { // not a JPEG, or one FreeImage can't transform (e.g. arithmetic coded)
+        if (!pixels.isAllocated() && !decodeImage(path, pixels, 0)) return false;
+        ofPixels cropped;
+        pixels.cropTo(cropped, left, top, c.width, c.height);
+        if (!ofSaveImage(cropped, tmpPath)) {
+            remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    if (rename(tmpPath.c_str(), outPath.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    c.bytesOut = fileSize(outPath);
+    return true;
+}
+
+void RoiCropper::toDistorted(float& left, float& top, float& right, float& bottom, int width, int height){
+
+    // same model as Undistorter::fillLut: an undistorted pixel to where it landed on the sensor. The
+    // region's outline maps to the outline of what it covers there, so its samples bound it
+    float f = lens.getFocalPx(width);
+    float cx = width * 0.5f, cy = height * 0.5f;
+    float x0 = width, y0 = height, x1 = 0, y1 = 0;
+    for (int i=0; i<edgeSamples * 4; i++){
+        float a = (float)(i % edgeSamples) / edgeSamples;
+        int side = i / edgeSamples;
+        float x = side == 0 ? ofLerp(left, right, a) : side == 1 ? right : side == 2 ? ofLerp(right, left, a) : left;
+        float y = side == 0 ? top : side == 1 ? ofLerp(top, bottom, a) : side == 2 ? bottom : ofLerp(bottom, top, a);
+        float xn = (x - cx) / f, yn = (y - cy) / f;
+        float r2 = xn * xn + yn * yn;
+        float radial = 1 + r2 * (lens.k1 + r2 * (lens.k2 + r2 * lens.k3));
+        float sx = (xn * radial + 2 * lens.p1 * xn * yn + lens.p2 * (r2 + 2 * xn * xn)) * f + cx;
+        float sy = (yn * radial + lens.p1 * (r2 + 2 * yn * yn) + 2 * lens.p2 * xn * yn) * f + cy;
+        if (!(sx == sx && sy == sy)) { // NaN from a wild model: keep the whole frame
+            x0 = y0 = 0;
+            x1 = width;
+            y1 = height;
+            break;
+        }
+        x0 = min(x0, sx);
+        y0 = min(y0, sy);
+        x1 = max(x1, sx);
+        y1 = max(y1, sy);
+    }
+    left = ofClamp(x0, 0.0f, (float)width);
+    top = ofClamp(y0, 0.0f, (float)height);
+    right = ofClamp(x1, 0.0f, (float)width);
+    bottom = ofClamp(y1, 0.0f, (float)height);
+}
+
+bool RoiCropper::saveList(const string& path, const vector<Crop>& crops){
+
+    ofBuffer buf;
+    buf.append("# working copy, offset + size in the original, original size, 1: lossless crop (0: re-encoded) - pixels\n");
+    for (int i=0; i<crops.size(); i++){
+        const Crop& c = crops[i];
+        buf.append(c.name + " " + ofToString(c.left) + " " + ofToString(c.top) + " " + ofToString(c.width) + " " + ofToString(c.height)
+            + " " + ofToString(c.fullWidth) + " " + ofToString(c.fullHeight) + " " + (c.lossless ? "1" : "0") + "\n");
+    }
+    return ofBufferToFile(path, buf);
+}
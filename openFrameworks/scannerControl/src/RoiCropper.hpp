@@ -0,0 +1,84 @@
+//
+//  RoiCropper.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+#include "TurntableGeometry.hpp"
+
+// compact working copies of a rotation for whatever reads the images next (reconstruction): the object
+// rarely fills the frame, so every shot is cut down to one region of interest - the union of the
+// object masks of all shots (Masker), or where pixels change across the rotation if most shots
+// have no mask, padded and grown to whole 16 px JPEG blocks. JPEGs (and the JPEG preview of RAW files)
+// are cropped losslessly, no decode or recompression; anything FreeImage can't crop that way is decoded,
+// cropped + re-encoded. Copies go to roi/ in the watch folder (not watched, not re-ingested) with
+// roi/crops.txt listing each copy's offset in the original, all one region so they stay comparable.
+// Masks are of undistorted images (Undistorter), their region goes back through the lens model
+// onto the originals before cropping
+// Region on a low res grid, then crops on all cores - the whole run on its own thread
+
+class RoiCropper {
+
+public:
+
+    enum Source {
+        ROI_MASKS, // union of the masks
+        ROI_MOTION // per pixel range of brightness across the shots
+    };
+
+    struct Stats {
+        int numImages = 0;
+        int numLossless = 0;
+        int numRecompressed = 0;
+        int numFailed = 0;
+        Source source = ROI_MASKS;
+        ofRectangle roi; // fraction of the frame, before block alignment (masks: undistorted frame)
+        uint64_t bytesIn = 0; // JPEG bytes read (RAW: preview only)
+        uint64_t bytesOut = 0;
+        float ms = 0;
+    };
+
+    ~RoiCropper() { if (runThread.joinable()) runThread.join(); }
+
+    void setPadding(float fraction) { padding = fraction; } // of the frame's long side, each way
+    void setMotionThreshold(int t) { motionThreshold = t; } // brightness range (0-255) that counts as moving
+
+    bool start(const vector<string>& imagePaths, const string& watchPath, const TurntableGeometry& geometry); // false if still busy. geometry: lens model the masks were made under
+    bool isBusy() { return bBusy; }
+    bool update(); // main thread, true once after each run finished
+    Stats getStats() { std::lock_guard<std::mutex> lock(statsMutex); return stats; }
+
+    static const char* dirName; // "roi"
+    static const char* listName; // "crops.txt"
+
+
+private:
+
+    struct Crop {
+        string name; // of the copy
+        int left = 0, top = 0, width = 0, height = 0; // in the original, pixels
+        int fullWidth = 0, fullHeight = 0;
+        bool lossless = false;
+        uint64_t bytesIn = 0, bytesOut = 0;
+    };
+
+    void run(vector<string> paths, string outDir);
+    bool findRoi(const vector<string>& paths, ofRectangle& roi, Source& source); // fraction of the frame, false if nothing found
+    bool crop(const string& path, const string& outDir, const ofRectangle& roi, bool undistorted, Crop& c); // on parallelFor workers
+    void toDistorted(float& left, float& top, float& right, float& bottom, int width, int height); // pixels, undistorted region -> its bounds on the sensor
+    bool saveList(const string& path, const vector<Crop>& crops);
+
+    std::thread runThread;
+    std::atomic<bool> bBusy { false };
+    std::atomic<bool> bFinished { false };
+    std::mutex statsMutex;
+    Stats stats;
+    TurntableGeometry lens; // set by start(), read by the run
+
+    float padding = 0.03;
+    int motionThreshold = 40;
+};
@@ -7,19 +7,90 @@
 //
 
 #include "Scanner.hpp"
+#include <chrono>
 
 Scanner::Scanner(ofSerial* serialPtr){
     
+    serial = serialPtr;
     commander = Commander(serialPtr); // create serial commander
 }
 
 bool Scanner::connect(){
+    stopReconnect();
+    stepOffset = 0; // table's position now is home
     connected = commander.connect();
+    linkState = connected ? LINK_CONNECTED : LINK_DISCONNECTED;
+    lastRxTime = ofGetElapsedTimef();
+    bPingPending = false;
+    if (connected) update(); // parse config report sent with handshake
     return connected;
 }
 
+void Scanner::disconnect(){
+    stopReconnect();
+    connected = false;
+    linkState = LINK_DISCONNECTED;
+    bResumeAutoscan = false;
+    bResumeQueried = false;
+}
+
+void Scanner::syncConfig(const Config& desired){
+    
+    desiredConfig = desired;
+    if (!connected) return;
+    
+    if (configHash != 0 && configHash == hashConfig(desired)){
+        ofLogNotice("Scanner") << "scanner config matches (hash " << configHash << "), nothing to send";
+        return;
+    }
+    
+    // send differences only - gear ratio first, scanner recalcs steps per turn from it
+    Config current = getConfig();
+    if (configHash == 0 || current.nStepsTurntable != desired.nStepsTurntable) setNumStepsTurntable(desired.nStepsTurntable);
+    if (configHash == 0 || current.rpm != desired.rpm) setRpm(desired.rpm);
+    if (configHash == 0 || current.numShots != desired.numShots) setNumShots(desired.numShots);
+    if (configHash == 0 || current.clockwise != desired.clockwise) setClockwise(desired.clockwise);
+    if (configHash == 0 || current.waitMs != desired.waitMs) send('W', desired.waitMs);
+    send('F', 0); // confirm new hash
+}
+
+Scanner::Config Scanner::getConfig(){
+    
+    Config config;
+    config.rpm = rpm;
+    config.nStepsTurntable = nStepsTurntable;
+    config.numShots = numShotsPerRotation;
+    config.clockwise = clockwise;
+    config.waitMs = waitMs;
+    return config;
+}
+
+unsigned long Scanner::hashConfig(const Config& config){
+    
+    // FNV-1a over 32 bit little endian fields, order must match Scanner::getConfigHash() in firmware
+    unsigned long fields[5] = {
+        (unsigned long)config.rpm,
+        (unsigned long)config.numShots,
+        (unsigned long)(!config.clockwise), // reversed: table cw == motor ccw
+        config.waitMs,
+        config.nStepsTurntable
+    };
+    uint32_t hash = 2166136261u; // offset basis
+    for (int f=0; f<5; f++){
+        for (int i=0; i<4; i++){
+            hash ^= (fields[f] >> (8*i)) & 0xFF;
+            hash *= 16777619u; // FNV prime
+        }
+    }
+    return hash;
+}
+
 int Scanner::update(){
     
+    if (linkState == LINK_RECONNECTING) return 0; // serial belongs to reconnect thread
+    if (linkState == LINK_RECONNECTED) onReconnected();
+    if (!connected) return 0;
+    
     commander.update(); // get all new cmds
     
     // run through input queue and return num cmds processed
@@ -30,54 +101,66 @@ int Scanner::update(){
         parse(cmd,val);
         ofLogNotice("Scanner") << "parsing cmd: " << cmd << " val: " << val;
     }
+    checkLink(numCmds);
     return numCmds;
 }
 
 void Scanner::setClockwise(bool cw){
     
-    if (cw)
-    commander.send('K',(int)(!cw)); // reversed: table cw == motor ccw
+    desiredConfig.clockwise = cw;
+    send('K',(int)(!cw)); // reversed: table cw == motor ccw
 }
 
 void Scanner::autoscan(bool start){
     
-    commander.send('A',(int)start); // 1 start, 0 stop
+    if (!start) bResumeAutoscan = false; // stopped on purpose
+    send('A',(int)start); // 1 start, 0 stop
 }
 
 void Scanner::setRpm(int motorRpm){
     
-    commander.send('R',motorRpm);
+    desiredConfig.rpm = motorRpm;
+    send('R',motorRpm);
 }
 
 void Scanner::setNumStepsTurntable(int numSteps){
     
+    desiredConfig.nStepsTurntable = numSteps;
     nStepsTurntable = numSteps;
-    commander.send('G',numSteps);
+    send('G',numSteps);
 }
 
 void Scanner::setNumShots(int nShots){
     
-    commander.send('C',nShots);
+    desiredConfig.numShots = nShots;
+    send('C',nShots);
 }
 
 void Scanner::setWaitAfterShot(int waitSeconds){
     
-    commander.send('W', waitSeconds*1000); // cvt to ms
+    desiredConfig.waitMs = waitSeconds*1000;
+    send('W', waitSeconds*1000); // cvt to ms
 }
 
 void Scanner::takePhoto(){
     
-    commander.send('P', 1);
+    send('P', 1);
+}
+
+void Scanner::photoLanded(){
+    
+    // scanner ignores it if autoscan has moved on to another shot
+    if (bShooting) send('J', autoscanShotsLeft);
 }
 
 void Scanner::turn(){
     
-    commander.send('M', 1);
+    send('M', 1);
     
 }
 
 void Scanner::rotate(){
-    commander.send('T',1);
+    send('T',1);
 }
 
 void Scanner::rotateTo(float degree){
@@ -85,23 +168,40 @@ void Scanner::rotateTo(float degree){
     // convert degree to step #
     degree = abs(degree); // make positive
     unsigned long step = degree/360.0 * (float)nStepsTurntable;
-    commander.send('S',step);
+    send('S',toScannerStep(step));
     
     ofLogNotice("Scanner") << "moving to degree: " << degree << " - step #: " << step;
 }
 
+void Scanner::moveToStep(unsigned long step){
+    
+    // scanner counts the other way round (see 'S' in parse)
+    if (nStepsTurntable == 0) return;
+    unsigned long raw = (nStepsTurntable - step % nStepsTurntable) % nStepsTurntable;
+    send('S', toScannerStep(raw));
+}
+
 void Scanner::sendCommand(unsigned char cmd, unsigned long val){
-    commander.send(cmd, val);
+    send(cmd, val);
 }
 
 void Scanner::sendCommand(string command){
-    commander.send(command);
+    if (linkState != LINK_CONNECTED) return;
+    if (!commander.send(command)) linkLost("write failed");
 }
 
 float Scanner::getDegree(){
     return (float)currentStep/(float)nStepsTurntable * 360.0; // calc degree from current step
 }
 
+bool Scanner::getNextShutterEvent(ShutterEvent& e){
+    
+    if (shutterEvents.empty()) return false;
+    e = shutterEvents.front();
+    shutterEvents.pop_front();
+    return true;
+}
+
 bool Scanner::getLastCmdValRcvd(char* cmd, unsigned long* val){
     if (lastCmdRcv != 0){
         *cmd = lastCmdRcv;
@@ -115,30 +215,218 @@ bool Scanner::getLastCmdValRcvd(char* cmd, unsigned long* val){
 // PRIVATE
 
 
+bool Scanner::send(unsigned char cmd, unsigned long val){
+    
+    if (linkState != LINK_CONNECTED) return false; // config changes are kept in desiredConfig, resent on reconnect
+    
+    bool sent = commander.send(cmd, val);
+    if (!sent) linkLost("write failed");
+    return sent;
+}
+
+void Scanner::checkLink(int numCmds){
+    
+    float now = ofGetElapsedTimef();
+    if (numCmds > 0) {
+        lastRxTime = now;
+        bPingPending = false;
+        return;
+    }
+    
+    // a quiet scanner is fine (nothing changed), only a ping going unanswered means it's gone
+    if (!bPingPending) {
+        if (now - lastRxTime > pingInterval) {
+            lastPingTime = now;
+            bPingPending = true;
+            send('Q', 0); // ping - reports # cmds queued, no side effects
+        }
+        return;
+    }
+    
+    // scanner loop blocks during 'S' moves and manual shots, allow for a full rotation / wait
+    float deadline = linkTimeout;
+    if (bMoving && rpm > 0) deadline += 60.0 / ((float)rpm * 4096.0 / (float)nStepsTurntable);
+    if (bShooting) deadline += waitMs / 1000.0;
+    
+    if (now - lastPingTime > deadline) {
+        linkLost("no reply to ping for " + ofToString(now - lastPingTime, 1) + " s");
+    }
+}
+
+void Scanner::linkLost(string reason){
+    
+    if (linkState != LINK_CONNECTED) return;
+    
+    ofLogWarning("Scanner") << "link lost (" << reason << "), reconnecting to " << device;
+    connected = false;
+    
+    if (isAutoscanning()) {
+        bResumeAutoscan = true;
+        lostRawStep = rawStep;
+    }
+    startReconnect();
+}
+
+void Scanner::startReconnect(){
+    
+    stopReconnect();
+    if (device == "" || baudRate == 0 || serial == NULL) {
+        linkState = LINK_DISCONNECTED;
+        return;
+    }
+    linkState = LINK_RECONNECTING;
+    bStopReconnect = false;
+    reconnectThread = std::thread(&Scanner::reconnectLoop, this);
+}
+
+void Scanner::stopReconnect(){
+    
+    bStopReconnect = true;
+    if (reconnectThread.joinable()) reconnectThread.join();
+    bStopReconnect = false;
+}
+
+void Scanner::reconnectLoop(){
+    
+    float backoff = 1.0;
+    
+    while (!bStopReconnect) {
+        
+        serial->close();
+        
+        // wait before trying, in short sleeps so stopReconnect() doesn't hang
+        float start = ofGetElapsedTimef();
+        while (!bStopReconnect && ofGetElapsedTimef() - start < backoff) ofSleepMillis(50);
+        if (bStopReconnect) return;
+        
+        ofLogNotice("Scanner") << "reconnect attempt: " << device << " @ " << baudRate;
+        if (serial->setup(device, baudRate) && commander.connect()) {
+            linkState = LINK_RECONNECTED; // main thread takes over in update()
+            return;
+        }
+        backoff = min(backoff*2, maxBackoff);
+    }
+}
+
+void Scanner::onReconnected(){
+    
+    if (reconnectThread.joinable()) reconnectThread.join();
+    connected = true;
+    linkState = LINK_CONNECTED;
+    lastRxTime = ofGetElapsedTimef();
+    bPingPending = false;
+    ofLogNotice("Scanner") << "reconnected to scanner";
+    
+    // parse config report from handshake, then restore config
+    char cmd; unsigned long val;
+    commander.update();
+    while (commander.getNext(&cmd, &val)) parse(cmd, val);
+    syncConfig(desiredConfig);
+    
+    if (bResumeAutoscan) {
+        // report only, nothing stopped: shots left ('N' 0), step, shots/rotation - resume once 'C' reply is in
+        bResumeQueried = true;
+        bResumeStateIn = false;
+        send('N', 0);
+        send('I', 0);
+        send('C', 0);
+    }
+}
+
+void Scanner::resumeAutoscan(){
+    
+    bResumeQueried = false;
+    bResumeAutoscan = false;
+    
+    // the port didn't reset the board (or the stall wasn't the port at all): autoscan carried on
+    if (autoscanShotsLeft > 0) {
+        ofLogNotice("Scanner") << "scanner still autoscanning, " << autoscanShotsLeft << " shots left";
+        return;
+    }
+    // a reboot restarts the step count at 0 - anywhere else, the autoscan ended (finished / stopped) on its own
+    if (reportedStep != 0) {
+        ofLogNotice("Scanner") << "autoscan ended while disconnected, not resuming";
+        return;
+    }
+    
+    // but the table stayed where it was: count on from there, so poses + move targets stay in one frame
+    stepOffset = lostRawStep;
+    setRawStep(reportedStep);
+    ofLogNotice("Scanner") << "scanner rebooted at step " << lostRawStep << ", offsetting its steps";
+    
+    if (!bShotConfirmed) { // lost before first shot finished, table hasn't moved - start over
+        ofLogNotice("Scanner") << "resuming autoscan from start";
+        send('A', 1);
+        return;
+    }
+    
+    // opening the port reboots the scanner, so its step count restarts but the table stays put:
+    // if the move after the last confirmed shot hadn't been reported done, redo it, else shoot here
+    ofLogNotice("Scanner") << "resuming autoscan: " << resumeShotsLeft << " shots left";
+    if (lostRawStep == confirmedRawStep) send('M', 1);
+    send('N', resumeShotsLeft); // continue autoscan from current move/position
+}
+
+void Scanner::setRawStep(unsigned long step){
+    
+    if (nStepsTurntable == 0) return;
+    // step # doesn't wrap around total steps if gear ratio/total steps changed after scanner/stepper init
+    rawStep = (step % nStepsTurntable + stepOffset % nStepsTurntable) % nStepsTurntable;
+    currentStep = (nStepsTurntable - rawStep) % nStepsTurntable; // reversed (table v. motor)
+}
+
+unsigned long Scanner::toScannerStep(unsigned long step){
+    
+    if (nStepsTurntable == 0) return step;
+    return (step % nStepsTurntable + nStepsTurntable - stepOffset % nStepsTurntable) % nStepsTurntable;
+}
+
+
 bool Scanner::parse(char cmd, unsigned long val){
     
     bool good = true;
     
     if (cmd == 'R') rpm = val;
     else if (cmd == 'M') bMoving = (val == 0) ? 0:1;
-    else if (cmd == 'P') bShooting = (val == 0) ? 0:1;
-    else if (cmd == 'C') numShotsPerRotation = val;
+    else if (cmd == 'P') {
+        // shot finished mid-autoscan: step report for it came just before this
+        if (bShooting && val == 0 && autoscanShotsLeft > 0) {
+            bShotConfirmed = true;
+            resumeShotsLeft = autoscanShotsLeft;
+            confirmedRawStep = rawStep;
+        }
+        // started shooting: step + autoscan shots left were reported just before this
+        if (!bShooting && val == 1) {
+            ShutterEvent e;
+            e.time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            e.step = currentStep;
+            e.stepsPerRev = nStepsTurntable;
+            e.degree = getDegree();
+            e.clockwise = clockwise;
+            e.shotIndex = autoscanShotsLeft > 0 ? numShotsPerRotation - autoscanShotsLeft : -1;
+            shutterEvents.push_back(e);
+            if (shutterEvents.size() > 1000) shutterEvents.pop_front(); // nobody reading
+        }
+        bShooting = (val == 0) ? 0:1;
+    }
+    else if (cmd == 'C') {
+        numShotsPerRotation = val;
+        if (bResumeQueried && bResumeStateIn) resumeAutoscan(); // last reply to resume queries
+    }
     else if (cmd == 'K') clockwise = (val == 0) ? 1:0; // reversed (table v. motor)
-    else if (cmd == 'A') autoscanShotsLeft = val;
-    else if (cmd == 'W') waitSeconds = val/1000;
+    else if (cmd == 'A') {
+        if (autoscanShotsLeft == 0 && (int)val == numShotsPerRotation) bShotConfirmed = false; // new autoscan
+        autoscanShotsLeft = val;
+    }
+    else if (cmd == 'W') { waitMs = val; waitSeconds = val/1000; }
     else if (cmd == 'G') nStepsTurntable = val;
     else if (cmd == 'S') {
-        currentStep = nStepsTurntable - val;
-        if (currentStep == nStepsTurntable) currentStep = 0;
-        else if (currentStep > nStepsTurntable) {
-            // bug in motor code? step # doesn't wrap around total steps if already higher...
-            // ideally, don't set gear ratio/total steps after scanner/stepper init
-            // hack fix
-            val %= nStepsTurntable;
-            currentStep = nStepsTurntable-val;
-        }
+        reportedStep = val;
+        if (bResumeQueried) bResumeStateIn = true; // shots left ('A') is reported before step
+        setRawStep(val);
     }
     else if (cmd == 'Q') nCmdsAtArduino = val;
+    else if (cmd == 'F') configHash = val;
     else good = false;
     
     if (good) {
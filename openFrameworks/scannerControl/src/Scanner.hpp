@@ -9,17 +9,60 @@
 #pragma once
 #include "ofMain.h"
 #include "Commander.hpp"
+#include <thread>
+#include <atomic>
+#include <deque>
 
 class Scanner {
     
 public:
     
+    // scanner config, mirrors what the firmware saves to EEPROM
+    struct Config {
+        int rpm = 10; // motor rpm
+        unsigned long nStepsTurntable = 4096; // # motor steps in 1 turntable rotation
+        int numShots = 24; // shots per rotation
+        bool clockwise = true; // table direction
+        unsigned long waitMs = 3000; // wait after shot (ms)
+    };
+    static unsigned long hashConfig(const Config& config); // same hash firmware reports as 'F'
+    
+    // camera fired: turntable pose at that moment, queued when scanner reports it started shooting (P1)
+    struct ShutterEvent {
+        int64_t time = 0; // ms since 1970, host clock
+        unsigned long step = 0; // turntable step (0 = home)
+        unsigned long stepsPerRev = 0; // turntable steps in one rotation
+        float degree = 0;
+        bool clockwise = true; // table direction
+        int shotIndex = -1; // shot # within autoscan rotation, -1 for single shots
+        bool reshoot = false; // retake of a missed autoscan shot (set by ReshootQueue)
+    };
+    
+    enum LinkState {
+        LINK_DISCONNECTED,
+        LINK_CONNECTED,
+        LINK_RECONNECTING, // reconnect thread owns serial
+        LINK_RECONNECTED // reconnect thread done, resync on next update()
+    };
+    
     Scanner(){}
     Scanner(ofSerial* serialPtr);
+    ~Scanner() { stopReconnect(); }
+    void setSerial(ofSerial* serialPtr) { serial = serialPtr; commander.setSerial(serialPtr); }
+    void setDevice(string devicePath, int baud) { device = devicePath; baudRate = baud; } // used to reconnect
     
     bool connect();
     int update();
     
+    void setLinkTimeout(float seconds) { linkTimeout = seconds; } // ping unanswered this long = link lost
+    LinkState getLinkState() { return linkState; }
+    bool isReconnecting() { return linkState == LINK_RECONNECTING || linkState == LINK_RECONNECTED; }
+    bool isResumingAutoscan() { return bResumeAutoscan; }
+    
+    void syncConfig(const Config& desired); // send only the config values that differ from scanner's
+    Config getConfig(); // scanner's config (as last reported)
+    bool isConfigSynced() { return configHash == hashConfig(desiredConfig); }
+    
     void setClockwise(bool cw);
     void autoscan(bool start); // false for stop
     void startAutoscan() { autoscan(true); }
@@ -29,9 +72,11 @@ public:
     void setNumShots(int nShots);
     void setWaitAfterShot(int waitSeconds); // in sec
     void takePhoto();
+    void photoLanded(); // photo file arrived, tell scanner to stop waiting (wait after shot becomes a timeout)
     void turn();
     void rotate();
     void rotateTo(float degree);
+    void moveToStep(unsigned long step); // turntable step as reported by getCurrentStep() / ShutterEvent
     void sendCommand(unsigned char cmd, unsigned long val);
     void sendCommand(string command);
     
@@ -49,19 +94,57 @@ public:
     unsigned long getNumStepsTurntable() { return nStepsTurntable; }
     float getDegree();
     bool getLastCmdValRcvd(char* cmd, unsigned long* val);
+    bool getNextShutterEvent(ShutterEvent& e); // oldest first, false if none
     
     bool isConnected() { return connected; }
-    void disconnect() { connected = false; }
+    void disconnect(); // stops any reconnect, forgets interrupted autoscan
     
     
 private:
     
     bool parse(char cmd, unsigned long val);
+    bool send(unsigned char cmd, unsigned long val); // send, flags link lost on write failure
+    
+    void checkLink(int numCmds); // ping when quiet, flag link lost once the ping goes unanswered
+    void linkLost(string reason);
+    void startReconnect();
+    void stopReconnect();
+    void reconnectLoop(); // runs on reconnectThread
+    void onReconnected();
+    void resumeAutoscan(); // called once firmware state is known after reconnect
+    void setRawStep(unsigned long step); // offset applied, updates currentStep
+    unsigned long toScannerStep(unsigned long step); // raw step -> as the scanner counts it (offset removed)
     
     int serialIdx = 0;
     Commander commander; // serial I/O parsing
+    ofSerial* serial = NULL;
     bool connected = false;
     
+    // link monitoring / reconnect
+    string device = "";
+    int baudRate = 0;
+    float linkTimeout = 3.0; // s without a reply to a ping before link is considered lost
+    float pingInterval = 1.0; // s without telemetry before pinging scanner
+    float maxBackoff = 30.0; // s max between reconnect attempts
+    float lastRxTime = 0;
+    float lastPingTime = 0;
+    bool bPingPending = false; // ping sent since last telemetry, no reply yet
+    std::atomic<LinkState> linkState { LINK_DISCONNECTED };
+    std::atomic<bool> bStopReconnect { false };
+    std::thread reconnectThread;
+    
+    // autoscan resume
+    bool bResumeAutoscan = false; // autoscan was interrupted by link loss
+    bool bResumeQueried = false; // sent state queries, waiting on replies
+    bool bResumeStateIn = false; // step + shots left reported since the queries
+    bool bShotConfirmed = false; // at least one shot of current autoscan confirmed
+    int resumeShotsLeft = 0; // autoscan shots left after last confirmed shot
+    unsigned long confirmedRawStep = 0; // scanner step of last confirmed shot
+    unsigned long lostRawStep = 0; // last scanner step reported before link loss
+    unsigned long rawStep = 0; // scanner step, offset applied (not reversed)
+    unsigned long reportedStep = 0; // scanner step as reported, restarts at 0 when the scanner reboots
+    unsigned long stepOffset = 0; // where the table stood when the scanner rebooted mid-autoscan, added to reported steps
+    
     int numShotsTaken = 0;
     
     unsigned long nStepsTurntable = 1;
@@ -75,6 +158,11 @@ private:
     int autoscanShotsLeft = 0;
     int waitSeconds = 0;
     int nCmdsAtArduino = 0; // tracks number of unprocessed cmds in arduino's cmdQueue
+    unsigned long waitMs = 0;
+    unsigned long configHash = 0; // reported by scanner ('F'), 0 if unknown
+    Config desiredConfig;
+    
+    deque<ShutterEvent> shutterEvents;
     
     char lastCmdRcv = 0; // last cmd received
     unsigned long lastValRcv = 0; // last val received
@@ -83,6 +171,8 @@ private:
 
 /*
  valid cmds:
+ 'H' = handshake (input H1, response: H1 followed by config report: G, R, C, K, W, F)
+ 'F' = report config hash (hash of R, C, K, W, G - saved to EEPROM on scanner when changed)
  'R' = set RPM (val 0: report)
  'M' = move one turn (val 0: report is moving)
  'P' = take picture (val 0: report is shooting)
@@ -90,7 +180,9 @@ private:
  'C' = set turns per circle (val 0: report current)
  'K' = set clockwise direction (vals - 0: report current, 1: set cw, 2: set ccw)
  'A' = run autoscan (vals - 0: report autoscan move left, 1: run, 2: stop)
+ 'N' = resume autoscan with N moves left (finishes current move then shoots, or shoots now)
  'W' = set wait (ms) after photo before next move (val 0: report current)
+ 'J' = photo landed, end wait after photo now (val: autoscan moves left when shot was taken, 0 if not autoscanning)
  'G' = set turntable total steps (val 0: report current)
  'I' = report step position
  'S' = move to step
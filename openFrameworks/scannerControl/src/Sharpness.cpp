@@ -0,0 +1,160 @@
+//
+//  Sharpness.cpp
+//  scannerControl
+//
+//
+
+#include "Sharpness.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHARPNESS_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SHARPNESS_NEON
+#endif
+
+// Laplacian sums of one row (interior pixels [1, w-1)), rows above / below given
+typedef void (*LaplacianRowFn)(const uint8_t* up, const uint8_t* row, const uint8_t* down, int w, int64_t* sum, int64_t* sumSq);
+
+static void laplacianRowScalar(const uint8_t* up, const uint8_t* row, const uint8_t* down, int w, int64_t* sum, int64_t* sumSq, int x){
+
+    int64_t s = 0, sq = 0;
+    for (; x<w-1; x++){
+        int lap = 4 * row[x] - row[x-1] - row[x+1] - up[x] - down[x];
+        s += lap;
+        sq += lap * lap;
+    }
+    *sum += s;
+    *sumSq += sq;
+}
+
+static void laplacianRow(const uint8_t* up, const uint8_t* row, const uint8_t* down, int w, int64_t* sum, int64_t* sumSq){
+
+    laplacianRowScalar(up, row, down, w, sum, sumSq, 1);
+}
+
+#ifdef SHARPNESS_X86
+__attribute__((target("avx2")))
+static void laplacianRowAvx2(const uint8_t* up, const uint8_t* row, const uint8_t* down, int w, int64_t* sum, int64_t* sumSq){
+
+    // 16 pixels a step as int16: |lap| <= 1020, lap^2 pairs summed by madd fit int32
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i accSum = _mm256_setzero_si256();
+    __m256i accSq = _mm256_setzero_si256(); // int32 lanes: 2 * 1020^2 per step, flushed per row (rows < 16k px)
+    int x = 1;
+    for (; x + 16 <= w - 1; x += 16){
+        __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + x)));
+        __m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + x - 1)));
+        __m256i r = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + x + 1)));
+        __m256i u = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(up + x)));
+        __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(down + x)));
+        __m256i lap = _mm256_sub_epi16(_mm256_slli_epi16(c, 2), _mm256_add_epi16(_mm256_add_epi16(l, r), _mm256_add_epi16(u, d)));
+        accSum = _mm256_add_epi32(accSum, _mm256_madd_epi16(lap, ones));
+        accSq = _mm256_add_epi32(accSq, _mm256_madd_epi16(lap, lap));
+    }
+
+    int32_t s[8], sq[8];
+    _mm256_storeu_si256((__m256i*)s, accSum);
+    _mm256_storeu_si256((__m256i*)sq, accSq);
+    for (int i=0; i<8; i++){
+        *sum += s[i];
+        *sumSq += (uint32_t)sq[i]; // sum of squares, never negative
+    }
+    laplacianRowScalar(up, row, down, w, sum, sumSq, x); // tail
+}
+#endif
+
+#ifdef SHARPNESS_NEON
+static void laplacianRowNeon(const uint8_t* up, const uint8_t* row, const uint8_t* down, int w, int64_t* sum, int64_t* sumSq){
+
+    int32x4_t accSum = vdupq_n_s32(0);
+    uint32x4_t accSq = vdupq_n_u32(0);
+    int x = 1;
+    for (; x + 8 <= w - 1; x += 8){
+        int16x8_t c = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x)));
+        int16x8_t l = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x - 1)));
+        int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(row + x + 1)));
+        int16x8_t u = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(up + x)));
+        int16x8_t d = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(down + x)));
+        int16x8_t lap = vsubq_s16(vshlq_n_s16(c, 2), vaddq_s16(vaddq_s16(l, r), vaddq_s16(u, d)));
+        accSum = vpadalq_s16(accSum, lap);
+        accSq = vreinterpretq_u32_s32(vmlal_s16(vreinterpretq_s32_u32(accSq), vget_low_s16(lap), vget_low_s16(lap)));
+        accSq = vreinterpretq_u32_s32(vmlal_s16(vreinterpretq_s32_u32(accSq), vget_high_s16(lap), vget_high_s16(lap)));
+    }
+
+    int32_t s[4];
+    uint32_t sq[4];
+    vst1q_s32(s, accSum);
+    vst1q_u32(sq, accSq);
+    for (int i=0; i<4; i++){
+        *sum += s[i];
+        *sumSq += sq[i];
+    }
+    laplacianRowScalar(up, row, down, w, sum, sumSq, x); // tail
+}
+#endif
+
+// best kernel for this CPU, picked once
+static LaplacianRowFn pickLaplacianRow(const char** name){
+
+#ifdef SHARPNESS_X86
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return laplacianRowAvx2;
+    }
+#endif
+#ifdef SHARPNESS_NEON
+    *name = "neon";
+    return laplacianRowNeon;
+#endif
+    *name = "scalar";
+    return laplacianRow;
+}
+
+static const char* implName = "";
+static const LaplacianRowFn laplacianRowBest = pickLaplacianRow(&implName);
+
+
+float getSharpness(const ofPixels& pixels){
+
+    int w = pixels.getWidth();
+    int h = pixels.getHeight();
+    int channels = pixels.getNumChannels();
+    if (w < 3 || h < 3 || !pixels.isAllocated()) return -1;
+
+    // luma rows, three kept around (above, current, below) - fits in L1 for proxies
+    vector<uint8_t> luma(w * 3);
+    const unsigned char* src = pixels.getData();
+    auto toLuma = [&](int y, uint8_t* dst){
+        const unsigned char* p = src + (size_t)y * w * channels;
+        if (channels < 3) {
+            for (int x=0; x<w; x++) dst[x] = p[x * channels];
+        } else {
+            for (int x=0; x<w; x++, p += channels) dst[x] = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8; // BT.601, 8 bit fixed point
+        }
+    };
+
+    uint8_t* rows[3] = { &luma[0], &luma[w], &luma[w * 2] };
+    toLuma(0, rows[0]);
+    toLuma(1, rows[1]);
+
+    int64_t sum = 0, sumSq = 0;
+    for (int y=1; y<h-1; y++){
+        toLuma(y+1, rows[2]);
+        laplacianRowBest(rows[0], rows[1], rows[2], w, &sum, &sumSq);
+        uint8_t* oldest = rows[0]; // rotate
+        rows[0] = rows[1];
+        rows[1] = rows[2];
+        rows[2] = oldest;
+    }
+
+    double n = (double)(w - 2) * (h - 2);
+    double mean = sum / n;
+    return sumSq / n - mean * mean;
+}
+
+string getSharpnessImpl(){
+
+    return implName;
+}
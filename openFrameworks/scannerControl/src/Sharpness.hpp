@@ -0,0 +1,15 @@
+//
+//  Sharpness.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// focus / motion blur score: variance of the Laplacian of luma (4 neighbour), higher is sharper
+// scores depend on content + size, so compare frames of the same object at the same proxy size
+// AVX2 (picked at runtime) / NEON / scalar, ~1ms for a 1k proxy - thread safe
+
+float getSharpness(const ofPixels& pixels); // gray or RGB(A), -1 if too small
+string getSharpnessImpl(); // "avx2", "neon" or "scalar"
@@ -0,0 +1,128 @@
+//
+//  ShotMatcher.cpp
+//  scannerControl
+//
+//
+
+#include "ShotMatcher.hpp"
+#include <chrono>
+
+void ShotMatcher::addShot(const Scanner::ShutterEvent& shot){
+
+    pendingShots.push_back(shot);
+}
+
+void ShotMatcher::addFile(const string& path, int64_t captureTime){
+
+    // twin of a file already matched (RAW+JPEG): same shot
+    string stem = ofFilePath::removeExt(path);
+    for (int i=recentShots.size()-1; i>=0; i--){
+        if (recentShots[i].first == stem) {
+            addTwin(path, captureTime);
+            return;
+        }
+    }
+
+    int64_t t = now();
+    expire(t);
+
+    int best = -1;
+    if (clockKnown && captureTime > 0) {
+        // nearest shot on the camera's clock, none if it's too far off (shot from the camera itself)
+        double bestErr = toleranceMs;
+        for (int i=0; i<pendingShots.size(); i++){
+            double err = fabs(captureTime - clockOffsetMs - pendingShots[i].time);
+            if (err <= bestErr) {
+                bestErr = err;
+                best = i;
+            }
+        }
+    }
+    else if (!pendingShots.empty() && pendingShots.front().time <= t) best = 0; // arrival order
+    if (best < 0) return;
+
+    Match m;
+    m.shot = pendingShots[best];
+    m.path = path;
+    m.captureTime = captureTime;
+    matches.push_back(m);
+    pendingShots.erase(pendingShots.begin() + best);
+
+    // learn camera clock, then follow its drift slowly
+    if (captureTime > 0) {
+        double offset = captureTime - m.shot.time;
+        if (!clockKnown) clockOffsetMs = offset;
+        else clockOffsetMs += (offset - clockOffsetMs) * 0.2;
+        clockKnown = true;
+    }
+
+    recentShots.push_back(make_pair(stem, m.shot));
+    if (recentShots.size() > 16) recentShots.pop_front();
+}
+
+void ShotMatcher::addTwin(const string& path, int64_t captureTime){
+
+    string stem = ofFilePath::removeExt(path);
+    for (int i=recentShots.size()-1; i>=0; i--){
+        if (recentShots[i].first == stem) {
+            Match m;
+            m.shot = recentShots[i].second;
+            m.path = path;
+            m.captureTime = captureTime;
+            matches.push_back(m);
+            return;
+        }
+    }
+    // its twin wasn't matched (no shot for it, or already in the manifest): taking a pending shot
+    // here would give some later file's pose to this one
+    ofLogVerbose("ShotMatcher") << "no shot for the twin of " << ofFilePath::getFileName(path) << ", not matched";
+}
+
+void ShotMatcher::update(){
+
+    if (!pendingShots.empty()) expire(now());
+}
+
+bool ShotMatcher::getNextMatch(Match& m){
+
+    if (matches.empty()) return false;
+    m = matches.front();
+    matches.pop_front();
+    return true;
+}
+
+bool ShotMatcher::getNextMissed(Scanner::ShutterEvent& shot){
+
+    if (missed.empty()) return false;
+    shot = missed.front();
+    missed.pop_front();
+    return true;
+}
+
+void ShotMatcher::clear(){
+
+    pendingShots.clear();
+    matches.clear();
+    missed.clear();
+    recentShots.clear();
+    clockKnown = false;
+    clockOffsetMs = 0;
+}
+
+
+// PRIVATE
+
+
+int64_t ShotMatcher::now(){
+
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void ShotMatcher::expire(int64_t t){
+
+    // shots nothing landed for in time won't get a file any more
+    while (!pendingShots.empty() && pendingShots.front().time < t - timeoutMs){
+        missed.push_back(pendingShots.front());
+        pendingShots.pop_front();
+    }
+}
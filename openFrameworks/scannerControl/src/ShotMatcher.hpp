@@ -0,0 +1,54 @@
+//
+//  ShotMatcher.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "Scanner.hpp"
+
+// pairs scanner shutter events with the image files they produce
+// files land in shutter order most of the time, but shots can go missing (misfire, dropped transfer) -
+// once one pair is known, the camera clock (EXIF capture time) is matched against shutter times instead,
+// so one lost file doesn't shift every later pose by a shot
+// RAW+JPEG twins get the same shot. Shots with no file within the timeout are reported missed. Main thread only
+
+class ShotMatcher {
+
+public:
+
+    struct Match {
+        Scanner::ShutterEvent shot;
+        string path;
+        int64_t captureTime = 0; // ms since 1970, camera clock, 0 if unknown
+    };
+
+    void addShot(const Scanner::ShutterEvent& shot);
+    void addFile(const string& path, int64_t captureTime); // just landed, captureTime 0 if unknown
+    void addTwin(const string& path, int64_t captureTime); // other half of a RAW+JPEG shot: its twin's shot, or nothing (never takes a pending shot)
+    void update(); // once per frame: times out shots
+    bool getNextMatch(Match& m); // oldest first, false if none
+    bool getNextMissed(Scanner::ShutterEvent& shot); // shot with no file within timeout, oldest first
+    void clear(); // forget pending shots + learnt camera clock
+
+    int getNumPendingShots() { return pendingShots.size(); }
+    void setTimeout(float seconds) { timeoutMs = seconds * 1000; } // shutter -> file landed, later is missed
+    void setTolerance(float seconds) { toleranceMs = seconds * 1000; } // camera clock v. shutter time
+
+
+private:
+
+    static int64_t now(); // ms since 1970, same clock as ShutterEvent::time
+    void expire(int64_t t); // pending shots past timeout -> missed
+
+    deque<Scanner::ShutterEvent> pendingShots;
+    deque<Match> matches;
+    deque<Scanner::ShutterEvent> missed;
+    deque<pair<string, Scanner::ShutterEvent> > recentShots; // path without ext -> shot, for twins
+
+    bool clockKnown = false;
+    double clockOffsetMs = 0; // camera clock - host clock
+    int64_t timeoutMs = 20000; // EOS Utility lands RAW files within a few s
+    int64_t toleranceMs = 1500; // EXIF times without sub seconds are up to 1s off
+};
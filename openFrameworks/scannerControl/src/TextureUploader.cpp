@@ -0,0 +1,95 @@
+//
+//  TextureUploader.cpp
+//  scannerControl
+//
+//
+
+#include "TextureUploader.hpp"
+
+void TextureUploader::add(uint64_t id, ofPixels&& pixels){
+
+    uploads.push_back(Upload());
+    Upload& up = uploads.back();
+    up.id = id;
+    up.pixels = std::move(pixels);
+}
+
+void TextureUploader::add(uint64_t id, const ofPixels* pixels){
+
+    uploads.push_back(Upload());
+    Upload& up = uploads.back();
+    up.id = id;
+    up.borrowed = pixels;
+}
+
+void TextureUploader::update(float budgetMs){
+
+    uint64_t start = ofGetElapsedTimeMicros();
+    uint64_t budgetUs = budgetMs * 1000;
+
+    while (!uploads.empty()){
+
+        Upload& up = uploads.front();
+        const ofPixels& src = up.source();
+        int w = src.getWidth();
+        int h = src.getHeight();
+
+        if (up.rowsDone == 0) {
+            if (!up.texture.isAllocated()) up.texture.allocate(w, h, ofGetGLInternalFormat(src)); // storage only, no data
+        }
+        int stripRows = max(1, stripBytes / max(1, (int)src.getBytesStride()));
+        uploadRows(up, min(stripRows, h - up.rowsDone));
+
+        if (up.rowsDone >= h){
+            uploaded.push_back(std::move(up));
+            uploads.pop_front();
+        }
+        if (ofGetElapsedTimeMicros() - start >= budgetUs) break;
+    }
+}
+
+bool TextureUploader::getNextUploaded(uint64_t* id, ofTexture* texture, ofPixels* pixels){
+
+    if (uploaded.empty()) return false;
+    Upload& up = uploaded.front();
+    *id = up.id;
+    *texture = up.texture; // ofTexture copies share the GL texture
+    if (pixels != NULL) *pixels = std::move(up.pixels); // unallocated if borrowed
+    uploaded.pop_front(); // frees pixels if not handed back
+    return true;
+}
+
+void TextureUploader::cancel(uint64_t id){
+
+    for (int i=uploads.size()-1; i>=0; i--){
+        if (uploads[i].id == id) uploads.erase(uploads.begin() + i);
+    }
+    for (int i=uploaded.size()-1; i>=0; i--){
+        if (uploaded[i].id == id) uploaded.erase(uploaded.begin() + i);
+    }
+}
+
+void TextureUploader::clear(){
+
+    uploads.clear();
+    uploaded.clear();
+}
+
+
+// PRIVATE
+
+
+void TextureUploader::uploadRows(Upload& up, int numRows){
+
+    const ofPixels& src = up.source();
+    ofTextureData& texData = up.texture.getTextureData();
+    int w = src.getWidth();
+    const unsigned char* rows = src.getData() + up.rowsDone * src.getBytesStride();
+
+    glBindTexture(texData.textureTarget, texData.textureID);
+    ofSetPixelStoreiAlignment(GL_UNPACK_ALIGNMENT, src.getBytesStride());
+    glTexSubImage2D(texData.textureTarget, 0, 0, up.rowsDone, w, numRows, ofGetGLFormat(src), ofGetGLType(src), rows);
+    glBindTexture(texData.textureTarget, 0);
+
+    up.rowsDone += numRows;
+}
@@ -0,0 +1,44 @@
+//
+//  TextureUploader.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// uploads decoded pixels to textures a strip of rows at a time, within a per-frame time budget
+// so big images don't stall a frame - main (GL) thread only
+
+class TextureUploader {
+
+public:
+
+    void add(uint64_t id, ofPixels&& pixels); // takes the pixels, freed once uploaded unless handed back
+    void add(uint64_t id, const ofPixels* pixels); // uploads from caller's pixels, which must stay put until uploaded / cancelled
+    void update(float budgetMs = 4.0); // upload strips until budget used (at least one strip)
+    bool getNextUploaded(uint64_t* id, ofTexture* texture, ofPixels* pixels = NULL); // fully uploaded textures, in order added (+ their pixels, moved out)
+    void cancel(uint64_t id); // drop pending / finished uploads for id
+    void clear();
+
+    int getNumPending() { return uploads.size(); }
+    void setStripBytes(int bytes) { stripBytes = bytes; } // ~bytes per glTexSubImage2D call
+
+
+private:
+
+    struct Upload {
+        uint64_t id = 0;
+        ofPixels pixels; // owned
+        const ofPixels* borrowed = NULL; // or caller's
+        ofTexture texture;
+        int rowsDone = 0;
+        const ofPixels& source() const { return borrowed != NULL ? *borrowed : pixels; }
+    };
+
+    void uploadRows(Upload& up, int numRows);
+
+    deque<Upload> uploads;
+    deque<Upload> uploaded;
+    int stripBytes = 1024*1024;
+};
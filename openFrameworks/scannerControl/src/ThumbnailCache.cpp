@@ -0,0 +1,221 @@
+//
+//  ThumbnailCache.cpp
+//  scannerControl
+//
+//
+
+#include "ThumbnailCache.hpp"
+#include <sys/stat.h>
+#include <utime.h>
+#include <cstdio>
+#include <ctime>
+
+static const uint32_t cacheVersion = 1;
+static const int64_t touchInterval = 3600; // s, last use written back to the file at most this often
+
+bool ThumbnailCache::setup(string dirPath){
+
+    close();
+
+    if (!ofDirectory::doesDirectoryExist(dirPath, false) && !ofDirectory::createDirectory(dirPath, false, true)){
+        ofLogError("ThumbnailCache") << "can't create cache dir: " << dirPath;
+        dir = "";
+        return false;
+    }
+    dir = dirPath;
+    bStop = false;
+    writeThread = std::thread(&ThumbnailCache::writeLoop, this);
+    return true;
+}
+
+void ThumbnailCache::close(){
+
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        bStop = true;
+    }
+    writeCond.notify_all();
+    if (writeThread.joinable()) writeThread.join();
+
+    std::lock_guard<std::mutex> lock(entryMutex);
+    entries.clear();
+    totalBytes = 0;
+}
+
+bool ThumbnailCache::load(const string& imagePath, int maxSize, ofPixels& pixels){
+
+    string path = getCachePath(imagePath, maxSize);
+    if (path == "") return false;
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == NULL) return false; // miss
+
+    Header h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1
+        && memcmp(h.magic, "3DTC", 4) == 0 && h.version == cacheVersion
+        && (h.channels == 1 || h.channels == 3) && h.width > 0 && h.height > 0;
+    if (ok) {
+        pixels.allocate(h.width, h.height, h.channels == 1 ? OF_PIXELS_GRAY : OF_PIXELS_RGB);
+        ok = fread(pixels.getData(), pixels.getTotalBytes(), 1, f) == 1;
+    }
+    fclose(f);
+
+    if (!ok) {
+        ofLogWarning("ThumbnailCache") << "bad cache file, removing: " << path;
+        remove(path.c_str());
+        pixels.clear();
+    }
+    else used(path, sizeof(h) + pixels.getTotalBytes());
+    return ok;
+}
+
+bool ThumbnailCache::save(const string& imagePath, int maxSize, const ofPixels& pixels){
+
+    string path = getCachePath(imagePath, maxSize);
+    if (path == "" || !pixels.isAllocated()) return false;
+
+    // decode workers go straight back to decoding, the copy is a proxy (small)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        if (bStop || (int)writes.size() >= maxQueued) return false; // writer behind, the next session decodes it again
+        writes.push_back(Write());
+        writes.back().path = path;
+        writes.back().pixels = pixels;
+    }
+    writeCond.notify_one();
+    return true;
+}
+
+
+// PRIVATE
+
+
+void ThumbnailCache::writeLoop(){
+
+    indexDir();
+    evict();
+
+    while (true) {
+        Write w;
+        {
+            std::unique_lock<std::mutex> lock(writeMutex);
+            writeCond.wait(lock, [this]{ return bStop || !writes.empty(); });
+            if (writes.empty()) return; // stopping, queue written
+            w = std::move(writes.front());
+            writes.pop_front();
+        }
+        if (write(w.path, w.pixels)) {
+            used(w.path, sizeof(Header) + w.pixels.getTotalBytes());
+            evict();
+        }
+    }
+}
+
+bool ThumbnailCache::write(const string& path, const ofPixels& pixels){
+
+    Header h;
+    memcpy(h.magic, "3DTC", 4);
+    h.version = cacheVersion;
+    h.width = pixels.getWidth();
+    h.height = pixels.getHeight();
+    h.channels = pixels.getNumChannels();
+    h.reserved = 0;
+
+    // write to a temp name + rename, other threads never see a partial file
+    string tmpPath = path + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(pixels.getData(), pixels.getTotalBytes(), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        ofLogWarning("ThumbnailCache") << "can't write cache file: " << path;
+        remove(tmpPath.c_str());
+    }
+    return ok;
+}
+
+void ThumbnailCache::indexDir(){
+
+    ofDirectory d(dir);
+    d.listDir();
+    for (int i=0; i<d.size(); i++){
+        string path = d.getPath(i);
+        string ext = ofFilePath::getFileExt(path);
+        if (ext != "thm") { // temp file of a write that never finished
+            if (ext == "tmp") remove(path.c_str());
+            continue;
+        }
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) continue;
+        std::lock_guard<std::mutex> lock(entryMutex);
+        if (entries.count(path)) continue; // loaded / written since setup, already newer
+        Entry& e = entries[path];
+        e.bytes = st.st_size;
+        e.lastUse = st.st_mtime;
+        totalBytes += e.bytes;
+    }
+}
+
+void ThumbnailCache::used(const string& path, uint64_t bytes){
+
+    int64_t now = time(NULL);
+    bool touch = false;
+    {
+        std::lock_guard<std::mutex> lock(entryMutex);
+        map<string, Entry>::iterator it = entries.find(path);
+        if (it == entries.end()) {
+            it = entries.insert(make_pair(path, Entry())).first;
+            it->second.bytes = bytes;
+            totalBytes += bytes;
+            touch = true;
+        }
+        else touch = now - it->second.lastUse > touchInterval;
+        it->second.lastUse = now;
+    }
+    if (touch) utime(path.c_str(), NULL); // mtime = last use, for the next session's index
+}
+
+void ThumbnailCache::evict(){
+
+    uint64_t limit = maxBytes;
+    vector<string> victims;
+    {
+        std::lock_guard<std::mutex> lock(entryMutex);
+        if (totalBytes <= limit) return;
+
+        // down to 90%, so evictions come in batches rather than one per write
+        vector<pair<int64_t, string> > byAge;
+        for (map<string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) byAge.push_back(make_pair(it->second.lastUse, it->first));
+        sort(byAge.begin(), byAge.end());
+        for (int i=0; i<byAge.size() && totalBytes > limit / 10 * 9; i++){
+            map<string, Entry>::iterator it = entries.find(byAge[i].second);
+            totalBytes -= it->second.bytes;
+            entries.erase(it);
+            victims.push_back(byAge[i].second);
+        }
+    }
+    for (int i=0; i<victims.size(); i++) remove(victims[i].c_str()); // a reader that has it open keeps its copy
+    ofLogVerbose("ThumbnailCache") << "evicted " << victims.size() << " entries";
+}
+
+string ThumbnailCache::getCachePath(const string& imagePath, int maxSize){
+
+    if (dir == "") return "";
+
+    struct stat st;
+    if (stat(imagePath.c_str(), &st) != 0) return "";
+
+    // FNV-1a 64 over the file's identity
+    string id = imagePath + "|" + ofToString((uint64_t)st.st_size) + "|" + ofToString((int64_t)st.st_mtime) + "|" + ofToString(maxSize);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i=0; i<id.size(); i++){
+        hash ^= (unsigned char)id[i];
+        hash *= 1099511628211ULL;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.thm", (unsigned long long)hash);
+    return ofFilePath::join(dir, name);
+}
@@ -0,0 +1,75 @@
+//
+//  ThumbnailCache.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+// decoded display proxies saved as raw pixels, so reopening a session skips the JPEG decodes
+// one file per proxy, named by a hash of image path + size + mtime + proxy size -
+// an edited / replaced image gets a new key, stale entries age out: past maxBytes the least recently
+// used files are removed (last use kept in the file's mtime, so the order survives restarts)
+// load() / save() are safe to call from decode threads - save() only queues, a writer thread does the IO
+
+class ThumbnailCache {
+
+public:
+
+    ~ThumbnailCache() { close(); }
+
+    bool setup(string dirPath); // creates dir if needed, starts writer thread (indexes what's there, evicts past maxBytes)
+    void close(); // writes whatever is queued, stops writer thread
+    bool isSetup() { return dir != ""; }
+    void setMaxBytes(uint64_t bytes) { maxBytes = bytes; } // on disk, least recently used removed past this
+
+    bool load(const string& imagePath, int maxSize, ofPixels& pixels); // false on miss
+    bool save(const string& imagePath, int maxSize, const ofPixels& pixels); // copied + queued, false if queue full (entry skipped)
+
+
+private:
+
+    struct Entry {
+        uint64_t bytes = 0;
+        int64_t lastUse = 0; // s since 1970
+    };
+
+    struct Write {
+        string path;
+        ofPixels pixels;
+    };
+
+    string getCachePath(const string& imagePath, int maxSize); // "" if image can't be stat'ed
+    void writeLoop(); // runs on writeThread
+    bool write(const string& path, const ofPixels& pixels);
+    void indexDir(); // entries already on disk, leftover temp files removed
+    void used(const string& path, uint64_t bytes); // mark entry used now
+    void evict(); // oldest entries out until 90% of maxBytes
+
+    struct Header {
+        char magic[4]; // "3DTC"
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;
+        uint32_t reserved;
+    };
+
+    string dir = "";
+    std::atomic<uint64_t> maxBytes { 1024ULL << 20 };
+    int maxQueued = 64;
+
+    std::mutex writeMutex;
+    std::condition_variable writeCond;
+    deque<Write> writes; // guarded by writeMutex
+    bool bStop = false; // guarded by writeMutex
+    std::thread writeThread;
+
+    std::mutex entryMutex;
+    map<string, Entry> entries; // by cache path, guarded by entryMutex
+    uint64_t totalBytes = 0; // guarded by entryMutex
+};
@@ -0,0 +1,106 @@
+//
+//  TurntableGeometry.cpp
+//  scannerControl
+//
+//
+
+#include "TurntableGeometry.hpp"
+
+const char* TurntableGeometry::fileName = "scan_geometry.txt";
+
+bool TurntableGeometry::load(const string& path){
+
+    ofBuffer buf = ofBufferFromFile(path);
+    if (buf.size() == 0) return false;
+
+    for (auto& line : buf.getLines()){
+        string l = line;
+        size_t hash = l.find('#');
+        if (hash != string::npos) l = l.substr(0, hash);
+        size_t eq = l.find('=');
+        if (eq == string::npos) continue;
+        string key = ofTrim(l.substr(0, eq));
+        string val = ofTrim(l.substr(eq + 1));
+        if (key == "" || val == "") continue;
+
+        if (key == "focal_mm") focalMm = ofToFloat(val);
+        else if (key == "sensor_width_mm") sensorWidthMm = ofToFloat(val);
+        else if (key == "focal_px") focalPx = ofToFloat(val);
+        else if (key == "image_width_px") imageWidthPx = ofToInt(val);
+        else if (key == "camera_distance_mm") cameraDistance = ofToFloat(val);
+        else if (key == "camera_height_mm") cameraHeight = ofToFloat(val);
+        else if (key == "target_height_mm") targetHeight = ofToFloat(val);
+        else if (key == "direction") direction = ofToInt(val) < 0 ? -1 : 1;
+        else if (key == "k1") k1 = ofToFloat(val);
+        else if (key == "k2") k2 = ofToFloat(val);
+        else if (key == "k3") k3 = ofToFloat(val);
+        else if (key == "p1") p1 = ofToFloat(val);
+        else if (key == "p2") p2 = ofToFloat(val);
+        else if (key == "volume_size_mm") volumeSize = ofToFloat(val);
+        else if (key == "resolution") resolution = ofToInt(val);
+        else ofLogWarning("TurntableGeometry") << "unknown key '" << key << "' in " << path;
+    }
+
+    int n = 8; // power of two, 8 .. 512
+    while (n < resolution && n < 512) n *= 2;
+    resolution = n;
+    if (cameraDistance <= 0 || volumeSize <= 0 || (focalPx <= 0 && (focalMm <= 0 || sensorWidthMm <= 0))){
+        ofLogError("TurntableGeometry") << "invalid geometry in " << path;
+        return false;
+    }
+    return true;
+}
+
+float TurntableGeometry::getFocalPx(int imageWidth) const{
+
+    if (focalPx > 0) return focalPx * (imageWidthPx > 0 ? (float)imageWidth / imageWidthPx : 1.0f);
+    return focalMm / sensorWidthMm * imageWidth;
+}
+
+bool TurntableGeometry::save(const string& path){
+
+    ofBuffer buf;
+    buf.append("# turntable rig, see TurntableGeometry.hpp - lengths in mm\n");
+    buf.append("focal_mm = " + ofToString(focalMm) + "\n");
+    buf.append("sensor_width_mm = " + ofToString(sensorWidthMm) + "\n");
+    buf.append("focal_px = " + ofToString(focalPx) + " # > 0 overrides focal_mm / sensor_width_mm\n");
+    buf.append("image_width_px = " + ofToString(imageWidthPx) + " # image width focal_px is in\n");
+    buf.append("camera_distance_mm = " + ofToString(cameraDistance) + " # lens to turntable axis\n");
+    buf.append("camera_height_mm = " + ofToString(cameraHeight) + " # lens above table surface\n");
+    buf.append("target_height_mm = " + ofToString(targetHeight) + " # aimed at this point on the axis\n");
+    buf.append("direction = " + ofToString(direction) + " # -1 if the hull comes out mirrored\n");
+    buf.append("k1 = " + ofToString(k1) + " # lens distortion, radial (OpenCV calibration order)\n");
+    buf.append("k2 = " + ofToString(k2) + "\n");
+    buf.append("k3 = " + ofToString(k3) + "\n");
+    buf.append("p1 = " + ofToString(p1) + " # tangential\n");
+    buf.append("p2 = " + ofToString(p2) + "\n");
+    buf.append("volume_size_mm = " + ofToString(volumeSize) + "\n");
+    buf.append("resolution = " + ofToString(resolution) + "\n");
+    return ofBufferToFile(path, buf);
+}
+
+void TurntableView::setup(const TurntableGeometry& geom, float tableRadians, int imageWidth, int imageHeight){
+
+    width = imageWidth;
+    height = imageHeight;
+    f = geom.getFocalPx(imageWidth);
+    cx = imageWidth * 0.5f;
+    cy = imageHeight * 0.5f;
+
+    // camera on -y looking at the axis: right = +x, down + forward from the aim
+    ofVec3f eye(0, -geom.cameraDistance, geom.cameraHeight);
+    ofVec3f fwd = (ofVec3f(0, 0, geom.targetHeight) - eye).getNormalized();
+    ofVec3f right = fwd.getCrossed(ofVec3f(0, 0, 1)).getNormalized();
+    ofVec3f down = fwd.getCrossed(right);
+
+    // object turned by the table angle, then into the camera
+    float a = geom.direction * tableRadians;
+    float c = cos(a), s = sin(a);
+    ofVec3f rows[3] = { right, down, fwd };
+    for (int i=0; i<3; i++){
+        R[i*3+0] = rows[i].x * c + rows[i].y * s;
+        R[i*3+1] = -rows[i].x * s + rows[i].y * c;
+        R[i*3+2] = rows[i].z;
+        t[i] = -rows[i].dot(eye);
+    }
+}
@@ -0,0 +1,65 @@
+//
+//  TurntableGeometry.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+
+// fixed camera looking at the turntable, measured once per rig and kept in the watch folder as
+// scan_geometry.txt ("key = value" lines, # comments) - with the table angle of a shot this gives
+// the camera pose relative to the object, no calibration target needed
+//
+// object frame: origin at the table centre on its surface, z up (turns with the table)
+// camera: distance from the axis, height above the table, aimed at a point on the axis
+
+struct TurntableGeometry {
+
+    float focalMm = 50;
+    float sensorWidthMm = 36; // sensor side along image width
+    float focalPx = 0; // overrides focal / sensor if > 0, pixels at image width imageWidthPx
+    int imageWidthPx = 0; // width focalPx was measured at (scaled to any decode size)
+    float cameraDistance = 500; // mm, lens to turntable axis (horizontal)
+    float cameraHeight = 150; // mm above the table surface
+    float targetHeight = 80; // mm, point on the axis the camera is aimed at
+    int direction = 1; // 1: object turns counter clockwise seen from above as the table degree goes up, -1: clockwise
+
+    // lens distortion (Brown-Conrady, OpenCV's order + units: normalised image coordinates, centre of the
+    // image as principal point), all 0: images are used as shot. See Undistorter
+    float k1 = 0, k2 = 0, k3 = 0; // radial
+    float p1 = 0, p2 = 0; // tangential
+
+    float volumeSize = 250; // mm, side of the cube carved (centred on the axis, bottom on the table)
+    int resolution = 128; // voxels along volumeSize, power of two
+
+    float getFocalPx(int imageWidth) const; // focal length in pixels of an image this wide
+    bool hasDistortion() const { return k1 != 0 || k2 != 0 || k3 != 0 || p1 != 0 || p2 != 0; }
+
+    bool load(const string& path); // keys missing from the file keep their defaults
+    bool save(const string& path); // all keys, so the file doubles as a template
+
+    static const char* fileName; // "scan_geometry.txt"
+};
+
+// pinhole camera of one shot: object point -> pixel at the given image size
+struct TurntableView {
+
+    void setup(const TurntableGeometry& geom, float tableRadians, int imageWidth, int imageHeight);
+
+    // false if behind the camera
+    inline bool project(float x, float y, float z, float* u, float* v) const {
+        float zc = R[6]*x + R[7]*y + R[8]*z + t[2];
+        if (zc <= 1e-3f) return false;
+        float s = f / zc;
+        *u = (R[0]*x + R[1]*y + R[2]*z + t[0]) * s + cx;
+        *v = (R[3]*x + R[4]*y + R[5]*z + t[1]) * s + cy;
+        return true;
+    }
+
+    float R[9]; // object -> camera (x right, y down, z forward), table rotation included
+    float t[3];
+    float f, cx, cy; // pixels
+    int width = 0;
+    int height = 0;
+};
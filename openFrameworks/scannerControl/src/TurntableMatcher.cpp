@@ -0,0 +1,241 @@
+//
+//  TurntableMatcher.cpp
+//  scannerControl
+//
+//
+
+#include "TurntableMatcher.hpp"
+#include "FeatureExtractor.hpp"
+#include "ParallelFor.hpp"
+#include <cfloat>
+#include <climits>
+
+const char* TurntableMatcher::fileName = "matches.bin";
+static const uint32_t matchesVersion = 1;
+
+static inline int hamming(const uint8_t* a, const uint8_t* b){
+
+    uint64_t x[4], y[4];
+    memcpy(x, a, 32);
+    memcpy(y, b, 32);
+    return __builtin_popcountll(x[0] ^ y[0]) + __builtin_popcountll(x[1] ^ y[1]) + __builtin_popcountll(x[2] ^ y[2]) + __builtin_popcountll(x[3] ^ y[3]);
+}
+
+bool TurntableMatcher::start(const vector<Shot>& shots, const TurntableGeometry& geom, const string& outPath){
+
+    if (bBusy) return false;
+    if (runThread.joinable()) runThread.join();
+    bBusy = true;
+    bFinished = false;
+    runThread = std::thread(&TurntableMatcher::run, this, shots, geom, outPath);
+    return true;
+}
+
+bool TurntableMatcher::update(){
+
+    if (!bFinished) return false;
+    bFinished = false;
+    return true;
+}
+
+
+// PRIVATE
+
+
+void TurntableMatcher::run(vector<Shot> shots, TurntableGeometry geom, string outPath){
+
+    uint64_t start = ofGetElapsedTimeMicros();
+
+    // features of every shot, mapped + copied in parallel
+    vector<FeatureSet> features(shots.size());
+    vector<uint8_t> loaded(shots.size(), 0);
+    parallelFor(shots.size(), [&](int begin, int end, int worker){
+        for (int i=begin; i<end; i++) loaded[i] = loadFeatures(FeatureExtractor::getFeaturePath(shots[i].imagePath), features[i]);
+    }, 0, 1);
+    for (int i=shots.size()-1; i>=0; i--){
+        if (loaded[i]) continue;
+        ofLogWarning("TurntableMatcher") << "no features for " << shots[i].imagePath;
+        shots.erase(shots.begin() + i);
+        features.erase(features.begin() + i);
+    }
+
+    vector<pair<int, int> > candidates = candidatePairs(shots);
+    vector<PairResult> pairs(candidates.size());
+    parallelFor(candidates.size(), [&](int begin, int end, int worker){
+        for (int p=begin; p<end; p++){
+            PairResult& r = pairs[p];
+            r.a = candidates[p].first;
+            r.b = candidates[p].second;
+            const FeatureSet& fa = features[r.a];
+            Region region = { -(float)fa.width, (float)fa.width, -(float)fa.height, (float)fa.height };
+            if (useGeometry) region = predictRegion(geom, shots[r.a].angle, shots[r.b].angle, fa.width, fa.height);
+            matchPair(fa, features[r.b], region, r.matches);
+        }
+    }, 0, 1);
+
+    Stats s;
+    s.numShots = shots.size();
+    s.numPairs = pairs.size();
+    for (int i=0; i<pairs.size(); i++) s.numMatches += pairs[i].matches.size() / 2;
+    if (!save(outPath, shots, features, pairs)) ofLogError("TurntableMatcher") << "can't write " << outPath;
+    s.ms = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats = s;
+    }
+    ofLogNotice("TurntableMatcher") << s.numShots << " shots, " << s.numPairs << " pairs, " << s.numMatches << " matches in " << s.ms << "ms";
+    bFinished = true;
+    bBusy = false;
+}
+
+vector<pair<int, int> > TurntableMatcher::candidatePairs(const vector<Shot>& shots) const{
+
+    // walk round the table in angle order, each shot paired with the next few up to window ahead of it
+    int n = shots.size();
+    vector<int> order(n);
+    vector<float> angle(n);
+    for (int i=0; i<n; i++){
+        order[i] = i;
+        angle[i] = fmod(fmod(shots[i].angle, TWO_PI) + TWO_PI, TWO_PI);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b){ return angle[a] < angle[b]; });
+
+    float maxGap = ofDegToRad(window) + 1e-4f; // shots exactly window apart still pair
+    set<pair<int, int> > pairs; // window past 180 reaches shots from both sides
+    for (int i=0; i<n; i++){
+        int numAhead = maxNeighbours > 0 ? min(maxNeighbours, n - 1) : n - 1;
+        for (int k=1; k<=numAhead; k++){
+            int j = (i + k) % n; // wraps past the last shot back to the first
+            float gap = angle[order[j]] - angle[order[i]];
+            if (gap < 0) gap += TWO_PI;
+            if (gap > maxGap) break;
+            int a = order[i], b = order[j];
+            pairs.insert(make_pair(min(a, b), max(a, b)));
+        }
+    }
+    return vector<pair<int, int> >(pairs.begin(), pairs.end());
+}
+
+TurntableMatcher::Region TurntableMatcher::predictRegion(const TurntableGeometry& geom, float angleA, float angleB, int w, int h) const{
+
+    // points through the carve volume on the half facing the camera in a: how far they move in the image
+    TurntableView va, vb;
+    va.setup(geom, angleA, w, h);
+    vb.setup(geom, angleB, w, h);
+    float a = geom.direction * angleA;
+    float sa = sin(a), ca = cos(a);
+    float half = geom.volumeSize * 0.5f;
+
+    Region r = { FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
+    const int steps = 6;
+    for (int iz=0; iz<=steps; iz++){
+        for (int iy=0; iy<=steps; iy++){
+            for (int ix=0; ix<=steps; ix++){
+                float x = -half + ix * geom.volumeSize / steps;
+                float y = -half + iy * geom.volumeSize / steps;
+                float z = iz * geom.volumeSize / steps;
+                if (x * x + y * y > half * half) continue; // table is round
+                if (sa * x + ca * y > 0) continue; // far side in a, can't be seen there
+                float ua, vA, ub, vB;
+                if (!va.project(x, y, z, &ua, &vA) || !vb.project(x, y, z, &ub, &vB)) continue;
+                r.dxMin = min(r.dxMin, ub - ua);
+                r.dxMax = max(r.dxMax, ub - ua);
+                r.dyMin = min(r.dyMin, vB - vA);
+                r.dyMax = max(r.dyMax, vB - vA);
+            }
+        }
+    }
+    if (r.dxMin > r.dxMax) return Region{ -(float)w, (float)w, -(float)h, (float)h }; // volume not in view, no prior
+
+    float pad = slack * w;
+    r.dxMin -= pad;
+    r.dxMax += pad;
+    r.dyMin -= pad;
+    r.dyMax += pad;
+    return r;
+}
+
+void TurntableMatcher::matchPair(const FeatureSet& a, const FeatureSet& b, const Region& region, vector<uint32_t>& matches) const{
+
+    // b by row, in a's pixels (RAW preview vs JPEG can differ in size)
+    float scale = b.width > 0 ? (float)a.width / b.width : 1;
+    vector<pair<float, int> > rows(b.size());
+    for (int j=0; j<b.size(); j++) rows[j] = make_pair(b.keypoints[j].y * scale, j);
+    sort(rows.begin(), rows.end());
+
+    vector<int> bestForB(b.size(), -1);
+    vector<int> bestDistForB(b.size(), INT_MAX);
+    vector<int> bestOfA(a.size(), -1);
+
+    for (int i=0; i<a.size(); i++){
+        const Keypoint& k = a.keypoints[i];
+        const uint8_t* da = a.getDescriptor(i);
+        float xMin = k.x + region.dxMin, xMax = k.x + region.dxMax;
+        float yMax = k.y + region.dyMax;
+        int best = INT_MAX, second = INT_MAX, bestJ = -1;
+        auto it = lower_bound(rows.begin(), rows.end(), make_pair(k.y + region.dyMin, INT_MIN));
+        for (; it != rows.end() && it->first <= yMax; ++it){
+            int j = it->second;
+            float x = b.keypoints[j].x * scale;
+            if (x < xMin || x > xMax) continue;
+            int d = hamming(da, b.getDescriptor(j));
+            if (d < best) {
+                second = best;
+                best = d;
+                bestJ = j;
+            }
+            else if (d < second) second = d;
+        }
+        if (bestJ < 0 || best > maxDistance) continue;
+        if (second != INT_MAX && best >= ratio * second) continue; // ambiguous
+        bestOfA[i] = bestJ;
+        if (best < bestDistForB[bestJ]) {
+            bestDistForB[bestJ] = best;
+            bestForB[bestJ] = i;
+        }
+    }
+
+    // one match per feature of b too: the closest a wins
+    for (int i=0; i<a.size(); i++){
+        int j = bestOfA[i];
+        if (j < 0 || bestForB[j] != i) continue;
+        matches.push_back(i);
+        matches.push_back(j);
+    }
+}
+
+bool TurntableMatcher::save(const string& path, const vector<Shot>& shots, const vector<FeatureSet>& features, const vector<PairResult>& pairs){
+
+    string tmpPath = path + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (f == NULL) return false;
+
+    uint32_t header[4] = { 0, matchesVersion, (uint32_t)shots.size(), (uint32_t)pairs.size() };
+    memcpy(header, "3DMT", 4);
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+    for (int i=0; i<shots.size() && ok; i++){
+        char name[120];
+        memset(name, 0, sizeof(name));
+        strncpy(name, ofFilePath::getFileName(shots[i].imagePath).c_str(), sizeof(name) - 1);
+        float angle = shots[i].angle;
+        uint32_t count = features[i].size();
+        ok = fwrite(name, sizeof(name), 1, f) == 1 && fwrite(&angle, 4, 1, f) == 1 && fwrite(&count, 4, 1, f) == 1;
+    }
+
+    uint32_t first = 0;
+    for (int i=0; i<pairs.size() && ok; i++){
+        uint32_t count = pairs[i].matches.size() / 2;
+        uint32_t rec[4] = { (uint32_t)pairs[i].a, (uint32_t)pairs[i].b, count, first };
+        ok = fwrite(rec, sizeof(rec), 1, f) == 1;
+        first += count;
+    }
+    for (int i=0; i<pairs.size() && ok; i++){
+        if (!pairs[i].matches.empty()) ok = fwrite(&pairs[i].matches[0], 4, pairs[i].matches.size(), f) == pairs[i].matches.size();
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok) ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) remove(tmpPath.c_str());
+    return ok;
+}
@@ -0,0 +1,91 @@
+//
+//  TurntableMatcher.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+#include "TurntableGeometry.hpp"
+#include "Features.hpp"
+
+// feature matches between shots of a rotation, using what the turntable already tells us:
+// only shots within window degrees of each other are paired (wrapping past 360, so the last shot
+// pairs with the first), and at most maxNeighbours ahead of each - n shots cost at most
+// n * maxNeighbours pairs instead of n^2 / 2, however densely the rotation is shot. Within a
+// pair a feature is only compared against features where the known rotation can have moved it
+// (from the rig geometry: visible side of the carve volume, both views projected), searched by row
+// band then column range. Hamming distance by popcount, Lowe ratio test, one match per feature.
+// Pairs run on all cores (work stealing), the whole run on its own thread
+//
+// matches.bin layout (version 1, little endian):
+//   header: "3DMT", uint32 version, uint32 # shots, uint32 # pairs
+//   shots: per shot char fileName[120] (image, relative to the folder), float angle (radians), uint32 # features
+//   pairs: per pair uint32 shot a, shot b, # matches, first match (index into matches)
+//   matches: uint32 feature in a, uint32 feature in b
+
+class TurntableMatcher {
+
+public:
+
+    struct Shot {
+        string imagePath; // features read from FeatureExtractor::getFeaturePath()
+        float angle = 0; // table angle, radians
+    };
+
+    struct Stats {
+        int numShots = 0;
+        int numPairs = 0;
+        int numMatches = 0;
+        float ms = 0;
+    };
+
+    ~TurntableMatcher() { if (runThread.joinable()) runThread.join(); }
+
+    void setWindow(float degrees) { window = degrees; } // pair shots up to this far apart
+    void setMaxNeighbours(int n) { maxNeighbours = n; } // closest shots ahead of each paired with it, 0: all within window
+    void setRatio(float r) { ratio = r; } // best must be < ratio * second best
+    void setMaxDistance(int bits) { maxDistance = bits; } // of 256
+    void setUseGeometry(bool b) { useGeometry = b; } // false: search the whole other image
+    void setSlack(float fraction) { slack = fraction; } // of image width, added to the predicted search region
+
+    bool start(const vector<Shot>& shots, const TurntableGeometry& geom, const string& outPath); // false if still busy
+    bool isBusy() { return bBusy; }
+    bool update(); // main thread, true once after each run finished
+    Stats getStats() { std::lock_guard<std::mutex> lock(statsMutex); return stats; }
+
+    static const char* fileName; // "matches.bin"
+
+
+private:
+
+    struct Region { // where a feature of a can be in b, pixels relative to it
+        float dxMin, dxMax, dyMin, dyMax;
+    };
+
+    struct PairResult {
+        int a, b;
+        vector<uint32_t> matches; // a, b feature index pairs
+    };
+
+    void run(vector<Shot> shots, TurntableGeometry geom, string outPath);
+    vector<pair<int, int> > candidatePairs(const vector<Shot>& shots) const;
+    Region predictRegion(const TurntableGeometry& geom, float angleA, float angleB, int w, int h) const;
+    void matchPair(const FeatureSet& a, const FeatureSet& b, const Region& region, vector<uint32_t>& matches) const;
+    bool save(const string& path, const vector<Shot>& shots, const vector<FeatureSet>& features, const vector<PairResult>& pairs);
+
+    std::thread runThread;
+    std::atomic<bool> bBusy { false };
+    std::atomic<bool> bFinished { false };
+    std::mutex statsMutex;
+    Stats stats;
+
+    float window = 25;
+    int maxNeighbours = 4;
+    float ratio = 0.8;
+    int maxDistance = 64;
+    bool useGeometry = true;
+    float slack = 0.03;
+};
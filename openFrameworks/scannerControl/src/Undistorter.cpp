@@ -0,0 +1,322 @@
+//
+//  Undistorter.cpp
+//  scannerControl
+//
+//
+
+#include "Undistorter.hpp"
+#include "ParallelFor.hpp"
+#include <thread>
+#include <sys/stat.h>
+#include <utime.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define UNDISTORT_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNDISTORT_NEON
+#endif
+
+static const uint32_t lutVersion = 1;
+static const int tileSize = 64;
+
+// FNV-1a 64
+static uint64_t hashString(const string& id){
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i=0; i<id.size(); i++){
+        hash ^= (unsigned char)id[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static string coefficientString(const TurntableGeometry& g){
+
+    return ofToString(g.k1, 9) + "|" + ofToString(g.k2, 9) + "|" + ofToString(g.k3, 9) + "|" + ofToString(g.p1, 9) + "|" + ofToString(g.p2, 9);
+}
+
+// one RGB pixel from its 2 x 2 source neighbourhood, weights out of 128: rows first, then columns,
+// rounded once at the end - SIMD versions give the same bytes
+static inline void bilinearScalar(const uint8_t* p, size_t stride, int fx, int fy, int channels, uint8_t* out){
+
+    for (int c=0; c<channels; c++){
+        int left = p[c] * (128 - fy) + p[stride + c] * fy;
+        int right = p[channels + c] * (128 - fy) + p[stride + channels + c] * fy;
+        out[c] = (left * (128 - fx) + right * fx + 8192) >> 14;
+    }
+}
+
+#if defined(UNDISTORT_SSE2)
+static inline void bilinearRgb(const uint8_t* p, size_t stride, int fx, int fy, uint8_t* out){
+
+    // 8 byte loads hold both pixels of a row (+ 2 unused bytes)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), zero);
+    __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + stride)), zero);
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(top, _mm_set1_epi16(128 - fy)), _mm_mullo_epi16(bottom, _mm_set1_epi16(fy))); // <= 32640
+
+    // left + right channel side by side, one madd per channel
+    __m128i lr = _mm_unpacklo_epi16(v, _mm_srli_si128(v, 6));
+    __m128i h = _mm_madd_epi16(lr, _mm_set1_epi32((fx << 16) | (128 - fx)));
+    h = _mm_srai_epi32(_mm_add_epi32(h, _mm_set1_epi32(8192)), 14);
+    h = _mm_packus_epi16(_mm_packs_epi32(h, zero), zero);
+    uint32_t rgb = _mm_cvtsi128_si32(h);
+    memcpy(out, &rgb, 3);
+}
+#elif defined(UNDISTORT_NEON)
+static inline void bilinearRgb(const uint8_t* p, size_t stride, int fx, int fy, uint8_t* out){
+
+    uint16x8_t v = vmlal_u8(vmull_u8(vld1_u8(p), vdup_n_u8(128 - fy)), vld1_u8(p + stride), vdup_n_u8(fy));
+    uint16x4_t left = vget_low_u16(v);
+    uint16x4_t right = vget_low_u16(vextq_u16(v, v, 3));
+    uint16x4_t h = vrshrn_n_u32(vmlal_n_u16(vmull_n_u16(left, 128 - fx), right, fx), 14);
+    uint32_t rgb = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(h, h))), 0);
+    memcpy(out, &rgb, 3);
+}
+#else
+static inline void bilinearRgb(const uint8_t* p, size_t stride, int fx, int fy, uint8_t* out){
+
+    bilinearScalar(p, stride, fx, fy, 3, out);
+}
+#endif
+
+bool Undistorter::setup(string cacheDir){
+
+    string path = ofToDataPath(cacheDir, true);
+    if (!ofDirectory::doesDirectoryExist(path, false) && !ofDirectory::createDirectory(path, false, true)){
+        ofLogError("Undistorter") << "can't create cache dir: " << path;
+        dir = "";
+        return false;
+    }
+    dir = path;
+    return true;
+}
+
+void Undistorter::setGeometry(const TurntableGeometry& geom){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    geometry = geom;
+    luts.clear(); // workers still remapping hold their own reference
+}
+
+bool Undistorter::isEnabled(){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return geometry.hasDistortion();
+}
+
+uint64_t Undistorter::getModelKey(){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!geometry.hasDistortion()) return 0;
+    // focal length at one reference width stands for every decode size
+    return hashString(ofToString(lutVersion) + "|" + ofToString(geometry.getFocalPx(1000), 6) + "|" + coefficientString(geometry));
+}
+
+bool Undistorter::apply(ofPixels& pixels, int numThreads){
+
+    int channels = pixels.getNumChannels();
+    if (!pixels.isAllocated() || (channels != 1 && channels != 3)) return false;
+    int w = pixels.getWidth();
+    int h = pixels.getHeight();
+    if (w < 2 || h < 2) return false;
+
+    shared_ptr<const Lut> lut = getLut(w, h);
+    if (lut == NULL) return false;
+
+    ofPixels out;
+    out.allocate(w, h, pixels.getPixelFormat());
+    const uint8_t* src = pixels.getData();
+    uint8_t* dst = out.getData();
+    size_t stride = (size_t)w * channels;
+    size_t simdEnd = pixels.getTotalBytes() - stride - 8; // 8 byte loads of the bottom row stay inside past this
+
+    int tilesX = (w + tileSize - 1) / tileSize;
+    int tilesY = (h + tileSize - 1) / tileSize;
+    parallelFor(tilesX * tilesY, [&](int begin, int end, int worker){
+        for (int t=begin; t<end; t++){
+            int x0 = (t % tilesX) * tileSize, x1 = min(x0 + tileSize, w);
+            int y0 = (t / tilesX) * tileSize, y1 = min(y0 + tileSize, h);
+            for (int y=y0; y<y1; y++){
+                size_t i = (size_t)y * w + x0;
+                const uint32_t* index = lut->index + i;
+                const uint8_t* weights = lut->weights + i * 2;
+                uint8_t* o = dst + i * channels;
+                for (int x=x0; x<x1; x++, index++, weights += 2, o += channels){
+                    if (*index == noSource) {
+                        memset(o, 0, channels);
+                        continue;
+                    }
+                    size_t offset = (size_t)*index * channels;
+                    if (channels == 3 && offset <= simdEnd) bilinearRgb(src + offset, stride, weights[0], weights[1], o);
+                    else bilinearScalar(src + offset, stride, weights[0], weights[1], channels, o);
+                }
+            }
+        }
+    }, numThreads, 1);
+
+    pixels = std::move(out);
+    return true;
+}
+
+
+// PRIVATE
+
+
+shared_ptr<const Undistorter::Lut> Undistorter::getLut(int width, int height){
+
+    // held while building: other workers wait for the first image instead of building the same table
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!geometry.hasDistortion()) return NULL;
+
+    auto it = luts.find(make_pair(width, height));
+    if (it != luts.end()) return it->second;
+
+    uint64_t key = getKey(width, height);
+    string path = "";
+    if (dir != "") {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.lut", (unsigned long long)key);
+        path = ofFilePath::join(dir, name);
+    }
+
+    shared_ptr<Lut> lut(new Lut());
+    uint64_t start = ofGetElapsedTimeMicros();
+    if (path != "" && loadLut(*lut, path, key)) {
+        utime(path.c_str(), NULL); // used now, pruned last
+        ofLogVerbose("Undistorter") << width << "x" << height << " table from cache";
+    }
+    else if (buildLut(*lut, width, height, path, key)) {
+        ofLogNotice("Undistorter") << "built " << width << "x" << height << " table in " << (ofGetElapsedTimeMicros() - start) / 1000 << "ms";
+        if (path != "") pruneCache();
+    }
+    else return NULL;
+
+    luts[make_pair(width, height)] = lut;
+    return lut;
+}
+
+bool Undistorter::loadLut(Lut& lut, const string& path, uint64_t key){
+
+    if (!lut.file.open(path, MappedFile::ACCESS_RANDOM)) return false; // miss, reused every image so no drop behind
+
+    const Header* h = (const Header*)lut.file.getData();
+    size_t n = lut.file.size() >= sizeof(Header) ? (size_t)h->width * h->height : 0;
+    if (n == 0 || memcmp(h->magic, "3DLU", 4) != 0 || h->version != lutVersion || h->key != key
+        || lut.file.size() != sizeof(Header) + n * 6) {
+        ofLogWarning("Undistorter") << "bad cache file, removing: " << path;
+        lut.file.close();
+        remove(path.c_str());
+        return false;
+    }
+    lut.file.willNeed(0, lut.file.size());
+    lut.width = h->width;
+    lut.height = h->height;
+    lut.index = (const uint32_t*)(lut.file.getData() + sizeof(Header));
+    lut.weights = lut.file.getData() + sizeof(Header) + n * 4;
+    return true;
+}
+
+bool Undistorter::buildLut(Lut& lut, int width, int height, const string& path, uint64_t key){
+
+    // straight into the cache file under a temp name: written once, then renamed + kept mapped
+    size_t n = (size_t)width * height;
+    size_t size = sizeof(Header) + n * 6;
+    string tmpPath = path + ".tmp" + ofToString(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    uint8_t* data = NULL;
+    if (path != "" && lut.file.create(tmpPath, size)) data = lut.file.getWritableData();
+    else {
+        if (path != "") ofLogWarning("Undistorter") << "can't write cache file: " << path;
+        lut.memory.resize(size);
+        data = &lut.memory[0];
+    }
+
+    Header* h = (Header*)data;
+    memcpy(h->magic, "3DLU", 4);
+    h->version = lutVersion;
+    h->width = width;
+    h->height = height;
+    h->key = key;
+    uint32_t* index = (uint32_t*)(data + sizeof(Header));
+    uint8_t* weights = data + sizeof(Header) + n * 4;
+    fillLut(index, weights, width, height);
+
+    if (lut.file.isOpen() && rename(tmpPath.c_str(), path.c_str()) != 0) { // still usable from the mapping
+        ofLogWarning("Undistorter") << "can't write cache file: " << path;
+        remove(tmpPath.c_str());
+    }
+    lut.width = width;
+    lut.height = height;
+    lut.index = index;
+    lut.weights = weights;
+    return true;
+}
+
+void Undistorter::fillLut(uint32_t* index, uint8_t* weights, int width, int height){
+
+    // each output (pinhole) pixel through the lens model to where it landed on the sensor
+    float f = geometry.getFocalPx(width);
+    float cx = width * 0.5f, cy = height * 0.5f;
+    float k1 = geometry.k1, k2 = geometry.k2, k3 = geometry.k3, p1 = geometry.p1, p2 = geometry.p2;
+
+    parallelFor(height, [&](int begin, int end, int worker){
+        for (int y=begin; y<end; y++){
+            for (int x=0; x<width; x++){
+                size_t i = (size_t)y * width + x;
+                float xn = (x - cx) / f, yn = (y - cy) / f;
+                float r2 = xn * xn + yn * yn;
+                float radial = 1 + r2 * (k1 + r2 * (k2 + r2 * k3));
+                float sx = (xn * radial + 2 * p1 * xn * yn + p2 * (r2 + 2 * xn * xn)) * f + cx;
+                float sy = (yn * radial + p1 * (r2 + 2 * yn * yn) + 2 * p2 * xn * yn) * f + cy;
+                if (!(sx > -0.5f && sy > -0.5f && sx < width - 0.5f && sy < height - 0.5f)) { // also NaN from a wild model
+                    index[i] = noSource;
+                    weights[i*2] = weights[i*2+1] = 0;
+                    continue;
+                }
+                sx = ofClamp(sx, 0.0f, width - 1.0f);
+                sy = ofClamp(sy, 0.0f, height - 1.0f);
+                int ix = min((int)sx, width - 2); // right / bottom edge: weight 128 on the last pixel
+                int iy = min((int)sy, height - 2);
+                index[i] = (uint32_t)iy * width + ix;
+                weights[i*2] = (uint8_t)lroundf((sx - ix) * 128);
+                weights[i*2+1] = (uint8_t)lroundf((sy - iy) * 128);
+            }
+        }
+    }, 0, 16);
+}
+
+uint64_t Undistorter::getKey(int width, int height){
+
+    // everything the table depends on
+    return hashString(ofToString(lutVersion) + "|" + ofToString(width) + "x" + ofToString(height) + "|" + ofToString(geometry.getFocalPx(width), 6) + "|" + coefficientString(geometry));
+}
+
+void Undistorter::pruneCache(){
+
+    // a cache hit touches its file, so mtime order is use order
+    ofDirectory d(dir);
+    d.allowExt("lut");
+    d.listDir();
+    vector<pair<int64_t, string> > tables;
+    for (int i=0; i<d.size(); i++){
+        struct stat st;
+        if (stat(d.getPath(i).c_str(), &st) == 0) tables.push_back(make_pair((int64_t)st.st_mtime, d.getPath(i)));
+    }
+    if ((int)tables.size() <= maxCached) return;
+    sort(tables.rbegin(), tables.rend()); // newest first
+    for (int i=maxCached; i<tables.size(); i++) remove(tables[i].second.c_str()); // still mapped ones stay valid until unmapped
+    ofLogVerbose("Undistorter") << "removed " << tables.size() - maxCached << " old tables from " << dir;
+}
+
+string getUndistortImpl(){
+
+#if defined(UNDISTORT_SSE2)
+    return "sse2";
+#elif defined(UNDISTORT_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
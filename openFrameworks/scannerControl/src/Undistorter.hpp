@@ -0,0 +1,68 @@
+//
+//  Undistorter.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include "MappedFile.hpp"
+#include "TurntableGeometry.hpp"
+
+// lens distortion taken out of decoded images, so masks, hull + features all see the pinhole camera
+// TurntableView assumes (same size, focal length + centre). Per image size a remap table is built once
+// from the rig's coefficients: for every output pixel the top left source pixel + 7 bit bilinear weights
+// (6 bytes / pixel), no polynomial per frame. Tables live in a cache dir as files named by a hash of
+// coefficients + focal length + size and are memory mapped, so later sessions (and every image after
+// the first) only pay the remap - in 64 x 64 tiles (source reads stay in cache), SSE2 / NEON bilinear.
+// apply() is safe from any thread (DecodePool workers)
+
+class Undistorter {
+
+public:
+
+    bool setup(string cacheDir = "lut_cache"); // relative to data/, created if needed - tables kept in memory only if it can't be
+    void setMaxCached(int n) { maxCached = n; } // tables kept in the cache dir, most recently used first
+    void setGeometry(const TurntableGeometry& geom); // tables of the previous coefficients are dropped
+    bool isEnabled(); // geometry has distortion coefficients
+    uint64_t getModelKey(); // hash of focal length + coefficients, 0 if disabled - stored with outputs made from undistorted images, so they're redone when it changes
+
+    bool apply(ofPixels& pixels, int numThreads = 1); // replaced by the undistorted image, false if disabled / not 1 or 3 channels. numThreads: tiles on parallelFor (0: all cores)
+
+
+private:
+
+    struct Lut {
+        int width = 0;
+        int height = 0;
+        const uint32_t* index = NULL; // top left source pixel, noSource: outside the image (black)
+        const uint8_t* weights = NULL; // x, y weight of right / bottom pixels (0 - 128) per output pixel
+        MappedFile file; // cache file the table lives in
+        vector<uint8_t> memory; // or this, if there's no cache
+    };
+
+    struct Header {
+        char magic[4]; // "3DLU"
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint64_t key; // getKey(), a file under the wrong name is never used
+    };
+
+    shared_ptr<const Lut> getLut(int width, int height); // mapped from cache or built, under mutex
+    bool loadLut(Lut& lut, const string& path, uint64_t key);
+    bool buildLut(Lut& lut, int width, int height, const string& path, uint64_t key); // into the cache file if possible
+    void fillLut(uint32_t* index, uint8_t* weights, int width, int height); // on all cores
+    uint64_t getKey(int width, int height);
+    void pruneCache(); // oldest tables out past maxCached, under mutex
+
+    static const uint32_t noSource = 0xFFFFFFFF;
+
+    string dir = "";
+    int maxCached = 8;
+    TurntableGeometry geometry;
+    std::mutex mutex;
+    map<pair<int, int>, shared_ptr<const Lut> > luts; // by image size
+};
+
+string getUndistortImpl(); // "sse2", "neon" or "scalar"
@@ -0,0 +1,315 @@
+//
+//  VisualHull.cpp
+//  scannerControl
+//
+//
+
+#include "VisualHull.hpp"
+#include "ParallelFor.hpp"
+#include <cfloat>
+
+static const int topCells = 8; // per side at the top level, splits from there
+static const int maxBatch = 64; // views per pass, one bit each
+
+void VisualHull::setup(){
+
+    close();
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+        bStop = false;
+        pendingGeometry = geometry;
+        bReset = true;
+    }
+    carveThread = std::thread(&VisualHull::carveLoop, this);
+}
+
+void VisualHull::close(){
+
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+        bStop = true;
+    }
+    viewCond.notify_all();
+    if (carveThread.joinable()) carveThread.join();
+}
+
+void VisualHull::setGeometry(const TurntableGeometry& geom){
+
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+        pendingGeometry = geom;
+    }
+    clear();
+}
+
+void VisualHull::addView(const string& maskPath, float tableRadians){
+
+    View view;
+    view.maskPath = maskPath;
+    view.angle = tableRadians;
+    numPending++;
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+        newViews.push_back(std::move(view));
+    }
+    viewCond.notify_one();
+}
+
+void VisualHull::clear(){
+
+    {
+        std::lock_guard<std::mutex> lock(viewMutex);
+        numPending -= newViews.size();
+        newViews.clear();
+        generation++; // batch being carved is dropped
+        bReset = true;
+    }
+    viewCond.notify_one();
+}
+
+bool VisualHull::update(){
+
+    int version = gridVersion;
+    if (version == seenVersion) return false;
+    seenVersion = version;
+    return true;
+}
+
+
+// PRIVATE
+
+
+void VisualHull::carveLoop(){
+
+    while (true){
+
+        vector<View> batch;
+        bool reset = false;
+        int gen;
+        {
+            std::unique_lock<std::mutex> lock(viewMutex);
+            viewCond.wait(lock, [this]{ return bStop || bReset || !newViews.empty(); });
+            if (bStop) return;
+            if (bReset) {
+                geometry = pendingGeometry;
+                reset = true;
+                bReset = false;
+            }
+            while (!newViews.empty() && batch.size() < maxBatch){ // everything landed meanwhile, in one pass
+                batch.push_back(std::move(newViews.front()));
+                newViews.pop_front();
+            }
+            gen = generation;
+        }
+
+        if (reset) {
+            resetCells();
+            numCarved = 0;
+            publish(0);
+        }
+        if (batch.empty()) continue;
+
+        uint64_t start = ofGetElapsedTimeMicros();
+        int numBatched = batch.size();
+
+        // masks -> summed area tables, one view per thread
+        vector<uint8_t> loaded(batch.size(), 0);
+        parallelFor(batch.size(), [&](int begin, int end, int worker){
+            for (int i=begin; i<end; i++) loaded[i] = loadView(batch[i]);
+        }, 0, 1);
+        vector<View> views;
+        for (int i=0; i<batch.size(); i++){
+            if (loaded[i]) views.push_back(std::move(batch[i]));
+        }
+        batch.clear();
+
+        carve(views);
+        numCarved += views.size();
+        numPending -= numBatched;
+        lastCarveMs = (ofGetElapsedTimeMicros() - start) / 1000.0f;
+
+        {
+            std::lock_guard<std::mutex> lock(viewMutex);
+            if (gen != generation) continue; // cleared while carving, reset comes next
+        }
+        publish(numCarved);
+        ofLogVerbose("VisualHull") << views.size() << " views carved in " << lastCarveMs << "ms, " << numCarved << " total, " << numVoxels << " voxels";
+    }
+}
+
+bool VisualHull::loadView(View& view){
+
+    ofPixels mask;
+    if (!ofLoadImage(mask, view.maskPath) || mask.getWidth() < 1 || mask.getHeight() < 1) {
+        ofLogError("VisualHull") << "can't load mask: " << view.maskPath;
+        return false;
+    }
+    int w = mask.getWidth();
+    int h = mask.getHeight();
+    int stride = mask.getNumChannels();
+    view.cam.setup(geometry, view.angle, w, h);
+
+    // sat[(y+1) * (w+1) + x+1] = # object pixels in [0, x] x [0, y]
+    int sw = w + 1;
+    view.sat.assign((size_t)sw * (h + 1), 0);
+    const uint8_t* src = mask.getData();
+    for (int y=0; y<h; y++){
+        const uint8_t* row = src + (size_t)y * w * stride;
+        const uint32_t* above = &view.sat[(size_t)y * sw];
+        uint32_t* out = &view.sat[(size_t)(y+1) * sw];
+        uint32_t sum = 0;
+        for (int x=0; x<w; x++){
+            sum += row[x * stride] > 127;
+            out[x+1] = above[x+1] + sum;
+        }
+    }
+    return true;
+}
+
+void VisualHull::carve(vector<View>& views){
+
+    if (views.empty()) return;
+    uint64_t all = views.size() >= 64 ? ~0ULL : (1ULL << views.size()) - 1;
+
+    // cells in, surviving (split) cells out per worker - cells never overlap, so no merging needed
+    vector<vector<Cell> > out(parallelThreads());
+    parallelFor(cells.size(), [&](int begin, int end, int worker){
+        for (int i=begin; i<end; i++) carveCell(cells[i], all, views, out[worker]);
+    }, out.size(), 32);
+
+    size_t total = 0;
+    for (int i=0; i<out.size(); i++) total += out[i].size();
+    cells.clear();
+    cells.reserve(total);
+    for (int i=0; i<out.size(); i++) cells.insert(cells.end(), out[i].begin(), out[i].end());
+}
+
+void VisualHull::carveCell(const Cell& cell, uint64_t viewMask, const vector<View>& views, vector<Cell>& out) const{
+
+    // only views the parent was partly in matter, it was fully inside the rest
+    uint64_t partial = 0;
+    for (int i=0; i<views.size(); i++){
+        if (!(viewMask & (1ULL << i))) continue;
+        int state = classify(cell, views[i]);
+        if (state == CELL_OUT) return;
+        if (state == CELL_PARTIAL) partial |= 1ULL << i;
+    }
+    if (partial == 0) {
+        out.push_back(cell);
+        return;
+    }
+
+    Cell child;
+    child.level = cell.level - 1;
+    uint16_t half = 1 << child.level;
+    for (int i=0; i<8; i++){
+        child.x = cell.x + ((i & 1) ? half : 0);
+        child.y = cell.y + ((i & 2) ? half : 0);
+        child.z = cell.z + ((i & 4) ? half : 0);
+        carveCell(child, partial, views, out);
+    }
+}
+
+int VisualHull::classify(const Cell& cell, const View& view) const{
+
+    const TurntableView& cam = view.cam;
+    int w = cam.width;
+    int h = cam.height;
+    int sw = w + 1;
+    const uint32_t* sat = &view.sat[0];
+
+    if (cell.level == 0) { // leaf: centre pixel decides
+        float u, v;
+        if (!cam.project(origin.x + (cell.x + 0.5f) * voxelSize, origin.y + (cell.y + 0.5f) * voxelSize, origin.z + (cell.z + 0.5f) * voxelSize, &u, &v)) return CELL_OUT;
+        int x = (int)floor(u);
+        int y = (int)floor(v);
+        if (x < 0 || y < 0 || x >= w || y >= h) return CELL_OUT; // object is assumed in frame
+        uint32_t px = sat[(y+1)*sw + x+1] - sat[y*sw + x+1] - sat[(y+1)*sw + x] + sat[y*sw + x];
+        return px ? CELL_IN : CELL_OUT;
+    }
+
+    // projected box of the cell's corners covers its whole footprint
+    float size = (1 << cell.level) * voxelSize;
+    float x0 = origin.x + cell.x * voxelSize;
+    float y0 = origin.y + cell.y * voxelSize;
+    float z0 = origin.z + cell.z * voxelSize;
+    float umin = FLT_MAX, vmin = FLT_MAX, umax = -FLT_MAX, vmax = -FLT_MAX;
+    for (int i=0; i<8; i++){
+        float u, v;
+        if (!cam.project(x0 + ((i & 1) ? size : 0), y0 + ((i & 2) ? size : 0), z0 + ((i & 4) ? size : 0), &u, &v)) return CELL_PARTIAL; // straddles the camera, let children decide
+        umin = min(umin, u); umax = max(umax, u);
+        vmin = min(vmin, v); vmax = max(vmax, v);
+    }
+    int px0 = (int)floor(umin), px1 = (int)ceil(umax);
+    int py0 = (int)floor(vmin), py1 = (int)ceil(vmax);
+    int cx0 = ofClamp(px0, 0, w), cx1 = ofClamp(px1, 0, w);
+    int cy0 = ofClamp(py0, 0, h), cy1 = ofClamp(py1, 0, h);
+    if (cx0 >= cx1 || cy0 >= cy1) return CELL_OUT; // out of frame
+
+    uint32_t sum = sat[cy1*sw + cx1] - sat[cy0*sw + cx1] - sat[cy1*sw + cx0] + sat[cy0*sw + cx0];
+    if (sum == 0) return CELL_OUT;
+    bool clipped = cx0 != px0 || cx1 != px1 || cy0 != py0 || cy1 != py1;
+    if (!clipped && sum == (uint32_t)(cx1 - cx0) * (cy1 - cy0)) return CELL_IN;
+    return CELL_PARTIAL;
+}
+
+void VisualHull::resetCells(){
+
+    n = geometry.resolution;
+    voxelSize = geometry.volumeSize / n;
+    origin = ofVec3f(-geometry.volumeSize * 0.5f, -geometry.volumeSize * 0.5f, 0);
+    topLevel = 0;
+    while ((topCells << topLevel) < n) topLevel++;
+
+    cells.clear();
+    Cell c;
+    c.level = topLevel;
+    for (int z=0; z<topCells; z++){
+        for (int y=0; y<topCells; y++){
+            for (int x=0; x<topCells; x++){
+                c.x = x << topLevel;
+                c.y = y << topLevel;
+                c.z = z << topLevel;
+                cells.push_back(c);
+            }
+        }
+    }
+}
+
+void VisualHull::publish(int numViewsCarved){
+
+    shared_ptr<Grid> g(new Grid());
+    g->n = n;
+    g->voxelSize = voxelSize;
+    g->origin = origin;
+    g->numViews = numViewsCarved;
+    g->occupied.assign((size_t)n * n * n, 0);
+
+    // cells are disjoint, each fills its own block
+    std::atomic<int> count { 0 };
+    uint8_t* occ = &g->occupied[0];
+    parallelFor(cells.size(), [&](int begin, int end, int worker){
+        int local = 0;
+        for (int i=begin; i<end; i++){
+            const Cell& c = cells[i];
+            int side = 1 << c.level;
+            for (int z=c.z; z<c.z+side; z++){
+                for (int y=c.y; y<c.y+side; y++){
+                    memset(occ + ((size_t)z * n + y) * n + c.x, 1, side);
+                }
+            }
+            local += side * side * side;
+        }
+        count += local;
+    }, 0, 256);
+    g->numVoxels = count;
+    g->version = gridVersion + 1;
+
+    numViews = numViewsCarved;
+    numVoxels = g->numVoxels;
+    {
+        std::lock_guard<std::mutex> lock(gridMutex);
+        grid = g;
+    }
+    gridVersion++;
+}
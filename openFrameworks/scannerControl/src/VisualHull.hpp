@@ -0,0 +1,108 @@
+//
+//  VisualHull.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+#include "TurntableGeometry.hpp"
+
+// object shape carved from its silhouettes: every voxel that projects onto background in any shot
+// is removed. Carved on own thread as each masked shot arrives, so the hull is done moments after
+// the last mask
+//
+// sparse octree kept as a flat list of occupied cells: a cell is only split where some shot sees
+// it partly on the object, so each shot costs ~ the hull's surface, not the grid. Cells are
+// tested against a shot via their projected bounding box in a summed area table of its mask
+// (O(1) whatever the cell size), leaf voxels by their centre. Cells fully inside every shot so far
+// stay whole - a new shot only ever needs its own mask. Shots arriving together are carved in one
+// pass, cells spread across all cores with work stealing (see parallelFor)
+
+class VisualHull {
+
+public:
+
+    // occupancy snapshot, n^3 voxels of voxelSize mm, x fastest - origin is the corner voxel's corner
+    struct Grid {
+        int n = 0;
+        float voxelSize = 0;
+        ofVec3f origin;
+        vector<uint8_t> occupied; // 1: inside hull
+        int numViews = 0;
+        int numVoxels = 0;
+        int version = 0; // bumped by each carve
+    };
+
+    VisualHull(){}
+    ~VisualHull() { close(); }
+
+    void setup(); // starts carve thread
+    void close();
+
+    void setGeometry(const TurntableGeometry& geom); // also resets the hull
+    void addView(const string& maskPath, float tableRadians); // gray mask (0 background), any size
+    void clear(); // back to the full volume, views in flight dropped
+
+    bool update(); // main thread, true when a new snapshot is ready
+    shared_ptr<const Grid> getGrid() { std::lock_guard<std::mutex> lock(gridMutex); return grid; } // latest snapshot, never changes once handed out
+    int getNumPending() { return numPending; } // views queued + carving
+    int getNumViews() { return numViews; }
+    int getNumVoxels() { return numVoxels; }
+    float getLastCarveMs() { return lastCarveMs; }
+
+
+private:
+
+    struct Cell {
+        uint16_t x, y, z; // leaf voxel coords of its min corner
+        uint8_t level; // side 2^level voxels, 0: leaf
+    };
+
+    struct View {
+        string maskPath;
+        float angle = 0;
+        TurntableView cam;
+        vector<uint32_t> sat; // summed area table of mask (1 per object pixel), (w+1) x (h+1)
+    };
+
+    enum { CELL_OUT, CELL_IN, CELL_PARTIAL };
+
+    void carveLoop(); // carve thread
+    bool loadView(View& view); // mask -> summed area table
+    void carve(vector<View>& views); // one pass over all cells for a batch of views
+    void carveCell(const Cell& cell, uint64_t viewMask, const vector<View>& views, vector<Cell>& out) const; // recursive
+    int classify(const Cell& cell, const View& view) const;
+    void resetCells(); // top level cells covering the volume
+    void publish(int numViewsCarved); // cells -> occupancy snapshot
+
+    std::thread carveThread;
+    bool bStop = false; // guarded by viewMutex
+
+    TurntableGeometry geometry; // carve thread only, set via pending*
+    int n = 0; // leaf voxels per side
+    int topLevel = 0;
+    float voxelSize = 0;
+    ofVec3f origin;
+    vector<Cell> cells; // occupied, carve thread only
+    int numCarved = 0; // views carved into cells
+
+    std::mutex viewMutex; // guards everything below up to the snapshot
+    std::condition_variable viewCond;
+    deque<View> newViews;
+    TurntableGeometry pendingGeometry;
+    bool bReset = false; // geometry changed / cleared, applied by the carve thread before the next view
+    int generation = 0;
+
+    std::mutex gridMutex;
+    shared_ptr<const Grid> grid;
+    std::atomic<int> gridVersion { 0 };
+    int seenVersion = 0;
+
+    std::atomic<int> numPending { 0 };
+    std::atomic<int> numViews { 0 };
+    std::atomic<int> numVoxels { 0 };
+    std::atomic<float> lastCarveMs { 0 };
+};
@@ -0,0 +1,284 @@
+//
+//  WatchFolder.cpp
+//  scannerControl
+//
+//
+
+#include "WatchFolder.hpp"
+#include <sys/stat.h>
+
+#ifdef TARGET_LINUX
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+bool WatchFolder::setup(string dirPath, vector<string> extensions){
+
+    close();
+
+    ofDirectory dir(dirPath);
+    if (!dir.isDirectory()){
+        ofLogError("WatchFolder") << "not a directory: " << dirPath;
+        return false;
+    }
+    path = dir.getAbsolutePath();
+
+    exts.clear();
+    for (int i=0; i<extensions.size(); i++) exts.push_back(ofToLower(extensions[i]));
+
+#ifdef TARGET_LINUX
+    // add the watch before listing, so nothing landing in between is missed (index drops duplicates)
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0 || inotify_add_watch(inotifyFd, path.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0){
+        ofLogWarning("WatchFolder") << "inotify unavailable (" << strerror(errno) << "), polling " << path;
+        if (inotifyFd >= 0) ::close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+
+    bListingExisting = true;
+    rescan(); // existing files queued as FILE_ADDED, in sorted order
+    bListingExisting = false;
+
+    bStop = false;
+    watchThread = std::thread(&WatchFolder::watchLoop, this);
+    watching = true;
+
+    ofLogVerbose("WatchFolder") << "watching " << path << " (" << getNumFiles() << " files)";
+    return true;
+}
+
+void WatchFolder::close(){
+
+    bStop = true;
+    if (watchThread.joinable()) watchThread.join();
+    watching = false;
+    movedFrom.clear();
+    lastListed.clear();
+    queuedStamps.clear();
+
+#ifdef TARGET_LINUX
+    if (inotifyFd >= 0) ::close(inotifyFd); // also removes the watch
+    inotifyFd = -1;
+#endif
+
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    events.clear();
+    numEvents = 0;
+}
+
+bool WatchFolder::getNextEvent(Event& e){
+
+    if (numEvents == 0) return false; // common case, no lock
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.empty()) return false;
+    e = events.front();
+    events.pop_front();
+    numEvents--;
+    return true;
+}
+
+vector<string> WatchFolder::getFiles(){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return vector<string>(index.begin(), index.end());
+}
+
+int WatchFolder::getNumFiles(){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+
+// PRIVATE
+
+
+void WatchFolder::watchLoop(){
+
+#ifdef TARGET_LINUX
+    if (inotifyFd >= 0){
+
+        // buffer aligned for inotify_event, holds many events per read
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+        while (!bStop){
+
+            pollfd pfd = { inotifyFd, POLLIN, 0 };
+            if (poll(&pfd, 1, 100) <= 0) { // timeout so close() doesn't hang
+                // quiet for a bit and still unpaired: moved out of the folder (or to an ignored name)
+                for (map<uint32_t, string>::iterator it = movedFrom.begin(); it != movedFrom.end(); ++it) fileRemoved(it->second);
+                movedFrom.clear();
+                continue;
+            }
+
+            ssize_t len = read(inotifyFd, buf, sizeof(buf));
+            if (len <= 0) continue;
+
+            for (char* p = buf; p < buf + len; ){
+                const struct inotify_event* ev = (const struct inotify_event*)p;
+                p += sizeof(struct inotify_event) + ev->len;
+
+                if (ev->mask & IN_Q_OVERFLOW){ // kernel dropped events, resync from listing
+                    ofLogWarning("WatchFolder") << "event queue overflow, rescanning " << path;
+                    movedFrom.clear();
+                    rescan();
+                    continue;
+                }
+                if (ev->len == 0 || !hasAllowedExt(ev->name)) continue;
+
+                string filePath = ofFilePath::join(path, ev->name);
+                if (ev->mask & IN_MOVED_FROM) movedFrom[ev->cookie] = filePath; // rename if its IN_MOVED_TO follows
+                else if (ev->mask & IN_MOVED_TO) {
+                    map<uint32_t, string>::iterator from = movedFrom.find(ev->cookie);
+                    if (from != movedFrom.end()) {
+                        fileRenamed(from->second, filePath);
+                        movedFrom.erase(from);
+                    }
+                    else fileWritten(filePath); // moved in whole
+                }
+                else if (ev->mask & IN_CLOSE_WRITE) fileWritten(filePath); // written + closed
+                else if (ev->mask & IN_DELETE) fileRemoved(filePath);
+            }
+        }
+        return;
+    }
+#endif
+
+    // fallback: relist on this thread, app thread still only sees events
+    while (!bStop){
+        float start = ofGetElapsedTimef();
+        while (!bStop && ofGetElapsedTimef() - start < pollInterval) ofSleepMillis(20);
+        if (!bStop) rescan(true); // no close event to go by, wait for files to stop changing
+    }
+}
+
+bool WatchFolder::hasAllowedExt(const string& name){
+
+    if (exts.empty()) return true;
+    if (name.size() > 0 && name[0] == '.') return false; // hidden / temp files
+    string ext = ofToLower(ofFilePath::getFileExt(name));
+    for (int i=0; i<exts.size(); i++){
+        if (ext == exts[i]) return true;
+    }
+    return false;
+}
+
+void WatchFolder::fileAdded(const string& filePath){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!index.insert(filePath).second) return; // already indexed (e.g. rewritten in place)
+    events.push_back(Event{ FILE_ADDED, filePath, "", bListingExisting });
+    numEvents++;
+}
+
+void WatchFolder::fileChanged(const string& filePath){
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index.insert(filePath).second) { // wasn't indexed after all, just new
+        events.push_back(Event{ FILE_ADDED, filePath, "" });
+        numEvents++;
+        return;
+    }
+    events.push_back(Event{ FILE_REMOVED, filePath, "" });
+    events.push_back(Event{ FILE_ADDED, filePath, "" });
+    numEvents += 2;
+}
+
+void WatchFolder::fileWritten(const string& filePath){
+
+    // a listing may have indexed it while still being written, or it was rewritten in place since
+    struct stat st;
+    if (stat(filePath.c_str(), &st) != 0) return; // gone again, its delete follows
+    Stamp stamp;
+    stamp.size = st.st_size;
+    stamp.mtime = st.st_mtime;
+    map<string, Stamp>::iterator queued = queuedStamps.find(filePath);
+    if (queued != queuedStamps.end() && queued->second == stamp) return; // queued complete already (landed while setup() listed)
+    queuedStamps[filePath] = stamp;
+    fileChanged(filePath);
+}
+
+void WatchFolder::fileRemoved(const string& filePath){
+
+    queuedStamps.erase(filePath);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index.erase(filePath) == 0) return;
+    events.push_back(Event{ FILE_REMOVED, filePath, "" });
+    numEvents++;
+}
+
+void WatchFolder::fileRenamed(const string& oldPath, const string& newPath){
+
+    queuedStamps.erase(oldPath);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index.erase(oldPath) == 0) { // wasn't indexed, treat as new
+        if (index.insert(newPath).second) {
+            events.push_back(Event{ FILE_ADDED, newPath, "" });
+            numEvents++;
+        }
+        return;
+    }
+    if (!index.insert(newPath).second) { // replaced an indexed file: old one's gone, new name's contents changed
+        events.push_back(Event{ FILE_REMOVED, newPath, "" });
+        events.push_back(Event{ FILE_ADDED, newPath, "" });
+        events.push_back(Event{ FILE_REMOVED, oldPath, "" });
+        numEvents += 3;
+        return;
+    }
+    events.push_back(Event{ FILE_RENAMED, newPath, oldPath });
+    numEvents++;
+}
+
+void WatchFolder::rescan(bool settle){
+
+    map<string, Stamp> listed = listFolder();
+
+    // diff both ways, so adds + deletes between scans are both caught
+    vector<string> removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (set<string>::iterator it = index.begin(); it != index.end(); ++it){
+            if (listed.find(*it) == listed.end()) removed.push_back(*it);
+        }
+    }
+    for (int i=0; i<removed.size(); i++) fileRemoved(removed[i]);
+
+    for (map<string, Stamp>::iterator it = listed.begin(); it != listed.end(); ++it){
+        if (settle) { // still being written if it grew / was touched since the last listing
+            map<string, Stamp>::iterator last = lastListed.find(it->first);
+            if (last == lastListed.end() || !(last->second == it->second)) continue;
+        }
+        map<string, Stamp>::iterator queued = queuedStamps.find(it->first);
+        if (queued == queuedStamps.end()) {
+            queuedStamps[it->first] = it->second;
+            fileAdded(it->first);
+        }
+        else if (!(queued->second == it->second)) { // indexed while incomplete, or rewritten since
+            queued->second = it->second;
+            fileChanged(it->first);
+        }
+    }
+    lastListed = listed;
+}
+
+map<string, WatchFolder::Stamp> WatchFolder::listFolder(){
+
+    map<string, Stamp> listed;
+    ofDirectory dir(path);
+    dir.listDir();
+    for (int i=0; i<dir.size(); i++){
+        string name = dir.getName(i);
+        if (dir.getFile(i).isDirectory() || !hasAllowedExt(name)) continue;
+        string filePath = ofFilePath::join(path, name);
+        struct stat st;
+        if (stat(filePath.c_str(), &st) != 0) continue; // gone since listing
+        Stamp& stamp = listed[filePath];
+        stamp.size = st.st_size;
+        stamp.mtime = st.st_mtime;
+    }
+    return listed;
+}
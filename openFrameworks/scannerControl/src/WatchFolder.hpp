@@ -0,0 +1,89 @@
+//
+//  WatchFolder.hpp
+//  scannerControl
+//
+//
+
+#pragma once
+#include "ofMain.h"
+#include <thread>
+#include <atomic>
+
+// watches a folder on a background thread, keeps a sorted index of its files
+// and queues add/remove/rename events for the app - nothing to do on the app side when nothing changed
+//   linux: inotify (IN_CLOSE_WRITE / IN_MOVED_TO / IN_DELETE / IN_MOVED_FROM), so files are complete when added,
+//          moves within the folder paired by cookie into renames, a file the initial / overflow listing caught
+//          mid-write (or one rewritten in place) is re-queued (remove + add) when it closes
+//   other: relists folder every pollInterval on the watch thread (renames show up as remove + add), a file is only
+//          added once its size + mtime held still for a poll, and re-queued (remove + add) if they change after
+
+class WatchFolder {
+
+public:
+
+    enum EventType {
+        FILE_ADDED,
+        FILE_REMOVED,
+        FILE_RENAMED
+    };
+
+    struct Event {
+        EventType type;
+        string path; // absolute
+        string oldPath; // FILE_RENAMED only
+        bool existing; // FILE_ADDED from the listing setup() starts with: on disk before watching, not a new arrival
+    };
+
+    WatchFolder(){}
+    ~WatchFolder() { close(); }
+
+    bool setup(string dirPath, vector<string> extensions); // starts watching, queues FILE_ADDED for existing files
+    void close(); // stop watching, clear index + events
+    bool isWatching() { return watching; }
+
+    bool getNextEvent(Event& e); // main thread - false if no events (no lock taken)
+    int getNumEvents() { return numEvents; }
+
+    vector<string> getFiles(); // sorted snapshot of index
+    int getNumFiles();
+    string getPath() { return path; }
+
+    void setPollInterval(float seconds) { pollInterval = seconds; } // non-inotify fallback only
+
+
+private:
+
+    void watchLoop(); // runs on watchThread
+    bool hasAllowedExt(const string& name);
+    void fileAdded(const string& filePath);
+    void fileRemoved(const string& filePath);
+    void fileRenamed(const string& oldPath, const string& newPath);
+    struct Stamp {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        bool operator==(const Stamp& o) const { return size == o.size && mtime == o.mtime; }
+    };
+
+    void fileChanged(const string& filePath); // indexed file rewritten: remove + add, so it's read again
+    void fileWritten(const string& filePath); // inotify: closed after writing / moved in - added, or changed if indexed with other contents
+    void rescan(bool settle = false); // diff a fresh listing against index. settle: only files unchanged since last rescan
+    map<string, Stamp> listFolder();
+
+    string path = "";
+    vector<string> exts; // lower case
+    float pollInterval = 0.25;
+
+    set<string> index; // sorted absolute paths, guarded by mutex
+    deque<Event> events; // guarded by mutex
+    std::atomic<int> numEvents { 0 };
+    std::mutex mutex;
+
+    std::thread watchThread;
+    std::atomic<bool> bStop { false };
+    bool watching = false;
+    int inotifyFd = -1;
+    map<uint32_t, string> movedFrom; // IN_MOVED_FROM waiting on its IN_MOVED_TO, by cookie (watch thread only)
+    map<string, Stamp> lastListed; // previous rescan's listing (watch thread only)
+    map<string, Stamp> queuedStamps; // size + mtime each file was queued with (watch thread only)
+    bool bListingExisting = false; // setup()'s rescan running, its adds are flagged existing
+};
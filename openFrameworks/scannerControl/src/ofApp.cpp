@@ -1,4 +1,6 @@
 #include "ofApp.h"
+#include <chrono>
+#include <sys/stat.h>
 
 //--------------------------------------------------------------
 void ofApp::setup(){
@@ -25,7 +27,7 @@ void ofApp::setup(){
     
     // CREATE SCANNER
     
-    scanner = Scanner(&serial); // create scanner with serial ptr
+    scanner.setSerial(&serial); // give scanner serial ptr
     
     
     // GUI
@@ -64,6 +66,8 @@ void ofApp::setup(){
     camReadyLabel = gui->addLabel("Ready to Shoot");
     clockwiseToggle = gui->addToggle("Move Table Clockwise", true);
     autoscanToggle = gui->addToggle("Start Auto-scan", false);
+    advanceToggle = gui->addToggle("Advance when Photo Lands", false);
+    reshootBlurToggle = gui->addToggle("Reshoot Blurry Shots", false);
     autoscanLabel = gui->addLabel("Auto-scan Shots Left: ");
     shutterBtn = gui->addButton("Take Shot");
     turnBtn = gui->addButton("Move one Turn");
@@ -117,6 +121,8 @@ void ofApp::setup(){
     camReadyLabel->setLabelColor(green);
     clockwiseToggle->setStripeColor(red);
     autoscanToggle->setStripeColor(red);
+    advanceToggle->setStripeColor(red);
+    reshootBlurToggle->setStripeColor(red);
     autoscanLabel->setStripeColor(red);
     shutterBtn->setStripeColor(red);
     turnBtn->setStripeColor(red);
@@ -161,6 +167,13 @@ void ofApp::setup(){
         scanner.setClockwise(clockwiseToggle->getChecked());
     });
     autoscanToggle->onToggleEvent([&](ofxDatGuiToggleEvent e){ // lamba, start/stop scanner autoscan
+        if (autoscanToggle->getChecked()) {
+            manifest.newSession(); // one session per rotation
+            hullSession = manifest.getSessionId(); // carved on its own, the object may have been moved since the last one
+            hull.clear();
+            autoscanStartTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count(); // same clock as ShutterEvent::time
+        }
+        reshoots.clear(); // new rotation, or stopped on purpose
         scanner.autoscan(autoscanToggle->getChecked());
     });
     shutterBtn->onButtonEvent([&](ofxDatGuiButtonEvent e){ // lamba, take picture
@@ -233,6 +246,17 @@ void ofApp::setup(){
     
     resizeImgAreas();
     
+    // start image decode threads
+    
+    images.setup();
+    images.setBudget(1024, 512); // MB of full res pixels / textures kept around
+    undistorter.setup(); // lens correction tables, enabled by the rig's distortion coefficients
+    masker.setUndistorter(&undistorter);
+    features.setUndistorter(&undistorter);
+    masker.setup(); // masks once a background is set ('b' key)
+    hull.setup(); // carves as masks come in
+    features.setup(); // .feat per image, ready for reconstruction when the rotation ends
+    
     // load font
     font = ofxSmartFont::add(guiTheme->font.file,8);
     
@@ -259,23 +283,85 @@ void ofApp::update(){
             // move scanner to rotation degree
             scanner.rotateTo(rotation);
         }
-        
-        // get all new output from scanner
+    }
+    
+    // get all new output from scanner (also picks up a background reconnect)
+    if (scanner.isConnected() || scanner.isReconnecting()){
         if (scanner.update() > 0) { // new data from scanner
             updateGui();
         }
+        Scanner::ShutterEvent shot;
+        while (scanner.getNextShutterEvent(shot)){ // pose at shutter, waits for its file
+            lastShutterTime = shot.time;
+            reshoots.onShutter(shot);
+            shotMatcher.addShot(shot);
+        }
+    }
+    
+    // show link state changes (e.g. lost link, reconnected)
+    if (scanner.getLinkState() != linkState){
+        linkState = scanner.getLinkState();
+        if (linkState == Scanner::LINK_RECONNECTING){
+            scannerConnectBtn->setLabel(scanner.isResumingAutoscan() ? "Reconnecting (will resume scan)..." : "Reconnecting...");
+            scannerConnectBtn->setLabelColor(ofColor::orange);
+        } else if (linkState == Scanner::LINK_CONNECTED){
+            scannerConnectBtn->setLabel("Scanner Connected");
+            scannerConnectBtn->setLabelColor(ofColor::green);
+        }
     }
     
     // check for new files in watch folder and update ofImage vector
-    if (watchFolder.exists()){
-        int nNew = loadNewImages();
+    if (watchFolder.isWatching()){
+        int nLanded = 0;
+        int nNew = loadNewImages(&nLanded);
         if (nNew > 0) {
+            // photo is on disk, don't wait out the rest of wait after shot
+            if (nLanded > 0 && advanceToggle->getChecked() && scanner.isConnected()) scanner.photoLanded();
+            
             imgIdx = images.size()-1; // set imgIdx to newest in vector
             imgSlider->setMax(images.size());
             imgSlider->setMin(1);
             imgSlider->setValue(images.size());
-            ofLogVerbose("ofApp::update") << "loaded " << nNew << " new images";
+            ofLogVerbose("ofApp::update") << "queued " << nNew << " new images";
+        }
+        recordShots();
+        reshoots.update(scanner, shotMatcher.getNumPendingShots()); // retakes gaps once rotation is done
+        // EXIF comes back with the proxies and can move images into capture order, keep showing the same ones
+        ImageStore::Handle shown, animShown;
+        if (images.size() > 0) {
+            shown = images.getHandle(min(imgIdx, images.size()-1));
+            animShown = images.getHandle(min(animFrame, images.size()-1));
+        }
+        images.update(); // decoded proxies + full res -> textures, within frame budget
+        if (images.size() > 0) {
+            int i = images.getIndex(shown);
+            if (i >= 0 && i != imgIdx) {
+                imgIdx = i;
+                imgSlider->setValue(imgIdx+1);
+            }
+            animFrame = max(images.getIndex(animShown), 0);
         }
+        matchLandedFiles();
+        if (masker.update() > 0 && masker.getNumPending() == 0) ofLogNotice("ofApp") << "all images masked";
+        updateHull();
+        if (features.update() > 0 && features.getNumPending() == 0) ofLogVerbose("ofApp") << "features up to date";
+        string featured;
+        while (features.getNextFeatures(&featured)) currentFeatures.insert(FeatureExtractor::getFeaturePath(featured));
+        if (exporter.update()) {
+            HullExporter::Stats s = exporter.getStats();
+            if (s.ok) ofLogNotice("ofApp") << "wrote " << s.path << ": " << s.mesh.numFaces << " triangles from " << s.numViews << " views (" << s.mesh.ms << "ms)";
+            else ofLogError("ofApp") << "can't write " << s.path;
+        }
+        if (matcher.update()) {
+            TurntableMatcher::Stats s = matcher.getStats();
+            ofLogNotice("ofApp") << "matched " << s.numShots << " shots: " << s.numMatches << " matches in " << s.numPairs << " pairs (" << s.ms << "ms)";
+        }
+        if (cropper.update()) {
+            RoiCropper::Stats s = cropper.getStats();
+            ofLogNotice("ofApp") << "cropped " << (s.numLossless + s.numRecompressed) << " of " << s.numImages << " images (" << s.numRecompressed << " re-encoded): "
+                << s.bytesIn / (1024 * 1024) << " -> " << s.bytesOut / (1024 * 1024) << " MB (" << s.ms << "ms)";
+        }
+        checkBlurryShots();
         // run animation
         if (ofGetElapsedTimef()-animSwitchTime >= animSwitchWait){
             bool switchAnim = true;
@@ -302,30 +388,50 @@ void ofApp::draw(){
     
     if (images.size() > 0){
         
-        // draw last image in images
-        float iW = images[imgIdx].getWidth();
-        float iH = images[imgIdx].getHeight();
-        // scale
-        if (iW >= iH){
-            iH *= imgArea.width/iW;
-            iW = imgArea.width;
+        // draw last image in images (once decoded)
+        string imgLbl = "Image: " + images.getFileName(imgIdx);
+        ofTexture* full = bShowFullRes ? images.getFull(imgIdx) : NULL; // requests decode if not resident
+        ofTexture& img = (full != NULL) ? *full : images.getProxy(imgIdx);
+        if (images.getState(imgIdx) == ImageStore::IMAGE_FAILED) imgLbl += " (decode error)";
+        else if (images.isBlurry(imgIdx)) imgLbl += " (blurry)";
+        else if (images.getPath(imgIdx) == masker.getReferencePath()) imgLbl += " (background)";
+        else if (bShowFullRes) imgLbl += (full != NULL) ? " (full res)" : " (loading full res)";
+        if (img.isAllocated()){
+            drawImage(img, imgArea, images.getMeta(imgIdx).orientation);
+            if (images.isBlurry(imgIdx)) drawBlurFrame(imgArea);
+            string exposure = images.getMeta(imgIdx).getExposureString();
+            if (exposure != "") imgLbl += "  " + exposure;
         } else {
-            iW *= imgArea.height/iH;
-            iH = imgArea.height;
+            imgLbl += " (loading)";
         }
-        images[imgIdx].draw(imgArea.getTopLeft(),iW,iH);
         
         // label
-        string imgLbl = "Image: " + loadedFiles[imgIdx].getFileName();
         font->draw(imgLbl, imgArea.getBottomLeft().x, imgArea.getBottomLeft().y+20.0);
+        if (masker.hasReference()){
+            string maskLbl = "Masks: " + (masker.getNumPending() > 0 ? ofToString(masker.getNumPending()) + " pending" : "done");
+            if (masker.getNumFailed() > 0) maskLbl += ", " + ofToString(masker.getNumFailed()) + " failed";
+            font->draw(maskLbl, imgArea.getBottomLeft().x, imgArea.getBottomLeft().y+36.0);
+        }
+        if (matcher.isBusy() || cropper.isBusy()){
+            font->draw(matcher.isBusy() ? "Matching..." : "Cropping...", imgArea.getBottomLeft().x + imgArea.width * 0.5, imgArea.getBottomLeft().y+52.0);
+        }
+        if (features.getNumPending() > 0){
+            font->draw("Features: " + ofToString(features.getNumPending()) + " pending", imgArea.getBottomLeft().x + imgArea.width * 0.5, imgArea.getBottomLeft().y+36.0);
+        }
+        if (hull.getNumViews() > 0 || hull.getNumPending() > 0){
+            string hullLbl = "Hull: " + ofToString(hull.getNumViews()) + " views, " + ofToString(hull.getNumVoxels()) + " voxels";
+            if (hull.getNumPending() > 0) hullLbl += " (" + ofToString(hull.getNumPending()) + " carving)";
+            font->draw(hullLbl, imgArea.getBottomLeft().x, imgArea.getBottomLeft().y+52.0);
+        }
         
         // draw animation
         if (animFrame < images.size()){ // safety
-            float hA = (animArea.width/images[animFrame].getWidth())*images[animFrame].getHeight();
-            images[animFrame].draw(animArea.getTopLeft(),animArea.width,hA);
+            ofTexture& frame = images.getProxy(animFrame);
+            if (frame.isAllocated()) drawImage(frame, animArea, images.getMeta(animFrame).orientation);
+            if (images.isBlurry(animFrame)) drawBlurFrame(animArea);
             
             // label
-            font->draw(loadedFiles[animFrame].getFileName(), animArea.getLeft(), animArea.getBottom()+20.0);
+            font->draw(images.getFileName(animFrame), animArea.getLeft(), animArea.getBottom()+20.0);
             string animFrameLbl = "Animation frame: " + ofToString(animFrame+1) + " / " + ofToString(images.size());
             ofVec2f animFrameLblPos(animArea.getRight() - font->width(animFrameLbl), animArea.getBottom()+20);
             font->draw(animFrameLbl, animFrameLblPos.x, animFrameLblPos.y);
@@ -337,6 +443,43 @@ void ofApp::draw(){
 
 }
 
+//--------------------------------------------------------------
+void ofApp::drawImage(ofTexture& tex, const ofRectangle& area, int orientation){
+    
+    // EXIF orientation: 5-8 are turned a quarter, 2 / 4 / 5 / 7 mirrored
+    bool quarterTurn = orientation >= 5 && orientation <= 8;
+    float tW = tex.getWidth();
+    float tH = tex.getHeight();
+    float shownW = quarterTurn ? tH : tW;
+    float shownH = quarterTurn ? tW : tH;
+    float scale = min(area.width/shownW, area.height/shownH); // fit
+    
+    float angle = 0;
+    if (orientation == 3 || orientation == 4) angle = 180;
+    else if (orientation == 6 || orientation == 7) angle = 90;
+    else if (orientation == 5 || orientation == 8) angle = 270;
+    bool mirror = orientation == 2 || orientation == 4 || orientation == 5 || orientation == 7;
+    
+    // top left aligned like the unrotated image, turned about its center
+    ofPushMatrix();
+    ofTranslate(area.x + shownW*scale*0.5, area.y + shownH*scale*0.5);
+    ofRotateZ(angle);
+    if (mirror) ofScale(-1, 1);
+    tex.draw(-tW*scale*0.5, -tH*scale*0.5, tW*scale, tH*scale);
+    ofPopMatrix();
+}
+
+//--------------------------------------------------------------
+void ofApp::drawBlurFrame(const ofRectangle& area){
+    
+    ofPushStyle();
+    ofNoFill();
+    ofSetLineWidth(3);
+    ofSetColor(255, 0, 0);
+    ofDrawRectangle(area);
+    ofPopStyle();
+}
+
 //--------------------------------------------------------------
 void ofApp::updateGui(){
     
@@ -414,10 +557,12 @@ void ofApp::onDropdownEvent(ofxDatGuiDropdownEvent e){
 //--------------------------------------------------------------
 void ofApp::connectScanner(ofxDatGuiButtonEvent e){
     
+    // stop any background reconnect, it uses the serial port
+    scanner.disconnect(); // reset scanner connection, just in case
+    
     // if we're connected to serial, close the connection first
     if (serial.isInitialized() /*&& !scanner.isConnected()*/){
         serial.close();
-        scanner.disconnect(); // reset scanner connection, just in case
         ofLogNotice("ofSerial") << "closing current connection";
     }
     
@@ -433,6 +578,7 @@ void ofApp::connectScanner(ofxDatGuiButtonEvent e){
             serColor = ofColor::green;
             
             // connect to scanner, check if worked
+            scanner.setDevice(serialDevice, baudRate); // remembered for reconnects
             if (scanner.connect()){
                 newLbl = "Scanner Connected";
                 scanColor = ofColor::green;
@@ -449,25 +595,51 @@ void ofApp::connectScanner(ofxDatGuiButtonEvent e){
         serialDeviceDropdown->setLabelColor(serColor);
         
         
-        // send current values to scanner
+        // send only the values that differ from the scanner's saved config
         if (scanner.isConnected()){
-            scanner.setClockwise(clockwiseToggle->getChecked());
-            // use gui callbacks
-            gearInput->onFocusLost();
-            rpmSlider->dispatchSliderChangedEvent();
-            numShotsSlider->dispatchSliderChangedEvent();
-            waitSlider->dispatchSliderChangedEvent();
+            scanner.syncConfig(getGuiConfig());
         }
     }
 }
 
+//--------------------------------------------------------------
+Scanner::Config ofApp::getGuiConfig(){
+    
+    Scanner::Config config;
+    config.rpm = rpmSlider->getValue();
+    config.numShots = numShotsSlider->getValue();
+    config.clockwise = clockwiseToggle->getChecked();
+    config.waitMs = waitSlider->getValue()*1000; // sec -> ms
+    int nSteps = 0;
+    config.nStepsTurntable = parseGearRatio(gearInput->getText(), &nSteps) ? nSteps : scanner.getNumStepsTurntable();
+    return config;
+}
+
 //--------------------------------------------------------------
 void ofApp::newGearRatioInput(ofxDatGuiTextInputEvent e){
     
-    // parse gear ratio
-    vector <string> tokens = ofSplitString(e.target->getText(),":",true,true); // ignore empty + trim
+    int nSteps = 0;
+    bool good = parseGearRatio(e.target->getText(), &nSteps);
     
-    bool good = false; float gr = 0; int nSteps = 0;
+    if (good){
+        // set gear ratio
+        string lbl = e.target->getText() + " - " + ofToString(nSteps) + " steps/rot";
+        scanner.setNumStepsTurntable(nSteps);
+        e.target->setText(lbl);
+        e.target->setLabelColor(ofColor::white);
+    } else {
+        string lbl = "invalid - " + ofToString(nSteps) + " steps/rot";
+        e.target->setText(lbl);
+        e.target->setLabelColor(ofColor::red);
+    }
+    
+}
+
+//--------------------------------------------------------------
+bool ofApp::parseGearRatio(string ratio, int* nSteps){
+    
+    // parse gear ratio
+    vector <string> tokens = ofSplitString(ratio,":",true,true); // ignore empty + trim
     
     if (tokens.size() == 2) { // good
         
@@ -476,28 +648,16 @@ void ofApp::newGearRatioInput(ofxDatGuiTextInputEvent e){
         
         if (motor != 0 && turntable != 0){ // good
             
-            gr = (float)turntable/(float)motor; // calc gr as float
-            nSteps = 4096 * gr; // calc num motor steps per turntable rotation
+            float gr = (float)turntable/(float)motor; // calc gr as float
+            *nSteps = 4096 * gr; // calc num motor steps per turntable rotation
             
-            if (nSteps > 0 && nSteps <= 32767) { // max arduino range
+            if (*nSteps > 0 && *nSteps <= 32767) { // max arduino range
                 
-                good = true; // good!
+                return true; // good!
             }
         }
     }
-    
-    if (good){
-        // set gear ratio
-        string lbl = e.target->getText() + " - " + ofToString(nSteps) + " steps/rot";
-        scanner.setNumStepsTurntable(nSteps);
-        e.target->setText(lbl);
-        e.target->setLabelColor(ofColor::white);
-    } else {
-        string lbl = "invalid - " + ofToString(nSteps) + " steps/rot";
-        e.target->setText(lbl);
-        e.target->setLabelColor(ofColor::red);
-    }
-    
+    return false;
 }
 
 //--------------------------------------------------------------
@@ -525,92 +685,330 @@ bool ofApp::loadWatchFolder(string path){
     
     // load watch folder
     
-    if (file.isDirectory()) {        // already dir, load
-        watchFolder = ofDirectory(path);
-        
-    } else {        // find enclosing dir, load
-        string dir = file.getEnclosingDirectory();
-        watchFolder = ofDirectory(dir);
-    }
+    string dir = file.isDirectory() ? path : file.getEnclosingDirectory(); // find enclosing dir if file
     
-    if (watchFolder.isDirectory()){ // double check
+    // reset images vector & animation stuff before the watcher queues the existing files
+    clearImages();
+    
+    if (watchFolder.setup(dir, {"jpg", "jpeg", "cr2", "cr3"})){ // jpegs + canon RAW (shown via embedded preview)
         
-        watchFolder.allowExt("jpg"); // allow only jpegs
-
-        watchFolder.listDir(); // list
-        watchFolder.sort(); // sort alphabetical
+        // shot poses go next to the images, files already in it aren't matched again
+        shotMatcher.clear();
+        manifest.setup(watchFolder.getPath());
+        hullSession = manifest.size() > 0 ? manifest.getRecord(manifest.size()-1).sessionId : manifest.getSessionId(); // last rotation shot into it
         
-        vector <ofFile> files = watchFolder.getFiles(); // get files
+        // rig geometry for carving, template written on first use
+        string geomPath = ofFilePath::join(watchFolder.getPath(), TurntableGeometry::fileName);
+        geometry = TurntableGeometry();
+        if (!ofFile(geomPath).exists()) {
+            geometry.save(geomPath);
+            ofLogNotice("ofApp") << "measure the rig + fill in " << geomPath << " before carving";
+        }
+        else geometry.load(geomPath);
+        hull.setGeometry(geometry);
+        undistorter.setGeometry(geometry);
+        
+        vector <string> files = watchFolder.getFiles(); // sorted alphabetical
         int nFiles = files.size();
         
-        ofLogVerbose("ofApp") << "\n  watch folder:\n    " << watchFolder.getAbsolutePath() << "\n  contains " << nFiles << " jpeg files:";
+        ofLogVerbose("ofApp") << "\n  watch folder:\n    " << watchFolder.getPath() << "\n  contains " << nFiles << " jpeg / RAW files:";
         if (ofGetLogLevel() == OF_LOG_VERBOSE){
             for (int i=0; i<files.size(); i++){
-                cout << "    " << files[i].getAbsolutePath() << endl;
+                cout << "    " << files[i] << endl;
             }
         }
         // set folder input text to path
         folderInput->setLabelColor(ofColor::green);
-        folderInput->setText(watchFolder.getAbsolutePath());
-        
-        // reset images vector & animation stuff
-        loadedFiles.clear();
-        images.clear();
-        animSwitchTime = ofGetElapsedTimef();
-        animFrame = 0;
+        folderInput->setText(watchFolder.getPath());
         
         return true;
     }
     
-    ofLogError("ofApp::loadWatchFolder") << "watch folder load error! - " << watchFolder.getAbsolutePath();
+    ofLogError("ofApp::loadWatchFolder") << "watch folder load error! - " << dir;
     return false;
 
     
 }
 
 //--------------------------------------------------------------
-int ofApp::loadNewImages(){
+int ofApp::loadNewImages(int* numLanded){
     
     int numNew = 0;
+    int numLandedFiles = 0;
     
-    watchFolder.listDir(); // relist
-    
-    if (loadedFiles.size() < watchFolder.getFiles().size()){ // new image(s)
+    // apply watcher events in order - nothing queued, nothing to do
+    // removes + renames are applied in place, decoded images and current frame are kept
+    // RAW+JPEG pairs (same name, different extension) are one image - the twin just stands by
+    WatchFolder::Event e;
+    while (watchFolder.getNextEvent(e)){
         
-        watchFolder.sort(); // sort alphabetical
-        
-        for (int w=0; w<watchFolder.getFiles().size(); w++){ // find new
-            
-            bool loaded = false;
-            for (int l=0; l<loadedFiles.size(); l++){
-                if (loadedFiles[l] == watchFolder[w])
-                    loaded = true; // check against loaded files
+        if (e.type == WatchFolder::FILE_RENAMED){
+            string oldStem = ofFilePath::removeExt(e.oldPath);
+            map<string, string>::iterator twin = pairedFiles.find(oldStem);
+            if (twin != pairedFiles.end() && twin->second == e.oldPath){ // standby twin renamed, treat as re-landed
+                pairedFiles.erase(twin);
+                e.type = WatchFolder::FILE_ADDED;
             }
-            
-            if (loaded == false){ // new image, load
-                
-                ofFile imgFile(watchFolder.getFiles()[w]);
-                ofImage img;
-                if (img.load(imgFile)){
-                    images.push_back(img);
-                    loadedFiles.push_back(imgFile);
+            else {
+                images.rename(images.find(e.oldPath), e.path);
+                if (twin != pairedFiles.end() && oldStem != ofFilePath::removeExt(e.path)){ // no longer a pair, show both
+                    images.add(twin->second);
+                    pairedFiles.erase(twin);
                     numNew++;
-                    
-                } else {
-                    ofLogError("ofApp::loadNewImages") << "error loading image file: " << imgFile.getAbsolutePath();
                 }
+                continue;
+            }
+        }
+        
+        if (e.type == WatchFolder::FILE_ADDED){ // new image, queue decode - shown once uploaded
+            string stem = ofFilePath::removeExt(e.path);
+            string pairedWith = "";
+            for (int i=images.size()-1; i>=0 && pairedWith == ""; i--){ // newest first, twins land back to back
+                if (ofFilePath::removeExt(images.getPath(i)) == stem) pairedWith = images.getPath(i);
+            }
+            if (pairedWith != "") {
+                pairedFiles[stem] = e.path; // second half of a RAW+JPEG shot, already landed
+                if (!manifest.contains(ofFilePath::getFileName(e.path))) waitingOnExif.push_back(make_pair(e.path, pairedWith)); // same shot as its twin
+                continue;
+            }
+            images.add(e.path); // last for now, moves into capture order once its EXIF is read
+            masker.add(e.path); // waits for a background if none yet
+            features.add(e.path);
+            if (!manifest.contains(ofFilePath::getFileName(e.path))) waitingOnExif.push_back(make_pair(e.path, e.path));
+            numNew++;
+            // the shot landing: only a file new to the folder, written since the last shutter (not an opened / rescanned folder's)
+            struct stat st;
+            if (!e.existing && lastShutterTime > 0 && stat(e.path.c_str(), &st) == 0 && (int64_t)st.st_mtime * 1000 + 1000 > lastShutterTime) numLandedFiles++;
+        }
+        else { // FILE_REMOVED
+            string stem = ofFilePath::removeExt(e.path);
+            map<string, string>::iterator twin = pairedFiles.find(stem);
+            if (twin != pairedFiles.end() && twin->second == e.path){ // standby twin gone, nothing shown changes
+                pairedFiles.erase(twin);
+                continue;
+            }
+            int i = images.find(e.path);
+            if (i < 0) continue;
+            if (twin != pairedFiles.end()){ // shown half of a pair gone, the other half takes its place (same shot, keeps decoded images)
+                images.rename(i, twin->second);
+                pairedFiles.erase(twin);
+                continue;
             }
+            removeImage(i);
         }
-    } else if (loadedFiles.size() > watchFolder.getFiles().size()) { // img delete, reload all
-        loadedFiles.clear();
-        images.clear();
-        animSwitchTime = ofGetElapsedTimef();
-        animFrame = 0;
-        numNew = loadNewImages();
     }
+    if (numLanded != NULL) *numLanded = numLandedFiles; // new on disk
     return numNew;
 }
 
+//--------------------------------------------------------------
+void ofApp::removeImage(int i){
+    
+    images.remove(i);
+    // keep showing the same images, step back if the removed one was showing
+    if (imgIdx > i || (imgIdx == i && imgIdx >= images.size())) imgIdx--;
+    if (animFrame > i || (animFrame == i && animFrame >= images.size())) animFrame--;
+    imgIdx = max(imgIdx, 0);
+    animFrame = max(animFrame, 0);
+    if (images.size() > 0){
+        imgSlider->setMax(images.size());
+        imgSlider->setValue(imgIdx+1);
+    }
+}
+
+//--------------------------------------------------------------
+static CaptureManifest::Record shotRecord(const Scanner::ShutterEvent& shot){
+    
+    CaptureManifest::Record r;
+    memset(&r, 0, sizeof(r));
+    r.shutterTime = shot.time;
+    r.step = shot.step;
+    r.stepsPerRev = shot.stepsPerRev;
+    r.degree = shot.degree;
+    r.shotIndex = shot.shotIndex;
+    r.clockwise = shot.clockwise;
+    if (shot.reshoot) r.flags |= CaptureManifest::RECORD_RESHOOT;
+    return r;
+}
+
+//--------------------------------------------------------------
+void ofApp::matchLandedFiles(){
+    
+    // in landing order, arrival order is the matcher's fallback when the camera clock isn't known
+    while (!waitingOnExif.empty()){
+        int i = images.find(waitingOnExif.front().second);
+        if (i < 0) i = images.find(waitingOnExif.front().first); // shown half gone, twin took its place
+        if (i >= 0 && !images.hasMeta(i)) break; // EXIF not read yet
+        string path = waitingOnExif.front().first;
+        bool twin = path != waitingOnExif.front().second;
+        waitingOnExif.pop_front();
+        if (i < 0) continue; // removed before it was read, nothing to match
+        if (twin) shotMatcher.addTwin(path, images.getMeta(i).captureTime); // same shot (+ camera time) as the shown half, or none
+        else shotMatcher.addFile(path, images.getMeta(i).captureTime);
+    }
+}
+
+//--------------------------------------------------------------
+void ofApp::recordShots(){
+    
+    ShotMatcher::Match m;
+    while (shotMatcher.getNextMatch(m)){
+        CaptureManifest::Record r = shotRecord(m.shot);
+        r.captureTime = m.captureTime;
+        string name = ofFilePath::getFileName(m.path);
+        if (name.size() >= sizeof(r.fileName)) {
+            ofLogWarning("ofApp::recordShots") << "file name too long for manifest, skipped: " << name;
+            continue;
+        }
+        strncpy(r.fileName, name.c_str(), sizeof(r.fileName));
+        if (manifest.append(r)) ofLogVerbose("ofApp::recordShots") << name << ": shot " << r.shotIndex << " at " << r.degree << " deg";
+    }
+    
+    // shots with no file in time: note the gap, retake it after the rotation
+    shotMatcher.update();
+    Scanner::ShutterEvent missed;
+    while (shotMatcher.getNextMissed(missed)){
+        ofLogWarning("ofApp::recordShots") << "no file for shot " << missed.shotIndex << " at " << missed.degree << " deg";
+        CaptureManifest::Record r = shotRecord(missed);
+        r.flags |= CaptureManifest::RECORD_MISSED;
+        manifest.append(r);
+        reshoots.add(missed);
+    }
+}
+
+//--------------------------------------------------------------
+void ofApp::checkBlurryShots(){
+    
+    string path;
+    while (images.getNextBlurry(&path)){
+        string name = ofFilePath::getFileName(path);
+        int r = manifest.find(name);
+        if (r < 0 || manifest.getRecord(r).shotIndex < 0) { // not an autoscan shot, just flag it
+            ofLogWarning("ofApp::checkBlurryShots") << name << " is blurry";
+            continue;
+        }
+        
+        // same step as the blurry one, retaken once the rotation is done - only shots of this rotation,
+        // not ones of earlier sessions found blurry when a folder is (re)loaded
+        const CaptureManifest::Record& rec = manifest.getRecord(r);
+        bool reshoot = reshootBlurToggle->getChecked() && rec.sessionId == manifest.getSessionId()
+            && autoscanStartTime > 0 && rec.shutterTime >= autoscanStartTime;
+        ofLogWarning("ofApp::checkBlurryShots") << name << " is blurry (shot " << rec.shotIndex << " at " << rec.degree << " deg)" << (reshoot ? ", reshooting" : "");
+        if (!reshoot) continue;
+        Scanner::ShutterEvent shot;
+        shot.time = rec.shutterTime;
+        shot.step = rec.step;
+        shot.stepsPerRev = rec.stepsPerRev;
+        shot.degree = rec.degree;
+        shot.clockwise = rec.clockwise;
+        shot.shotIndex = rec.shotIndex;
+        reshoots.add(shot);
+    }
+}
+
+//--------------------------------------------------------------
+void ofApp::setBackground(int i){
+    
+    if (i < 0 || i >= images.size()) return;
+    masker.setReference(images.getPath(i));
+    hull.clear(); // masks change, carve again
+    unposedMasks.clear();
+    for (int j=0; j<images.size(); j++) masker.add(images.getPath(j)); // all shown so far, new ones as they land
+    ofLogNotice("ofApp") << "background: " << images.getFileName(i);
+}
+
+//--------------------------------------------------------------
+void ofApp::updateHull(){
+    
+    string path;
+    while (masker.getNextMask(&path)) unposedMasks.push_back(path);
+    
+    // pose from the shot's manifest record, masks of files not matched yet wait
+    // only shots of one session: between sessions the object (or rig) may have moved, poses wouldn't agree
+    for (int i=0; i<unposedMasks.size(); ){
+        int r = manifest.find(ofFilePath::getFileName(unposedMasks[i]));
+        if (r < 0) {
+            i++;
+            continue;
+        }
+        const CaptureManifest::Record& rec = manifest.getRecord(r);
+        if (rec.sessionId == hullSession) hull.addView(Masker::getMaskPath(unposedMasks[i]), CaptureManifest::getAngle(rec));
+        unposedMasks.erase(unposedMasks.begin() + i);
+    }
+    
+    if (hull.update() && hull.getNumPending() == 0 && hull.getNumViews() > 0){
+        ofLogVerbose("ofApp") << "hull: " << hull.getNumViews() << " views, " << hull.getNumVoxels() << " voxels (last carve " << hull.getLastCarveMs() << "ms)";
+    }
+}
+
+//--------------------------------------------------------------
+void ofApp::exportHull(MeshFormat format){
+    
+    shared_ptr<const VisualHull::Grid> grid = hull.getGrid();
+    if (!watchFolder.isWatching() || grid == NULL || grid->numViews == 0) {
+        ofLogWarning("ofApp") << "no hull to export yet";
+        return;
+    }
+    if (exporter.isBusy()) {
+        ofLogWarning("ofApp") << "still exporting the hull";
+        return;
+    }
+    exporter.start(grid, ofFilePath::join(watchFolder.getPath(), format == MESH_PLY ? "visual_hull.ply" : "visual_hull.obj"), format);
+}
+
+//--------------------------------------------------------------
+void ofApp::matchShots(){
+    
+    if (!watchFolder.isWatching() || matcher.isBusy()) return;
+    
+    // posed shots with features written, RAW+JPEG twins once (the shown file) - only .feat the extractor
+    // wrote or checked this session, not whatever is lying next to the images
+    // only shots of the session carved (as the hull): angles of different rotations don't pair up
+    vector<TurntableMatcher::Shot> shots;
+    for (int i=0; i<images.size(); i++){
+        int r = manifest.find(images.getFileName(i));
+        if (r < 0 || manifest.getRecord(r).sessionId != hullSession) continue;
+        if (!currentFeatures.count(FeatureExtractor::getFeaturePath(images.getPath(i)))) continue;
+        TurntableMatcher::Shot shot;
+        shot.imagePath = images.getPath(i);
+        shot.angle = CaptureManifest::getAngle(manifest.getRecord(r));
+        shots.push_back(shot);
+    }
+    if (shots.size() < 2) {
+        ofLogWarning("ofApp") << "not enough posed shots with features in this session to match";
+        return;
+    }
+    if (features.getNumPending() > 0) ofLogWarning("ofApp") << features.getNumPending() << " images still detecting, matching without them";
+    matcher.start(shots, geometry, ofFilePath::join(watchFolder.getPath(), TurntableMatcher::fileName));
+}
+
+//--------------------------------------------------------------
+void ofApp::cropImages(){
+    
+    if (!watchFolder.isWatching() || cropper.isBusy() || images.size() == 0) return;
+    
+    vector<string> paths;
+    for (int i=0; i<images.size(); i++) paths.push_back(images.getPath(i)); // RAW+JPEG twins once (the shown file)
+    if (masker.getNumPending() > 0) ofLogWarning("ofApp") << masker.getNumPending() << " images still masking, region from the masks written so far";
+    cropper.start(paths, watchFolder.getPath(), geometry); // masks are undistorted with it
+}
+
+//--------------------------------------------------------------
+void ofApp::clearImages(){
+    
+    images.clear(); // anything still decoding is dropped when it comes back
+    masker.clear();
+    hull.clear();
+    features.clear();
+    currentFeatures.clear();
+    unposedMasks.clear();
+    pairedFiles.clear();
+    waitingOnExif.clear();
+    animSwitchTime = ofGetElapsedTimef();
+    animFrame = 0;
+    imgIdx = 0;
+}
+
 //--------------------------------------------------------------
 void ofApp::resizeImgAreas(){
     
@@ -627,6 +1025,9 @@ void ofApp::resizeImgAreas(){
     ofVec2f topLeftAnim(imgArea.getRight()+10,imgArea.getTop());
     ofVec2f bottomRightAnim(topLeftAnim.x+imgArea.width,topLeftAnim.y+imgArea.height);
     animArea = ofRectangle(topLeftAnim,bottomRightAnim);
+    
+    // decode proxies big enough for the larger area (images already loaded keep their size)
+    images.setProxySize(max(64, (int)ceil(max(imgArea.width, animArea.width))));
 }
 
 //--------------------------------------------------------------
@@ -656,7 +1057,17 @@ void ofApp::windowResized(int w, int h){
 
 //--------------------------------------------------------------
 void ofApp::keyPressed(int key){
-
+    
+    if (key == 'f') { // toggle full res decode of shown image
+        bShowFullRes = !bShowFullRes; // full res stays cached within budget, evicted LRU
+    }
+    else if (key == 'b') { // shown image is the empty backdrop, mask against it
+        setBackground(imgIdx);
+    }
+    else if (key == 'e') exportHull(MESH_PLY);
+    else if (key == 'E') exportHull(MESH_OBJ);
+    else if (key == 'm') matchShots();
+    else if (key == 'c') cropImages();
 }
 
 //--------------------------------------------------------------
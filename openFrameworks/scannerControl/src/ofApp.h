@@ -3,6 +3,19 @@
 #include "ofMain.h"
 #include "ofxDatGui.h"
 #include "Scanner.hpp"
+#include "WatchFolder.hpp"
+#include "ImageStore.hpp"
+#include "CaptureManifest.hpp"
+#include "ShotMatcher.hpp"
+#include "ReshootQueue.hpp"
+#include "Undistorter.hpp"
+#include "Masker.hpp"
+#include "VisualHull.hpp"
+#include "MeshExtractor.hpp"
+#include "HullExporter.hpp"
+#include "FeatureExtractor.hpp"
+#include "TurntableMatcher.hpp"
+#include "RoiCropper.hpp"
 
 class GuiTheme : public ofxDatGuiTheme {
 public:
@@ -28,12 +41,26 @@ public:
     void onDropdownEvent(ofxDatGuiDropdownEvent e);
     void connectScanner(ofxDatGuiButtonEvent e);
     void newGearRatioInput(ofxDatGuiTextInputEvent e);
+    bool parseGearRatio(string ratio, int* nSteps); // "motor:table" -> # motor steps per table rotation, false if invalid
+    Scanner::Config getGuiConfig(); // scanner config as currently set in gui
     
     void newWatchFolderInput(ofxDatGuiTextInputEvent e);
     bool loadWatchFolder(string folderPath);
     
-    int loadNewImages();
+    int loadNewImages(int* numLanded = NULL); // applies watch folder changes, returns # images queued, numLanded = # files new on disk
+    void clearImages(); // drop images + any decodes / uploads in flight
+    void removeImage(int i); // keeps current image / animation frame showing
+    void matchLandedFiles(); // landed files whose EXIF is in -> shot matcher, in landing order
+    void recordShots(); // matched shutter events + files -> capture manifest, missed shots -> manifest + reshoot queue
+    void checkBlurryShots(); // flags blurry images, queues reshoots if enabled
+    void setBackground(int i); // image i is the empty backdrop, masks every other image ('b' key)
+    void updateHull(); // new masks with a known turntable pose -> visual hull
+    void exportHull(MeshFormat format); // current hull -> mesh file in the watch folder ('e' / 'E' key)
+    void matchShots(); // features of posed shots (hull session only) -> matches.bin in the watch folder, angular neighbours only ('m' key)
+    void cropImages(); // working copies cut to the object's region -> roi/ in the watch folder ('c' key)
     void resizeImgAreas();
+    void drawImage(ofTexture& tex, const ofRectangle& area, int orientation); // fit into area, EXIF orientation applied
+    void drawBlurFrame(const ofRectangle& area); // red outline, image flagged blurry
  
     //void setTurnDegreesLabel();
     
@@ -54,6 +81,7 @@ public:
     vector <int> baudRates;
     int baudRate = 0;
     Scanner scanner;
+    Scanner::LinkState linkState = Scanner::LINK_DISCONNECTED; // last shown in gui
     
     float startRotateTime = 0;
     float waitBetweenRotatePresses = 0.1;
@@ -74,6 +102,8 @@ public:
     ofxDatGuiLabel* camReadyLabel;
     ofxDatGuiToggle* clockwiseToggle;
     ofxDatGuiToggle* autoscanToggle;
+    ofxDatGuiToggle* advanceToggle; // end wait after shot as soon as photo lands in watch folder
+    ofxDatGuiToggle* reshootBlurToggle; // retake blurry autoscan shots after the rotation
     ofxDatGuiLabel* autoscanLabel;
     ofxDatGuiButton* shutterBtn;
     ofxDatGuiButton* turnBtn;
@@ -91,9 +121,27 @@ public:
     ofxDatGuiSlider* animSpeedSlider;
     ofxDatGuiSlider* animPauseSlider;
     
-    ofDirectory watchFolder;
-    vector <ofFile> loadedFiles;
-    vector <ofImage> images;
+    WatchFolder watchFolder; // indexes folder + reports new/removed files off the main thread
+    ImageStore images; // proxies decoded + uploaded in the background, full res on demand within RAM/VRAM budget
+    CaptureManifest manifest; // turntable pose of every shot, in the watch folder
+    ShotMatcher shotMatcher; // shutter events <-> landed files
+    ReshootQueue reshoots; // missed autoscan shots, retaken after the rotation
+    int64_t lastShutterTime = 0; // ms since 1970 (shutter clock), files written before it don't count as the shot landing
+    int64_t autoscanStartTime = 0; // ms since 1970 (shutter clock), only shots of the running rotation are reshot for blur
+    Undistorter undistorter; // lens distortion out of images before masking / features (outlives both)
+    Masker masker; // object masks next to the images, against a backdrop shot
+    TurntableGeometry geometry; // camera vs turntable, scan_geometry.txt in the watch folder
+    VisualHull hull; // carved from the masks as they're written
+    HullExporter exporter; // hull -> mesh file, on its own thread
+    uint64_t hullSession = 0; // manifest session carved: the running rotation, or the last one recorded when a folder is opened
+    deque<string> unposedMasks; // masked images not matched to a shot (manifest record) yet
+    FeatureExtractor features; // keypoints + descriptors next to each image as it lands
+    set<string> currentFeatures; // .feat files written (or found current) since the folder was opened
+    TurntableMatcher matcher; // matches between neighbouring shots, on its own thread
+    RoiCropper cropper; // cropped working copies of the rotation, on its own thread
+    map<string, string> pairedFiles; // RAW+JPEG shots: path without extension -> the twin not shown (first to land is shown)
+    deque<pair<string, string> > waitingOnExif; // landed files not in the manifest yet -> the shown image whose EXIF they go by (itself or its twin)
+    bool bShowFullRes = false; // full resolution of current image ('f' key)
     ofRectangle imgArea, animArea; // latest image and looping animation
     int imgIdx = 0; // current img to show
     float animSwitchTime = 0; // time of last frame switch